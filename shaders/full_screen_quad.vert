@@ -2,6 +2,10 @@
 
 layout(location = 0) out vec2 TexCoordOutput;
 
+layout(push_constant) uniform FullScreenQuadPushConstants {
+    vec2 uv_scale;
+} state;
+
 vec2 QuadVertices[] = {
     vec2(-1.0, -1.0),
     vec2(+1.0, -1.0),
@@ -23,5 +27,5 @@ uint QuadIndices[] = {
 
 void main() {
     gl_Position = vec4(QuadVertices[QuadIndices[gl_VertexIndex]], 0.0, 1.0);
-    TexCoordOutput = QuadTexCoords[QuadIndices[gl_VertexIndex]];
+    TexCoordOutput = QuadTexCoords[QuadIndices[gl_VertexIndex]] * state.uv_scale;
 }
@@ -1,12 +1,22 @@
 #version 450 core
 
+#extension GL_EXT_nonuniform_qualifier : enable
+
 layout(location = 0) in vec2 in_frag_texcoord;
 layout(location = 1) in vec4 in_frag_color;
 
 layout(location = 0) out vec4 out_frag_color;
 
-layout(set = 0, binding = 0) uniform sampler2D Texture;
+// bindless texture table, see BindlessTextureTable
+layout(set = 1, binding = 0) uniform sampler2D textures[];
+
+// shared with imgui.vert, texture_index selects the draw command's texture
+layout(push_constant) uniform uPushConstant {
+    vec2 uScale;
+    vec2 uTranslate;
+    uint texture_index;
+} pc;
 
 void main() {
-    out_frag_color = in_frag_color * texture(Texture, in_frag_texcoord);
-}
\ No newline at end of file
+    out_frag_color = in_frag_color * texture(textures[pc.texture_index], in_frag_texcoord);
+}
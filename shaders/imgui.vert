@@ -7,6 +7,7 @@ layout(location = 2) in vec4 in_vert_color;
 layout(push_constant) uniform uPushConstant {
     vec2 uScale;
     vec2 uTranslate;
+    uint texture_index;
 } pc;
 
 layout(location = 0) out vec2 out_vert_texcoord;
@@ -0,0 +1,23 @@
+#version 460 core
+
+#extension GL_EXT_nonuniform_qualifier : require
+
+layout(location = 0) in vec2 in_frag_texcoord;
+layout(location = 1) in vec4 in_frag_color;
+layout(location = 2) flat in vec4 in_frag_clip_rect;
+layout(location = 3) flat in uint in_frag_texture_index;
+
+layout(location = 0) out vec4 out_frag_color;
+
+// bindless texture table, see BindlessTextureTable
+layout(set = 1, binding = 0) uniform sampler2D textures[];
+
+void main() {
+    // the clip rect replaces the per-draw scissor, in framebuffer pixels with max exclusive
+    if (any(lessThan(gl_FragCoord.xy, in_frag_clip_rect.xy)) || any(greaterThanEqual(gl_FragCoord.xy, in_frag_clip_rect.zw))) {
+        discard;
+    }
+
+    // draws sharing a subgroup can use different textures
+    out_frag_color = in_frag_color * texture(textures[nonuniformEXT(in_frag_texture_index)], in_frag_texcoord);
+}
@@ -0,0 +1,40 @@
+#version 460 core
+
+#extension GL_EXT_buffer_reference : require
+
+layout(location = 0) in vec2 in_vert_position;
+layout(location = 1) in vec2 in_vert_texcoord;
+layout(location = 2) in vec4 in_vert_color;
+
+// one per indirect draw command, see ImGuiIndirectDraw
+struct DrawParameters {
+    vec4 clip_rect;
+    uint texture_index;
+    uint padding[3];
+};
+
+layout(buffer_reference, std430, buffer_reference_align = 16) readonly buffer DrawBufferReference {
+    DrawParameters draws[];
+};
+
+layout(push_constant) uniform uPushConstant {
+    vec2                uScale;
+    vec2                uTranslate;
+    DrawBufferReference draw_buffer;
+} pc;
+
+layout(location = 0) out vec2 out_vert_texcoord;
+layout(location = 1) out vec4 out_vert_color;
+layout(location = 2) flat out vec4 out_vert_clip_rect;
+layout(location = 3) flat out uint out_vert_texture_index;
+
+void main() {
+    DrawParameters draw = pc.draw_buffer.draws[gl_DrawID];
+
+    out_vert_color = in_vert_color;
+    out_vert_texcoord = in_vert_texcoord;
+    out_vert_clip_rect = draw.clip_rect;
+    out_vert_texture_index = draw.texture_index;
+
+    gl_Position = vec4(in_vert_position * pc.uScale + pc.uTranslate, 0, 1);
+}
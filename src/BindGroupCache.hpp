@@ -0,0 +1,166 @@
+#pragma once
+
+#include "gpu.hpp"
+#include "ManagedObject.hpp"
+
+// Descriptor sets keyed by their layout and contents, reused across frames instead of being allocated and written again.
+//
+// A cached set is written once and never updated afterwards, so handing the same set to several frames in flight is safe.
+// Sets not requested for MAX_IDLE_FRAMES frames, or referring to a forgotten image view, are retired and rewritten for a
+// new key once the last frame that used them has completed. Sets of a forgotten layout are dropped, they stay in the pools
+// until the cache is destroyed. Only used by the thread recording frames.
+class BindGroupCache : public ManagedObject {
+public:
+    static constexpr u64 MAX_IDLE_FRAMES = 120;
+
+    GpuContext*             context;
+
+    // counters for the UI
+    u64                     hit_count   = 0;
+    u64                     miss_count  = 0;
+
+private:
+    struct KeyHash {
+        auto operator()(const std::vector<u64>& key) const -> usize {
+            return std::hash<std::string_view>{}(std::string_view(reinterpret_cast<const char*>(key.data()), key.size() * sizeof(u64)));
+        }
+    };
+
+    struct Entry {
+        vk::DescriptorSet       bind_group          = {};
+        vk::DescriptorSetLayout bind_group_layout   = {};
+        u64                     last_used_frame     = {};
+    };
+
+    GpuBindGroupAllocator                                   allocator;
+    std::unordered_map<std::vector<u64>, Entry, KeyHash>    entries;
+    std::vector<Entry>                                      retired;
+    std::vector<u64>                                        scratch_key;
+    u64                                                     current_frame_value     = 0;
+    u64                                                     completed_frame_value   = 0;
+
+public:
+    explicit BindGroupCache(GpuContext* context) : context(context) {}
+
+    ~BindGroupCache() override {
+        gpu_destroy_bind_group_allocator(context, &allocator);
+    }
+
+    // Called once per frame before recording, frame values are those of VulkanRenderer.
+    void BeginFrame(u64 current_frame, u64 completed_frame) {
+        current_frame_value = current_frame;
+        completed_frame_value = completed_frame;
+
+        for (auto it = entries.begin(); it != entries.end();) {
+            if (it->second.last_used_frame + MAX_IDLE_FRAMES < current_frame_value) {
+                retired.push_back(it->second);
+                it = entries.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    // Returns a set holding exactly these writes, dstSet of the writes is ignored. Only image and buffer descriptors are
+    // supported, and layouts created with eUpdateAfterBindPool need a pool of their own.
+    auto GetBindGroup(vk::DescriptorSetLayout bind_group_layout, Slice<vk::WriteDescriptorSet> writes) -> vk::DescriptorSet {
+        BuildKey(bind_group_layout, writes);
+
+        auto it = entries.find(scratch_key);
+        if (it != entries.end()) {
+            it->second.last_used_frame = current_frame_value;
+            hit_count += 1;
+            return it->second.bind_group;
+        }
+        miss_count += 1;
+
+        auto bind_group = AllocateBindGroup(bind_group_layout);
+
+        auto bound_writes = std::vector<vk::WriteDescriptorSet>(writes.begin(), writes.end());
+        for (auto& write : bound_writes) {
+            write.setDstSet(bind_group);
+        }
+        context->logical_device.updateDescriptorSets(bound_writes, nullptr);
+
+        entries.emplace(scratch_key, Entry{
+            .bind_group = bind_group,
+            .bind_group_layout = bind_group_layout,
+            .last_used_frame = current_frame_value,
+        });
+        return bind_group;
+    }
+
+    // Retires every set referring to the view; called before the view is destroyed, whose handle may then be reused.
+    void ForgetImageView(vk::ImageView view) {
+        auto handle = reinterpret_cast<u64>(static_cast<VkImageView>(view));
+        for (auto it = entries.begin(); it != entries.end();) {
+            if (std::find(it->first.begin(), it->first.end(), handle) != it->first.end()) {
+                retired.push_back(it->second);
+                it = entries.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    // Drops every set of the layout, cached or retired; called before the layout is destroyed, whose handle may then be
+    // reused by a layout the sets do not match.
+    void ForgetBindGroupLayout(vk::DescriptorSetLayout bind_group_layout) {
+        for (auto it = entries.begin(); it != entries.end();) {
+            if (it->second.bind_group_layout == bind_group_layout) {
+                it = entries.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        std::erase_if(retired, [&](const Entry& entry) {
+            return entry.bind_group_layout == bind_group_layout;
+        });
+    }
+
+    auto GetSize() const -> usize {
+        return entries.size();
+    }
+
+private:
+    void BuildKey(vk::DescriptorSetLayout bind_group_layout, Slice<vk::WriteDescriptorSet> writes) {
+        scratch_key.clear();
+        scratch_key.push_back(reinterpret_cast<u64>(static_cast<VkDescriptorSetLayout>(bind_group_layout)));
+
+        for (auto& write : writes) {
+            scratch_key.push_back(write.dstBinding);
+            scratch_key.push_back(write.dstArrayElement);
+            scratch_key.push_back(static_cast<u64>(write.descriptorType));
+            scratch_key.push_back(write.descriptorCount);
+
+            for (u32 i = 0; i < write.descriptorCount; ++i) {
+                if (write.pImageInfo != nullptr) {
+                    auto& info = write.pImageInfo[i];
+                    scratch_key.push_back(reinterpret_cast<u64>(static_cast<VkSampler>(info.sampler)));
+                    scratch_key.push_back(reinterpret_cast<u64>(static_cast<VkImageView>(info.imageView)));
+                    scratch_key.push_back(static_cast<u64>(info.imageLayout));
+                } else if (write.pBufferInfo != nullptr) {
+                    auto& info = write.pBufferInfo[i];
+                    scratch_key.push_back(reinterpret_cast<u64>(static_cast<VkBuffer>(info.buffer)));
+                    scratch_key.push_back(info.offset);
+                    scratch_key.push_back(info.range);
+                } else {
+                    assert(false && "BindGroupCache only supports image and buffer descriptors");
+                }
+            }
+        }
+    }
+
+    // Reuses a retired set of the same layout once no frame in flight can still be reading it.
+    auto AllocateBindGroup(vk::DescriptorSetLayout bind_group_layout) -> vk::DescriptorSet {
+        for (usize i = 0; i < retired.size(); ++i) {
+            if (retired[i].bind_group_layout == bind_group_layout && retired[i].last_used_frame <= completed_frame_value) {
+                auto bind_group = retired[i].bind_group;
+                retired[i] = retired.back();
+                retired.pop_back();
+                return bind_group;
+            }
+        }
+        return gpu_bind_group_allocator_allocate(context, &allocator, bind_group_layout);
+    }
+};
@@ -0,0 +1,108 @@
+#pragma once
+
+#include "gpu.hpp"
+#include "ManagedObject.hpp"
+
+// One long-lived descriptor set with a runtime array of combined image samplers, shaders index it with
+// GpuTexture::bindless_index instead of getting a descriptor set per draw.
+//
+// Declared in shaders as `layout(set = BIND_GROUP_INDEX, binding = 0) uniform sampler2D textures[];`, the reflected
+// layout of such a shader is then identical to bind_group_layout, see gpu_create_bind_group_layout. Slots are written
+// with update-after-bind, so textures can be registered while earlier frames using the set are still in flight.
+class BindlessTextureTable : public ManagedObject {
+public:
+    static constexpr u32 BIND_GROUP_INDEX = 1;
+
+    GpuContext*             context;
+    vk::DescriptorSetLayout bind_group_layout;
+    vk::DescriptorPool      bind_group_pool;
+    vk::DescriptorSet       bind_group;
+
+private:
+    std::vector<u32>        free_indices;
+    u32                     next_index = 0;
+
+public:
+    explicit BindlessTextureTable(GpuContext* context) : context(context) {
+        auto entries = std::array{
+            vk::DescriptorSetLayoutBinding(0, vk::DescriptorType::eCombinedImageSampler, 0, vk::ShaderStageFlagBits::eAll)
+        };
+        bind_group_layout = gpu_create_bind_group_layout(context, entries);
+
+        auto pool_sizes = std::array{
+            vk::DescriptorPoolSize(vk::DescriptorType::eCombinedImageSampler, GPU_BINDLESS_DESCRIPTOR_COUNT)
+        };
+
+        auto pool_create_info = vk::DescriptorPoolCreateInfo()
+            .setFlags(vk::DescriptorPoolCreateFlagBits::eUpdateAfterBind)
+            .setMaxSets(1)
+            .setPoolSizes(pool_sizes);
+
+        bind_group_pool = context->logical_device.createDescriptorPool(pool_create_info);
+
+        auto allocate_info = vk::DescriptorSetAllocateInfo()
+            .setDescriptorPool(bind_group_pool)
+            .setSetLayouts(bind_group_layout);
+
+        vk::resultCheck(context->logical_device.allocateDescriptorSets(&allocate_info, &bind_group), "Failed to allocate bindless descriptor set");
+    }
+
+    ~BindlessTextureTable() override {
+        context->logical_device.destroyDescriptorPool(bind_group_pool);
+        context->logical_device.destroyDescriptorSetLayout(bind_group_layout);
+    }
+
+    // Writes the texture into a free slot and stores the slot in texture->bindless_index.
+    void Register(GpuTexture* texture, vk::ImageLayout layout = vk::ImageLayout::eShaderReadOnlyOptimal) {
+        if (texture->bindless_index != GPU_BINDLESS_INVALID_INDEX) {
+            return;
+        }
+
+        u32 index;
+        if (!free_indices.empty()) {
+            index = free_indices.back();
+            free_indices.pop_back();
+        } else if (next_index < GPU_BINDLESS_DESCRIPTOR_COUNT) {
+            index = next_index++;
+        } else {
+            throw std::runtime_error("Bindless texture table is full");
+        }
+
+        auto image_info = vk::DescriptorImageInfo()
+            .setSampler(texture->sampler)
+            .setImageView(texture->view)
+            .setImageLayout(layout);
+
+        auto writes = std::array{
+            vk::WriteDescriptorSet()
+                .setDstSet(bind_group)
+                .setDstBinding(0)
+                .setDstArrayElement(index)
+                .setDescriptorType(vk::DescriptorType::eCombinedImageSampler)
+                .setDescriptorCount(1)
+                .setPImageInfo(&image_info)
+        };
+
+        context->logical_device.updateDescriptorSets(writes, nullptr);
+        texture->bindless_index = index;
+    }
+
+    // The slot is reused right away, so the GPU must be done with the texture, as it must be before destroying it.
+    void Unregister(GpuTexture* texture) {
+        if (texture->bindless_index == GPU_BINDLESS_INVALID_INDEX) {
+            return;
+        }
+        free_indices.push_back(texture->bindless_index);
+        texture->bindless_index = GPU_BINDLESS_INVALID_INDEX;
+    }
+
+    // The slot for a shader to sample texture through, or fallback's for a texture that was never registered, whose invalid
+    // index would read past the table.
+    static auto GetIndex(const GpuTexture* texture, const GpuTexture* fallback) -> u32 {
+        return texture->bindless_index != GPU_BINDLESS_INVALID_INDEX ? texture->bindless_index : fallback->bindless_index;
+    }
+
+    auto GetRegisteredCount() const -> u32 {
+        return next_index - static_cast<u32>(free_indices.size());
+    }
+};
@@ -0,0 +1,248 @@
+#pragma once
+
+#include "DrawDataSnapshot.hpp"
+
+// Rewrites ImDrawData into fewer draw commands before encoding, without changing the visible result.
+//
+// Within each draw list, never across a user callback:
+// - commands whose geometry lies entirely outside their clip rect are dropped,
+// - a command moves up next to an earlier one with the same texture when it overlaps none of the commands it passes,
+// - neighbours with the same texture merge when their clip rects are equal, or when neither clip rect actually clips its
+//   geometry, in which case the merged command gets the bounding rect of both.
+// Indices are rewritten in the new order so every merged command is one contiguous range, vertex buffers are shared with
+// the source. The result is valid until the next Build and as long as the source draw data.
+class DrawBatcher {
+public:
+    // how far ahead a command with the same texture is looked for, keeps the pass close to linear
+    static constexpr usize REORDER_WINDOW = 64;
+
+    // pixels kept between geometry and a clip rect edge before the clip rect counts as not clipping, covers the rounding
+    // of clip rects to scissors and dispatch rects
+    static constexpr f32 CLIP_MARGIN_PIXELS = 2.0F;
+
+    DrawBatcher() = default;
+    DrawBatcher(const DrawBatcher&) = delete;
+    auto operator=(const DrawBatcher&) -> DrawBatcher& = delete;
+
+    ~DrawBatcher() {
+        DetachLists();
+    }
+
+    auto Build(const ImDrawData* source) -> ImDrawData* {
+        DetachLists();
+        arena.Reset();
+        input_command_count = 0;
+        output_command_count = 0;
+
+        auto min_scale = std::min(source->FramebufferScale.x, source->FramebufferScale.y);
+        clip_margin = CLIP_MARGIN_PIXELS / (min_scale > 0.0F ? min_scale : 1.0F);
+
+        while (lists.size() < static_cast<usize>(source->CmdListsCount)) {
+            lists.emplace_back(std::make_unique<ImDrawList>(nullptr));
+        }
+
+        auto cmd_lists = arena.AllocateArray<ImDrawList*>(static_cast<usize>(source->CmdListsCount));
+        for (i32 i = 0; i < source->CmdListsCount; ++i) {
+            auto dst = lists[static_cast<usize>(i)].get();
+            BuildList(source->CmdLists[i], dst);
+            cmd_lists[i] = dst;
+        }
+
+        draw_data = *source;
+        draw_data.CmdLists = cmd_lists;
+        draw_data.OwnerViewport = nullptr;
+        built_list_count = static_cast<usize>(source->CmdListsCount);
+        return &draw_data;
+    }
+
+    // counts of the last Build, user callbacks excluded
+    auto GetInputCommandCount() const -> u32 {
+        return input_command_count;
+    }
+
+    auto GetOutputCommandCount() const -> u32 {
+        return output_command_count;
+    }
+
+private:
+    struct Item {
+        const ImDrawCmd*    cmd;
+        ImRect              clip;
+        ImRect              bounds;
+        ImRect              coverage;   // pixels the command can touch, widened by the clip margin
+        bool                contained;  // bounds are far enough inside clip that clipping changes nothing
+    };
+
+    struct Batch {
+        ImDrawCmd   cmd;
+        ImRect      clip;
+        bool        contained;
+    };
+
+    void BuildList(const ImDrawList* src, ImDrawList* dst) {
+        // vertices are shared with the source list, indices and commands are written in their new order
+        dst->VtxBuffer.Data = src->VtxBuffer.Data;
+        dst->VtxBuffer.Size = src->VtxBuffer.Size;
+        dst->VtxBuffer.Capacity = src->VtxBuffer.Size;
+        dst->IdxBuffer.Data = arena.AllocateArray<ImDrawIdx>(static_cast<usize>(src->IdxBuffer.Size));
+        dst->IdxBuffer.Size = 0;
+        dst->IdxBuffer.Capacity = src->IdxBuffer.Size;
+        dst->CmdBuffer.Data = arena.AllocateArray<ImDrawCmd>(static_cast<usize>(src->CmdBuffer.Size));
+        dst->CmdBuffer.Size = 0;
+        dst->CmdBuffer.Capacity = src->CmdBuffer.Size;
+        dst->Flags = src->Flags;
+
+        items.clear();
+        for (auto& cmd : std::span(src->CmdBuffer.Data, src->CmdBuffer.Size)) {
+            if (cmd.UserCallback != nullptr) {
+                FlushSegment(src, dst);
+                dst->CmdBuffer.Data[dst->CmdBuffer.Size++] = cmd;
+                continue;
+            }
+
+            input_command_count += 1;
+            if (cmd.ElemCount == 0) {
+                continue;
+            }
+
+            auto item = Item{
+                .cmd = &cmd,
+                .clip = ImRect(cmd.ClipRect.x, cmd.ClipRect.y, cmd.ClipRect.z, cmd.ClipRect.w),
+                .bounds = GetBounds(src, cmd),
+            };
+
+            auto visible = item.bounds;
+            visible.ClipWithFull(item.clip);
+            if (visible.Min.x >= visible.Max.x || visible.Min.y >= visible.Max.y) {
+                continue;
+            }
+            item.coverage = ImRect(visible.Min - ImVec2(clip_margin, clip_margin), visible.Max + ImVec2(clip_margin, clip_margin));
+
+            auto inner = ImRect(item.clip.Min + ImVec2(clip_margin, clip_margin), item.clip.Max - ImVec2(clip_margin, clip_margin));
+            item.contained = inner.Contains(item.bounds);
+
+            items.push_back(item);
+        }
+        FlushSegment(src, dst);
+    }
+
+    static auto GetBounds(const ImDrawList* list, const ImDrawCmd& cmd) -> ImRect {
+        auto bounds = ImRect(FLT_MAX, FLT_MAX, -FLT_MAX, -FLT_MAX);
+        for (u32 i = 0; i < cmd.ElemCount; ++i) {
+            auto index = list->IdxBuffer.Data[cmd.IdxOffset + i] + cmd.VtxOffset;
+            bounds.Add(list->VtxBuffer.Data[index].pos);
+        }
+        return bounds;
+    }
+
+    static auto IsSameState(const Item& a, const Item& b) -> bool {
+        return a.cmd->TextureId == b.cmd->TextureId && a.cmd->VtxOffset == b.cmd->VtxOffset;
+    }
+
+    static auto Overlaps(const ImRect& a, const ImRect& b) -> bool {
+        return a.Min.x < b.Max.x && b.Min.x < a.Max.x && a.Min.y < b.Max.y && b.Min.y < a.Max.y;
+    }
+
+    // Reorders and merges the commands collected since the last callback, then appends them to dst.
+    void FlushSegment(const ImDrawList* src, ImDrawList* dst) {
+        emitted.assign(items.size(), false);
+        order.clear();
+        for (usize i = 0; i < items.size(); ++i) {
+            if (emitted[i]) {
+                continue;
+            }
+            emitted[i] = true;
+            order.push_back(i);
+
+            // pull later commands with the same state up behind this one, past commands they do not overlap
+            auto end = std::min(items.size(), i + 1 + REORDER_WINDOW);
+            for (usize j = i + 1; j < end; ++j) {
+                if (emitted[j] || !IsSameState(items[i], items[j])) {
+                    continue;
+                }
+                auto blocked = false;
+                for (usize k = i + 1; k < j && !blocked; ++k) {
+                    blocked = !emitted[k] && Overlaps(items[k].coverage, items[j].coverage);
+                }
+                if (!blocked) {
+                    emitted[j] = true;
+                    order.push_back(j);
+                }
+            }
+        }
+
+        std::optional<Batch> batch;
+        for (auto index : order) {
+            auto& item = items[index];
+
+            auto same_clip = batch.has_value()
+                && batch->clip.Min.x == item.clip.Min.x && batch->clip.Min.y == item.clip.Min.y
+                && batch->clip.Max.x == item.clip.Max.x && batch->clip.Max.y == item.clip.Max.y;
+            auto mergeable = batch.has_value()
+                && batch->cmd.TextureId == item.cmd->TextureId
+                && batch->cmd.VtxOffset == item.cmd->VtxOffset
+                && (same_clip || (batch->contained && item.contained));
+
+            if (mergeable) {
+                batch->clip.Add(item.clip);
+                batch->contained = batch->contained && item.contained;
+                batch->cmd.ElemCount += item.cmd->ElemCount;
+            } else {
+                if (batch.has_value()) {
+                    EmitBatch(dst, &*batch);
+                }
+                batch = Batch{
+                    .cmd = *item.cmd,
+                    .clip = item.clip,
+                    .contained = item.contained,
+                };
+                batch->cmd.IdxOffset = static_cast<u32>(dst->IdxBuffer.Size);
+            }
+
+            // indices are appended in batch order, so a merged batch is always one contiguous range
+            std::memcpy(dst->IdxBuffer.Data + dst->IdxBuffer.Size, src->IdxBuffer.Data + item.cmd->IdxOffset, item.cmd->ElemCount * sizeof(ImDrawIdx));
+            dst->IdxBuffer.Size += static_cast<i32>(item.cmd->ElemCount);
+        }
+        if (batch.has_value()) {
+            EmitBatch(dst, &*batch);
+        }
+
+        items.clear();
+    }
+
+    void EmitBatch(ImDrawList* dst, Batch* batch) {
+        batch->cmd.ClipRect = ImVec4(batch->clip.Min.x, batch->clip.Min.y, batch->clip.Max.x, batch->clip.Max.y);
+        dst->CmdBuffer.Data[dst->CmdBuffer.Size++] = batch->cmd;
+        output_command_count += 1;
+    }
+
+    template<typename T>
+    static void DetachVector(ImVector<T>* vector) {
+        vector->Data = nullptr;
+        vector->Size = 0;
+        vector->Capacity = 0;
+    }
+
+    void DetachLists() {
+        for (usize i = 0; i < built_list_count; ++i) {
+            DetachVector(&lists[i]->CmdBuffer);
+            DetachVector(&lists[i]->IdxBuffer);
+            DetachVector(&lists[i]->VtxBuffer);
+        }
+        built_list_count = 0;
+        draw_data = {};
+    }
+
+private:
+    DrawDataArena                               arena                   = {};
+    std::vector<std::unique_ptr<ImDrawList>>    lists                   = {};
+    usize                                       built_list_count        = 0;
+    ImDrawData                                  draw_data               = {};
+
+    std::vector<Item>                           items                   = {};
+    std::vector<bool>                           emitted                 = {};
+    std::vector<usize>                          order                   = {};
+    f32                                         clip_margin             = 0.0F;
+    u32                                         input_command_count     = 0;
+    u32                                         output_command_count    = 0;
+};
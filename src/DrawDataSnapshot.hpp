@@ -0,0 +1,147 @@
+#pragma once
+
+#include <imgui.h>
+
+// Bump allocator that is reset as a whole, used for one snapshot at a time.
+//
+// Growth adds blocks, the next Reset folds them into a single block so a steady UI settles at zero allocations per frame.
+class DrawDataArena {
+public:
+    static constexpr usize MIN_BLOCK_SIZE = 256 * 1024;
+
+    auto Allocate(usize size, usize alignment) -> void* {
+        if (!blocks.empty()) {
+            auto& block = blocks.back();
+            auto address = reinterpret_cast<uintptr_t>(block.data.get());
+            auto aligned = (address + offset + alignment - 1) & ~(static_cast<uintptr_t>(alignment) - 1);
+            if (aligned + size <= address + block.capacity) {
+                offset = aligned + size - address;
+                return reinterpret_cast<void*>(aligned);
+            }
+        }
+
+        auto capacity = std::max(MIN_BLOCK_SIZE, size + alignment);
+        if (!blocks.empty()) {
+            capacity = std::max(capacity, blocks.back().capacity * 2);
+        }
+        blocks.push_back(Block{ std::make_unique<std::byte[]>(capacity), capacity });
+        offset = 0;
+        return Allocate(size, alignment);
+    }
+
+    template<typename T>
+    auto AllocateArray(usize count) -> T* {
+        static_assert(std::is_trivially_copyable_v<T>);
+        return static_cast<T*>(Allocate(std::max<usize>(count, 1) * sizeof(T), alignof(T)));
+    }
+
+    void Reset() {
+        if (blocks.size() > 1) {
+            usize capacity = 0;
+            for (auto& block : blocks) {
+                capacity += block.capacity;
+            }
+            blocks.clear();
+            blocks.push_back(Block{ std::make_unique<std::byte[]>(capacity), capacity });
+        }
+        offset = 0;
+    }
+
+    auto GetCapacity() const -> usize {
+        usize capacity = 0;
+        for (auto& block : blocks) {
+            capacity += block.capacity;
+        }
+        return capacity;
+    }
+
+private:
+    struct Block {
+        std::unique_ptr<std::byte[]>    data;
+        usize                           capacity;
+    };
+
+    std::vector<Block>  blocks = {};
+    usize               offset = 0;
+};
+
+// Deep copy of ImDrawData whose buffers live in an arena, safe to read on another thread while ImGui builds the next frame.
+//
+// Command, index and vertex buffers of the copied lists point into the arena, so the lists are detached from it again
+// before the arena is reset or they are destroyed; ImGui would otherwise try to free memory it does not own.
+class DrawDataSnapshot {
+public:
+    DrawDataSnapshot() = default;
+    DrawDataSnapshot(const DrawDataSnapshot&) = delete;
+    auto operator=(const DrawDataSnapshot&) -> DrawDataSnapshot& = delete;
+
+    ~DrawDataSnapshot() {
+        DetachLists();
+    }
+
+    void Capture(const ImDrawData* source) {
+        DetachLists();
+        arena.Reset();
+
+        while (lists.size() < static_cast<usize>(source->CmdListsCount)) {
+            lists.emplace_back(std::make_unique<ImDrawList>(nullptr));
+        }
+
+        auto cmd_lists = arena.AllocateArray<ImDrawList*>(static_cast<usize>(source->CmdListsCount));
+        for (i32 i = 0; i < source->CmdListsCount; ++i) {
+            auto src = source->CmdLists[i];
+            auto dst = lists[static_cast<usize>(i)].get();
+
+            CopyVector(&dst->CmdBuffer, src->CmdBuffer);
+            CopyVector(&dst->IdxBuffer, src->IdxBuffer);
+            CopyVector(&dst->VtxBuffer, src->VtxBuffer);
+            dst->Flags = src->Flags;
+            cmd_lists[i] = dst;
+        }
+
+        draw_data = *source;
+        draw_data.CmdLists = cmd_lists;
+        draw_data.OwnerViewport = nullptr;
+        captured_list_count = static_cast<usize>(source->CmdListsCount);
+    }
+
+    auto GetDrawData() -> ImDrawData* {
+        return &draw_data;
+    }
+
+    auto GetArenaCapacity() const -> usize {
+        return arena.GetCapacity();
+    }
+
+private:
+    template<typename T>
+    void CopyVector(ImVector<T>* dst, const ImVector<T>& src) {
+        dst->Data = arena.AllocateArray<T>(static_cast<usize>(src.Size));
+        dst->Size = src.Size;
+        dst->Capacity = src.Size;
+        std::memcpy(dst->Data, src.Data, static_cast<usize>(src.Size) * sizeof(T));
+    }
+
+    template<typename T>
+    static void DetachVector(ImVector<T>* vector) {
+        vector->Data = nullptr;
+        vector->Size = 0;
+        vector->Capacity = 0;
+    }
+
+    void DetachLists() {
+        for (usize i = 0; i < captured_list_count; ++i) {
+            DetachVector(&lists[i]->CmdBuffer);
+            DetachVector(&lists[i]->IdxBuffer);
+            DetachVector(&lists[i]->VtxBuffer);
+        }
+        captured_list_count = 0;
+        draw_data = {};
+    }
+
+private:
+    DrawDataArena                               arena               = {};
+    std::vector<std::unique_ptr<ImDrawList>>    lists               = {};
+    usize                                       captured_list_count = 0;
+    ImDrawData                                  draw_data           = {};
+};
@@ -0,0 +1,73 @@
+#pragma once
+
+// Picks the scale of the rasterizer's internal resolution from its measured GPU time.
+//
+// The scale drops a step once the smoothed time has stayed over the budget for FRAMES_TO_LOWER frames, and rises a step
+// once it has stayed under HEADROOM of the budget for FRAMES_TO_RAISE frames, if the time predicted for the larger scale
+// still fits. The gap between the two thresholds and the longer wait before raising keep the scale from oscillating, and
+// restarting both counts after a change lets the timings of frames still in flight at the old scale drain.
+class DynamicResolution {
+public:
+    static constexpr f32 MIN_SCALE = 0.5F;
+    static constexpr f32 SCALE_STEP = 0.125F;
+    static constexpr f64 HEADROOM = 0.75;
+    static constexpr u32 FRAMES_TO_LOWER = 8;
+    static constexpr u32 FRAMES_TO_RAISE = 60;
+
+    void Update(f64 gpu_ms, f64 budget_ms) {
+        constexpr f64 smoothing = 0.1;
+        smoothed_ms = has_sample ? smoothed_ms + (gpu_ms - smoothed_ms) * smoothing : gpu_ms;
+        has_sample = true;
+
+        if (smoothed_ms > budget_ms) {
+            frames_under_budget = 0;
+            frames_over_budget += 1;
+            if (frames_over_budget >= FRAMES_TO_LOWER && scale > MIN_SCALE) {
+                SetScale(scale - SCALE_STEP);
+            }
+        } else if (smoothed_ms < budget_ms * HEADROOM) {
+            frames_over_budget = 0;
+            frames_under_budget += 1;
+            if (frames_under_budget >= FRAMES_TO_RAISE && scale < 1.0F && PredictMs(scale + SCALE_STEP) < budget_ms) {
+                SetScale(scale + SCALE_STEP);
+            }
+        } else {
+            frames_over_budget = 0;
+            frames_under_budget = 0;
+        }
+    }
+
+    void Reset() {
+        scale = 1.0F;
+        smoothed_ms = 0.0;
+        has_sample = false;
+        frames_over_budget = 0;
+        frames_under_budget = 0;
+    }
+
+    auto GetScale() const -> f32 {
+        return scale;
+    }
+
+private:
+    // the rasterizer's time grows with the pixel count, so with the square of the scale
+    auto PredictMs(f32 new_scale) const -> f64 {
+        auto ratio = static_cast<f64>(std::min(new_scale, 1.0F)) / static_cast<f64>(scale);
+        return smoothed_ms * ratio * ratio;
+    }
+
+    void SetScale(f32 new_scale) {
+        new_scale = std::clamp(new_scale, MIN_SCALE, 1.0F);
+        smoothed_ms = PredictMs(new_scale);
+        scale = new_scale;
+        frames_over_budget = 0;
+        frames_under_budget = 0;
+    }
+
+private:
+    f32     scale                   = 1.0F;
+    f64     smoothed_ms             = 0.0;
+    bool    has_sample              = false;
+    u32     frames_over_budget      = 0;
+    u32     frames_under_budget     = 0;
+};
@@ -0,0 +1,666 @@
+#pragma once
+
+#include "VulkanRenderer.hpp"
+
+// How a pass touches an image; with the Read or Write it was declared with this gives the stages, accesses and layout.
+enum class FrameGraphUsage {
+    eTransfer,          // transfer src when read, transfer dst when written
+    eComputeStorage,
+    eComputeSampled,
+    eFragmentSampled,
+    eColorAttachment,
+};
+
+// State of an image at the edges of a graph. For an imported image, the stages and writes that must finish before its
+// first use; for an output, the stages and accesses that come after the graph. A queue family other than the graph's
+// turns the first barrier into an ownership acquire, or the final one into a release, whose layouts must match the other
+// queue's half of the transfer.
+struct FrameGraphImageState {
+    vk::ImageLayout         layout              = vk::ImageLayout::eUndefined;
+    vk::PipelineStageFlags2 stages              = vk::PipelineStageFlagBits2::eNone;
+    vk::AccessFlags2        access              = vk::AccessFlagBits2::eNone;
+    u32                     queue_family_index  = VK_QUEUE_FAMILY_IGNORED;
+};
+
+// Transient 2D color image, created and placed in memory by the graph.
+struct FrameGraphImageDesc {
+    vk::Extent2D        extent  = {};
+    vk::Format          format  = {};
+    vk::ImageUsageFlags usage   = {};
+
+    auto operator==(const FrameGraphImageDesc&) const -> bool = default;
+};
+
+using FrameGraphImage = u32;
+using FrameGraphPass = u32;
+
+struct FrameGraphStats {
+    u32             pass_count              = 0;
+    u32             culled_pass_count       = 0;
+    u32             barrier_count           = 0;    // image barriers
+    u32             barrier_batch_count     = 0;    // pipelineBarrier2 calls
+    u32             transient_image_count   = 0;
+    vk::DeviceSize  transient_memory_size   = 0;    // bytes of the heaps used this frame
+    vk::DeviceSize  aliased_memory_size     = 0;    // bytes saved by sharing memory between transients
+};
+
+// Memory of transient images, reused by later graphs once the frame that last used it has finished.
+//
+// Each heap is one allocation holding the transients of one graph at the offsets the graph placed them at. Images are
+// cached with the heap by description and offset, so a graph recorded the same way as before creates nothing. Heaps not
+// used for MAX_IDLE_FRAMES frames are freed. Only used by the thread recording frames.
+class FrameGraphTransientPool : public ManagedObject {
+public:
+    static constexpr u64 MAX_IDLE_FRAMES = 120;
+
+    struct CachedImage {
+        FrameGraphImageDesc desc        = {};
+        vk::DeviceSize      offset      = 0;
+        GpuTexture          texture     = {};
+        bool                used        = false;
+    };
+
+    struct Heap {
+        GpuStorageMode              storage_mode        = GpuStorageMode::ePrivate;
+        GpuAllocation               allocation          = {};
+        u32                         memory_type_index   = 0;
+        u64                         last_used_frame     = 0;
+        std::vector<CachedImage>    images              = {};
+    };
+
+    VulkanRenderer*                     vulkan;
+
+private:
+    std::vector<std::unique_ptr<Heap>>  heaps;
+
+public:
+    explicit FrameGraphTransientPool(VulkanRenderer* vulkan) : vulkan(vulkan) {}
+
+    ~FrameGraphTransientPool() override {
+        for (auto& heap : heaps) {
+            DestroyHeap(heap.get());
+        }
+    }
+
+    // Returns a heap of at least size bytes in a memory type allowed by memory_type_bits that no frame in flight still
+    // uses, or nullptr when the storage mode has no such memory type.
+    auto AcquireHeap(GpuStorageMode storage_mode, vk::DeviceSize size, u32 memory_type_bits) -> Heap* {
+        auto current_frame = vulkan->current_frame_value;
+        auto completed_frame = vulkan->GetCompletedFrameValue();
+
+        for (auto it = heaps.begin(); it != heaps.end();) {
+            auto& heap = **it;
+            auto idle = heap.last_used_frame <= completed_frame;
+            if (idle && heap.last_used_frame + MAX_IDLE_FRAMES < current_frame) {
+                DestroyHeap(&heap);
+                it = heaps.erase(it);
+                continue;
+            }
+
+            // outgrown heaps are replaced instead of kept around next to their successor
+            auto same_mode = heap.storage_mode == storage_mode;
+            if (idle && same_mode && heap.allocation.memory_requirements.size < size) {
+                DestroyHeap(&heap);
+                it = heaps.erase(it);
+                continue;
+            }
+
+            if (idle && same_mode && (memory_type_bits & (1u << heap.memory_type_index)) != 0) {
+                heap.last_used_frame = current_frame;
+                return &heap;
+            }
+            ++it;
+        }
+
+        auto memory_type_index = gpu_find_memory_type_index(&vulkan->context, memory_type_bits, GetMemoryPropertyFlags(storage_mode));
+        if (memory_type_index == std::numeric_limits<u32>::max()) {
+            return nullptr;
+        }
+
+        auto heap = std::make_unique<Heap>();
+        heap->storage_mode = storage_mode;
+        heap->memory_type_index = memory_type_index;
+        heap->last_used_frame = current_frame;
+
+        // restricted to the type found above, so later requirements are checked against the type actually allocated
+        auto memory_requirements = vk::MemoryRequirements(size, 0, 1u << memory_type_index);
+        gpu_allocate_memory(&vulkan->context, &heap->allocation, memory_requirements, storage_mode, {});
+
+        heaps.push_back(std::move(heap));
+        return heaps.back().get();
+    }
+
+    // The image of this description at this offset, created on first use. Call BeginHeap before the first lookup and
+    // EndHeap after the last one of a graph, images not looked up in between are destroyed.
+    auto GetImage(Heap* heap, const FrameGraphImageDesc& desc, vk::DeviceSize offset, const vk::ImageCreateInfo& create_info) -> GpuTexture* {
+        for (auto& image : heap->images) {
+            if (!image.used && image.offset == offset && image.desc == desc) {
+                image.used = true;
+                return &image.texture;
+            }
+        }
+
+        auto& image = heap->images.emplace_back(CachedImage{ .desc = desc, .offset = offset, .used = true });
+        image.texture.image = vulkan->context.logical_device.createImage(create_info);
+        image.texture.extent = desc.extent;
+        vulkan->context.logical_device.bindImageMemory(image.texture.image, heap->allocation.device_memory, offset);
+
+        auto view_info = vk::ImageViewCreateInfo()
+            .setImage(image.texture.image)
+            .setViewType(vk::ImageViewType::e2D)
+            .setFormat(desc.format)
+            .setSubresourceRange(vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1));
+
+        image.texture.view = vulkan->context.logical_device.createImageView(view_info);
+        return &image.texture;
+    }
+
+    static void BeginHeap(Heap* heap) {
+        for (auto& image : heap->images) {
+            image.used = false;
+        }
+    }
+
+    // The heap's previous frame has finished, so unused images can go right away.
+    void EndHeap(Heap* heap) {
+        for (auto it = heap->images.begin(); it != heap->images.end();) {
+            if (!it->used) {
+                vulkan->CleanupTexture(&it->texture);
+                it = heap->images.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    static auto GetMemoryPropertyFlags(GpuStorageMode storage_mode) -> vk::MemoryPropertyFlags {
+        if (storage_mode == GpuStorageMode::eLazy) {
+            return vk::MemoryPropertyFlagBits::eDeviceLocal | vk::MemoryPropertyFlagBits::eLazilyAllocated;
+        }
+        return vk::MemoryPropertyFlagBits::eDeviceLocal;
+    }
+
+private:
+    void DestroyHeap(Heap* heap) {
+        for (auto& image : heap->images) {
+            vulkan->CleanupTexture(&image.texture);
+        }
+        gpu_free_memory(&vulkan->context, &heap->allocation);
+    }
+};
+
+// Passes of one command buffer, recorded with the barriers worked out from what each pass declared it reads and writes.
+//
+// Built anew every frame: import or create images, add passes in execution order, declare their uses with Read and
+// Write, mark outputs, then Execute. Execute
+// - culls passes that write nothing an output or a later live pass reads, unless they have side effects,
+// - gives every used transient a place in a shared heap, transients whose live passes do not overlap share memory, and
+//   heaps of attachment-only transients use lazily allocated memory where the device has it,
+// - records each live pass behind one batched barrier covering the layout transitions and hazards of all its images,
+//   nothing for reads following reads in the same layout,
+// - transitions the outputs to their final state.
+// Images are whole single-mip color images. Transient textures are valid inside the pass callbacks only.
+class FrameGraph {
+public:
+    using PassCallback = std::function<void(GpuCommandBuffer* command_buffer)>;
+
+private:
+    // what the image has seen since its last barrier, for working out the next one
+    struct ImageSyncState {
+        vk::ImageLayout         layout              = vk::ImageLayout::eUndefined;
+        vk::PipelineStageFlags2 write_stages        = {};   // last write or layout transition, later uses chain after it
+        vk::AccessFlags2        write_access        = {};   // writes not yet made available
+        vk::PipelineStageFlags2 read_stages         = {};   // reads since the last write, a write waits for them
+        vk::PipelineStageFlags2 visible_stages      = {};   // where the last write is already visible
+        vk::AccessFlags2        visible_access      = {};
+        u32                     queue_family_index  = VK_QUEUE_FAMILY_IGNORED;
+    };
+
+    struct Image {
+        GpuTexture                          texture         = {};
+        FrameGraphImageDesc                 desc            = {};
+        bool                                transient       = false;
+        std::optional<FrameGraphImageState> final_state     = {};
+        ImageSyncState                      state           = {};
+
+        // transients only, filled in by Execute
+        u32                                 first_pass      = std::numeric_limits<u32>::max();
+        u32                                 last_pass       = 0;
+        vk::ImageCreateInfo                 create_info     = {};
+        vk::MemoryRequirements              requirements    = {};
+        GpuStorageMode                      storage_mode    = GpuStorageMode::ePrivate;
+        vk::DeviceSize                      offset          = 0;
+        std::vector<FrameGraphImage>        aliased_images  = {};   // earlier transients sharing its memory
+    };
+
+    struct Use {
+        FrameGraphImage         image           = 0;
+        vk::PipelineStageFlags2 stages          = {};
+        vk::AccessFlags2        read_access     = {};
+        vk::AccessFlags2        write_access    = {};
+        vk::ImageLayout         layout          = vk::ImageLayout::eUndefined;
+    };
+
+    struct Pass {
+        const char*         name            = {};
+        PassCallback        callback        = {};
+        bool                has_side_effects = false;
+        bool                live            = false;
+        std::vector<Use>    uses            = {};
+    };
+
+    VulkanRenderer*             vulkan;
+    FrameGraphTransientPool*    transients;
+    u32                         queue_family_index;
+
+    std::vector<Image>          images;
+    std::vector<Pass>           passes;
+    FrameGraphStats             stats       = {};
+
+public:
+    FrameGraph(VulkanRenderer* vulkan, FrameGraphTransientPool* transients, u32 queue_family_index)
+        : vulkan(vulkan), transients(transients), queue_family_index(queue_family_index) {}
+
+    FrameGraph(const FrameGraph&) = delete;
+    auto operator=(const FrameGraph&) -> FrameGraph& = delete;
+
+    // An image owned outside the graph, in initial_state when the graph starts.
+    auto ImportImage(const GpuTexture& texture, const FrameGraphImageState& initial_state) -> FrameGraphImage {
+        auto& image = images.emplace_back();
+        image.texture = texture;
+        image.state = ImageSyncState{
+            .layout = initial_state.layout,
+            .write_stages = initial_state.stages,
+            .write_access = initial_state.access,
+            .queue_family_index = initial_state.queue_family_index,
+        };
+        return static_cast<FrameGraphImage>(images.size() - 1);
+    }
+
+    // An image that exists for this graph only, its contents are undefined at its first use.
+    auto CreateImage(const FrameGraphImageDesc& desc) -> FrameGraphImage {
+        auto& image = images.emplace_back();
+        image.desc = desc;
+        image.texture.extent = desc.extent;
+        image.transient = true;
+        return static_cast<FrameGraphImage>(images.size() - 1);
+    }
+
+    // Keeps the passes writing the image alive and leaves it in final_state, a final layout of eUndefined keeps the
+    // layout of its last use.
+    void SetOutput(FrameGraphImage image, const FrameGraphImageState& final_state = {}) {
+        images[image].final_state = final_state;
+    }
+
+    // Passes run in the order they are added. Passes with side effects, like readbacks, are never culled.
+    auto AddPass(const char* name, PassCallback callback, bool has_side_effects = false) -> FrameGraphPass {
+        passes.push_back(Pass{
+            .name = name,
+            .callback = std::move(callback),
+            .has_side_effects = has_side_effects,
+        });
+        return static_cast<FrameGraphPass>(passes.size() - 1);
+    }
+
+    void Read(FrameGraphPass pass, FrameGraphImage image, FrameGraphUsage usage) {
+        AddUse(pass, image, usage, false);
+    }
+
+    void Write(FrameGraphPass pass, FrameGraphImage image, FrameGraphUsage usage) {
+        AddUse(pass, image, usage, true);
+    }
+
+    // The image a pass callback works on, transients get theirs during Execute.
+    auto GetTexture(FrameGraphImage image) -> GpuTexture* {
+        return &images[image].texture;
+    }
+
+    auto GetStats() const -> const FrameGraphStats& {
+        return stats;
+    }
+
+    void Execute(GpuCommandBuffer* command_buffer) {
+        stats = FrameGraphStats{ .pass_count = static_cast<u32>(passes.size()) };
+
+        CullPasses();
+        AllocateTransients();
+
+        std::vector<vk::ImageMemoryBarrier2> barriers;
+        for (u32 i = 0; i < passes.size(); ++i) {
+            auto& pass = passes[i];
+            if (!pass.live) {
+                continue;
+            }
+
+            barriers.clear();
+            for (auto& use : pass.uses) {
+                AddBarrier(&barriers, use);
+            }
+            FlushBarriers(command_buffer, barriers);
+
+            pass.callback(command_buffer);
+        }
+
+        barriers.clear();
+        for (auto& image : images) {
+            if (image.final_state) {
+                AddFinalBarrier(&barriers, &image);
+            }
+        }
+        FlushBarriers(command_buffer, barriers);
+    }
+
+private:
+    struct UsageInfo {
+        vk::PipelineStageFlags2 stages          = {};
+        vk::AccessFlags2        access          = {};
+        vk::ImageLayout         layout          = vk::ImageLayout::eUndefined;
+    };
+
+    static auto GetUsageInfo(FrameGraphUsage usage, bool write) -> UsageInfo {
+        switch (usage) {
+            case FrameGraphUsage::eTransfer: {
+                return write
+                    ? UsageInfo{ vk::PipelineStageFlagBits2::eAllTransfer, vk::AccessFlagBits2::eTransferWrite, vk::ImageLayout::eTransferDstOptimal }
+                    : UsageInfo{ vk::PipelineStageFlagBits2::eAllTransfer, vk::AccessFlagBits2::eTransferRead, vk::ImageLayout::eTransferSrcOptimal };
+            }
+            case FrameGraphUsage::eComputeStorage: {
+                return write
+                    ? UsageInfo{ vk::PipelineStageFlagBits2::eComputeShader, vk::AccessFlagBits2::eShaderStorageWrite, vk::ImageLayout::eGeneral }
+                    : UsageInfo{ vk::PipelineStageFlagBits2::eComputeShader, vk::AccessFlagBits2::eShaderStorageRead, vk::ImageLayout::eGeneral };
+            }
+            case FrameGraphUsage::eComputeSampled: {
+                assert(!write && "Sampled images are read only");
+                return UsageInfo{ vk::PipelineStageFlagBits2::eComputeShader, vk::AccessFlagBits2::eShaderSampledRead, vk::ImageLayout::eShaderReadOnlyOptimal };
+            }
+            case FrameGraphUsage::eFragmentSampled: {
+                assert(!write && "Sampled images are read only");
+                return UsageInfo{ vk::PipelineStageFlagBits2::eFragmentShader, vk::AccessFlagBits2::eShaderSampledRead, vk::ImageLayout::eShaderReadOnlyOptimal };
+            }
+            case FrameGraphUsage::eColorAttachment: {
+                return write
+                    ? UsageInfo{ vk::PipelineStageFlagBits2::eColorAttachmentOutput, vk::AccessFlagBits2::eColorAttachmentWrite, vk::ImageLayout::eColorAttachmentOptimal }
+                    : UsageInfo{ vk::PipelineStageFlagBits2::eColorAttachmentOutput, vk::AccessFlagBits2::eColorAttachmentRead, vk::ImageLayout::eColorAttachmentOptimal };
+            }
+        }
+        return {};
+    }
+
+    // Uses of one image within a pass are merged, in General layout when their layouts differ.
+    void AddUse(FrameGraphPass pass, FrameGraphImage image, FrameGraphUsage usage, bool write) {
+        auto info = GetUsageInfo(usage, write);
+
+        auto& uses = passes[pass].uses;
+        auto it = std::find_if(uses.begin(), uses.end(), [&](const Use& use) { return use.image == image; });
+        if (it == uses.end()) {
+            it = uses.insert(uses.end(), Use{ .image = image, .layout = info.layout });
+        }
+
+        it->stages |= info.stages;
+        if (write) {
+            it->write_access |= info.access;
+        } else {
+            it->read_access |= info.access;
+        }
+        if (it->layout != info.layout) {
+            it->layout = vk::ImageLayout::eGeneral;
+        }
+    }
+
+    // Walks the passes backwards, a pass lives when it has side effects or writes an image something later needs.
+    void CullPasses() {
+        std::vector<bool> needed(images.size(), false);
+        for (u32 i = 0; i < images.size(); ++i) {
+            needed[i] = images[i].final_state.has_value();
+        }
+
+        for (auto i = passes.size(); i-- > 0;) {
+            auto& pass = passes[i];
+            pass.live = pass.has_side_effects || std::any_of(pass.uses.begin(), pass.uses.end(), [&](const Use& use) {
+                return use.write_access && needed[use.image];
+            });
+            if (!pass.live) {
+                stats.culled_pass_count += 1;
+                continue;
+            }
+            for (auto& use : pass.uses) {
+                needed[use.image] = true;
+            }
+        }
+    }
+
+    // Places every transient used by a live pass. Largest first, each at the lowest offset not overlapping a transient
+    // placed before it whose lifetime overlaps its own, so transients that never live at the same time share memory.
+    void AllocateTransients() {
+        for (u32 i = 0; i < passes.size(); ++i) {
+            if (!passes[i].live) {
+                continue;
+            }
+            for (auto& use : passes[i].uses) {
+                auto& image = images[use.image];
+                if (image.transient) {
+                    image.first_pass = std::min(image.first_pass, i);
+                    image.last_pass = std::max(image.last_pass, i);
+                }
+            }
+        }
+
+        std::array<std::vector<u32>, 2> groups;     // private, lazy
+        for (u32 i = 0; i < images.size(); ++i) {
+            auto& image = images[i];
+            if (!image.transient || image.first_pass > image.last_pass) {
+                continue;
+            }
+            PrepareTransient(&image);
+            groups[image.storage_mode == GpuStorageMode::eLazy ? 1 : 0].push_back(i);
+        }
+
+        // without a lazily allocated memory type the lazy group joins the private one
+        if (!groups[1].empty() && !PlaceGroup(groups[1], GpuStorageMode::eLazy)) {
+            for (auto index : groups[1]) {
+                images[index].storage_mode = GpuStorageMode::ePrivate;
+                images[index].create_info.usage &= ~vk::ImageUsageFlagBits::eTransientAttachment;
+                images[index].requirements = GetRequirements(images[index].create_info);
+                groups[0].push_back(index);
+            }
+        }
+        if (!groups[0].empty() && !PlaceGroup(groups[0], GpuStorageMode::ePrivate)) {
+            throw std::runtime_error("No memory type for frame graph transients");
+        }
+    }
+
+    void PrepareTransient(Image* image) {
+        constexpr auto attachment_usage = vk::ImageUsageFlagBits::eColorAttachment
+            | vk::ImageUsageFlagBits::eDepthStencilAttachment
+            | vk::ImageUsageFlagBits::eInputAttachment;
+
+        // only attachments can live in lazily allocated memory, which tilers may never back at all
+        auto lazy = (image->desc.usage & ~attachment_usage) == vk::ImageUsageFlags{};
+        image->storage_mode = lazy ? GpuStorageMode::eLazy : GpuStorageMode::ePrivate;
+
+        image->create_info = vk::ImageCreateInfo()
+            .setImageType(vk::ImageType::e2D)
+            .setFormat(image->desc.format)
+            .setExtent(vk::Extent3D(image->desc.extent.width, image->desc.extent.height, 1))
+            .setMipLevels(1)
+            .setArrayLayers(1)
+            .setSamples(vk::SampleCountFlagBits::e1)
+            .setTiling(vk::ImageTiling::eOptimal)
+            .setUsage(image->desc.usage | (lazy ? vk::ImageUsageFlagBits::eTransientAttachment : vk::ImageUsageFlags{}))
+            .setSharingMode(vk::SharingMode::eExclusive)
+            .setInitialLayout(vk::ImageLayout::eUndefined);
+
+        image->requirements = GetRequirements(image->create_info);
+    }
+
+    auto GetRequirements(const vk::ImageCreateInfo& create_info) -> vk::MemoryRequirements {
+        auto requirements_info = vk::DeviceImageMemoryRequirements().setPCreateInfo(&create_info);
+        return vulkan->context.logical_device.getImageMemoryRequirements(requirements_info).memoryRequirements;
+    }
+
+    auto PlaceGroup(std::vector<u32> group, GpuStorageMode storage_mode) -> bool {
+        std::sort(group.begin(), group.end(), [&](u32 a, u32 b) {
+            return images[a].requirements.size > images[b].requirements.size;
+        });
+
+        auto heap_size = vk::DeviceSize(0);
+        auto memory_type_bits = ~0u;
+        auto requested_size = vk::DeviceSize(0);
+        for (usize i = 0; i < group.size(); ++i) {
+            auto& image = images[group[i]];
+
+            auto overlaps = [&](vk::DeviceSize offset, const Image& other) {
+                auto lifetimes_overlap = image.first_pass <= other.last_pass && other.first_pass <= image.last_pass;
+                return lifetimes_overlap && offset < other.offset + other.requirements.size && other.offset < offset + image.requirements.size;
+            };
+
+            // the lowest free offset is either 0 or right after one of the transients already placed
+            auto best_offset = std::numeric_limits<vk::DeviceSize>::max();
+            for (usize j = 0; j <= i; ++j) {
+                auto offset = j == 0 ? 0 : gpu_calculate_alignment(images[group[j - 1]].offset + images[group[j - 1]].requirements.size, image.requirements.alignment);
+                if (offset >= best_offset) {
+                    continue;
+                }
+                auto blocked = false;
+                for (usize k = 0; k < i && !blocked; ++k) {
+                    blocked = overlaps(offset, images[group[k]]);
+                }
+                if (!blocked) {
+                    best_offset = offset;
+                }
+            }
+
+            image.offset = best_offset;
+            heap_size = std::max(heap_size, image.offset + image.requirements.size);
+            memory_type_bits &= image.requirements.memoryTypeBits;
+            requested_size += image.requirements.size;
+        }
+
+        auto heap = transients->AcquireHeap(storage_mode, heap_size, memory_type_bits);
+        if (heap == nullptr) {
+            return false;
+        }
+
+        FrameGraphTransientPool::BeginHeap(heap);
+        for (auto index : group) {
+            auto& image = images[index];
+            image.texture = *transients->GetImage(heap, image.desc, image.offset, image.create_info);
+
+            for (auto other_index : group) {
+                auto& other = images[other_index];
+                auto memory_overlaps = image.offset < other.offset + other.requirements.size && other.offset < image.offset + image.requirements.size;
+                if (other_index != index && memory_overlaps && other.last_pass < image.first_pass) {
+                    image.aliased_images.push_back(other_index);
+                }
+            }
+        }
+        transients->EndHeap(heap);
+
+        stats.transient_image_count += static_cast<u32>(group.size());
+        stats.transient_memory_size += heap_size;
+        stats.aliased_memory_size += requested_size - std::min(requested_size, heap_size);
+        return true;
+    }
+
+    void AddBarrier(std::vector<vk::ImageMemoryBarrier2>* barriers, const Use& use) {
+        auto& state = images[use.image].state;
+
+        // contents are discarded, but the first use still waits for the last use of the transients it aliases
+        for (auto other : images[use.image].aliased_images) {
+            state.write_stages |= images[other].state.write_stages | images[other].state.read_stages;
+            state.write_access |= images[other].state.write_access;
+        }
+        images[use.image].aliased_images.clear();
+
+        auto write = use.write_access != vk::AccessFlags2{};
+        auto layout_change = state.layout != use.layout;
+        auto access = use.read_access | use.write_access;
+        auto acquire = state.queue_family_index != VK_QUEUE_FAMILY_IGNORED && state.queue_family_index != queue_family_index;
+
+        auto barrier = vk::ImageMemoryBarrier2()
+            .setDstStageMask(use.stages)
+            .setDstAccessMask(access)
+            .setOldLayout(state.layout)
+            .setNewLayout(use.layout)
+            .setImage(images[use.image].texture.image)
+            .setSubresourceRange(vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1));
+
+        if (acquire) {
+            // the release on the other queue and the semaphore between them already ordered everything before
+            barrier.setSrcQueueFamilyIndex(state.queue_family_index).setDstQueueFamilyIndex(queue_family_index);
+            state.queue_family_index = VK_QUEUE_FAMILY_IGNORED;
+        } else if (write || layout_change) {
+            barrier.setSrcStageMask(state.write_stages | state.read_stages).setSrcAccessMask(state.write_access);
+        } else {
+            // a read after a read, or after a write already made visible to it, needs nothing
+            auto visible = (use.stages & ~state.visible_stages) == vk::PipelineStageFlags2{}
+                && (access & ~state.visible_access) == vk::AccessFlags2{};
+            if (!state.write_stages || visible) {
+                state.read_stages |= use.stages;
+                return;
+            }
+            barrier.setSrcStageMask(state.write_stages).setSrcAccessMask(state.write_access);
+        }
+
+        // the first use of an image nothing is pending on, in the layout it already has
+        if (acquire || layout_change || barrier.srcStageMask) {
+            barriers->push_back(barrier);
+        }
+
+        state.layout = use.layout;
+        if (write) {
+            state.write_stages = use.stages;
+            state.write_access = use.write_access;
+            state.read_stages = {};
+            state.visible_stages = {};
+            state.visible_access = {};
+        } else {
+            // a layout transition counts as a write the next readers chain after, already available to all of them
+            if (layout_change || acquire) {
+                state.write_stages = use.stages;
+                state.visible_stages = {};
+                state.visible_access = {};
+            }
+            state.write_access = {};
+            state.read_stages |= use.stages;
+            state.visible_stages |= use.stages;
+            state.visible_access |= access;
+        }
+    }
+
+    void AddFinalBarrier(std::vector<vk::ImageMemoryBarrier2>* barriers, Image* image) {
+        auto& state = image->state;
+        auto& final_state = *image->final_state;
+        auto new_layout = final_state.layout == vk::ImageLayout::eUndefined ? state.layout : final_state.layout;
+        auto release = final_state.queue_family_index != VK_QUEUE_FAMILY_IGNORED && final_state.queue_family_index != queue_family_index;
+        if (new_layout == state.layout && !release && !final_state.stages) {
+            return;
+        }
+
+        auto barrier = vk::ImageMemoryBarrier2()
+            .setSrcStageMask(state.write_stages | state.read_stages)
+            .setSrcAccessMask(state.write_access)
+            .setOldLayout(state.layout)
+            .setNewLayout(new_layout)
+            .setImage(image->texture.image)
+            .setSubresourceRange(vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1));
+
+        if (release) {
+            // the acquire on the other queue has the destination scope
+            barrier.setSrcQueueFamilyIndex(queue_family_index).setDstQueueFamilyIndex(final_state.queue_family_index);
+        } else {
+            barrier.setDstStageMask(final_state.stages).setDstAccessMask(final_state.access);
+        }
+        barriers->push_back(barrier);
+        state.layout = new_layout;
+    }
+
+    void FlushBarriers(GpuCommandBuffer* command_buffer, const std::vector<vk::ImageMemoryBarrier2>& barriers) {
+        if (barriers.empty()) {
+            return;
+        }
+        command_buffer->cmd_buffer.pipelineBarrier2(vk::DependencyInfo().setImageMemoryBarriers(barriers));
+        stats.barrier_count += static_cast<u32>(barriers.size());
+        stats.barrier_batch_count += 1;
+    }
+};
@@ -11,13 +11,33 @@
 #include <backends/imgui_impl_glfw.h>
 #include <backends/imgui_impl_vulkan.h>
 
+// Added with ImDrawList::AddCallback to keep the compute rasterizer's dynamic resolution away from a draw list, the list
+// and every list drawn after it stay at full resolution. Renderers without scaling skip it.
+#define ImDrawCallback_FullResolution (ImDrawCallback)(-9)
+
+// Per-draw data of the indirect path, read by imgui_indirect.vert with gl_DrawID.
+struct ImGuiIndirectDraw {
+    ImVec4  clip_rect;          // framebuffer pixels, max exclusive
+    u32     texture_index;      // slot in the bindless texture table
+    u32     padding[3];
+};
+
+struct ImGuiIndirectPushConstants {
+    ImVec2              scale;
+    ImVec2              translate;
+    vk::DeviceAddress   draw_buffer_reference;
+};
+
 class ImGuiRenderer : public ManagedObject {
 public:
+    // imgui.vert and imgui.frag declare the same push constant block, so the reflected range covers both stages
+    static constexpr auto PUSH_CONSTANT_STAGES = vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment;
+
     VulkanRenderer* vulkan;
     GpuTexture texture;
 
-    vk::DescriptorSetLayout bind_group_layout;
     GpuGraphicsPipelineState graphics_pipeline_state;
+    GpuGraphicsPipelineState indirect_pipeline_state;
 
 public:
     explicit ImGuiRenderer(VulkanRenderer* vulkan) : vulkan(vulkan) {
@@ -26,10 +46,12 @@ public:
     }
 
     ~ImGuiRenderer() override {
-        vulkan->context.logical_device.destroyDescriptorSetLayout(bind_group_layout);
         vulkan->CleanupTexture(&texture);
 
         gpu_destroy_graphics_pipeline_state(&vulkan->context, &graphics_pipeline_state);
+        if (IsIndirectSupported()) {
+            gpu_destroy_graphics_pipeline_state(&vulkan->context, &indirect_pipeline_state);
+        }
 
         ImGui_ImplGlfw_Shutdown();
         ImGui::DestroyContext();
@@ -47,26 +69,24 @@ public:
         io.Fonts->SetTexID(&texture);
     }
 
+    // Multi-draw indirect is an optional core feature, without it only the per-draw path is available.
+    auto IsIndirectSupported() const -> bool {
+        return vulkan->context.features.multiDrawIndirect;
+    }
+
     void CreateDeviceObjects() {
+        CreatePipelineState("shaders/imgui.vert.spv", "shaders/imgui.frag.spv", &graphics_pipeline_state);
+        if (IsIndirectSupported()) {
+            CreatePipelineState("shaders/imgui_indirect.vert.spv", "shaders/imgui_indirect.frag.spv", &indirect_pipeline_state);
+        }
+    }
+
+    void CreatePipelineState(const char* vert_path, const char* frag_path, GpuGraphicsPipelineState* state) {
         GpuShaderObject vert_shader_object;
         GpuShaderObject frag_shader_object;
 
-        auto entries = std::array{
-            vk::DescriptorSetLayoutBinding(0, vk::DescriptorType::eCombinedImageSampler, 1, vk::ShaderStageFlagBits::eFragment)
-        };
-
-        bind_group_layout = vulkan->context.logical_device.createDescriptorSetLayout(vk::DescriptorSetLayoutCreateInfo({}, entries));
-
-        auto bind_group_layouts = std::array{
-            bind_group_layout
-        };
-
-        auto push_constant_ranges = std::array{
-            vk::PushConstantRange(vk::ShaderStageFlagBits::eVertex, 0, sizeof(f32[4]))
-        };
-
-        auto vert_bytes = vulkan->ReadBytes("shaders/imgui.vert.spv").value();
-        auto frag_bytes = vulkan->ReadBytes("shaders/imgui.frag.spv").value();
+        auto vert_bytes = vulkan->ReadBytes(vert_path).value();
+        auto frag_bytes = vulkan->ReadBytes(frag_path).value();
 
         GpuShaderObjectCreateInfo vert_shader_object_info = {};
         vert_shader_object_info.stage = vk::ShaderStageFlagBits::eVertex;
@@ -126,57 +146,90 @@ public:
                 .bindings = bindings,
                 .attributes = attributes
             },
-            .bind_group_layouts = bind_group_layouts,
-            .push_constant_ranges = push_constant_ranges,
         };
 
         vk::PipelineRenderingCreateInfo rendering_create_info = {};
         rendering_create_info.colorAttachmentCount = 1;
         rendering_create_info.pColorAttachmentFormats = &vulkan->configuration.format;
-        gpu_create_graphics_pipeline_state(&vulkan->context, &graphics_pipeline_state, &state_create_info, &rendering_create_info);
+        gpu_create_graphics_pipeline_state(&vulkan->context, state, &state_create_info, &rendering_create_info);
 
         gpu_destroy_shader_object(&vulkan->context, &vert_shader_object);
         gpu_destroy_shader_object(&vulkan->context, &frag_shader_object);
     }
 
-    void RecordCommandBuffer(GpuCommandBuffer* command_buffer, ImDrawData* draw_data) {
+    // Uploads the vertex and index data of all lists into one contiguous buffer each, false when out of space.
+    auto UploadGeometry(GpuCommandBuffer* command_buffer, ImDrawData* draw_data, GpuBufferInfo* va, GpuBufferInfo* ia) -> bool {
+        if (draw_data->TotalVtxCount <= 0) {
+            return true;
+        }
+
+        // Create or resize the vertex/index buffers
+        if (!gpu_command_buffer_allocate(&vulkan->context, command_buffer, va, draw_data->TotalVtxCount * sizeof(ImDrawVert), alignof(ImDrawVert))) {
+            fprintf(stderr, "Failed to allocate vertex buffer for ImGui\n");
+            return false;
+        }
+        if (!gpu_command_buffer_allocate(&vulkan->context, command_buffer, ia, draw_data->TotalIdxCount * sizeof(ImDrawIdx), alignof(ImDrawIdx))) {
+            fprintf(stderr, "Failed to allocate index buffer for ImGui\n");
+            return false;
+        }
+
+        // Upload vertex/index data into a single contiguous GPU buffer
+        auto* vtx_dst = reinterpret_cast<ImDrawVert*>(gpu_buffer_contents(va));
+        auto* idx_dst = reinterpret_cast<ImDrawIdx*>(gpu_buffer_contents(ia));
+
+        for (auto cmd_list : std::span(draw_data->CmdLists, draw_data->CmdListsCount)) {
+            std::memcpy(vtx_dst, cmd_list->VtxBuffer.Data, cmd_list->VtxBuffer.Size * sizeof(ImDrawVert));
+            std::memcpy(idx_dst, cmd_list->IdxBuffer.Data, cmd_list->IdxBuffer.Size * sizeof(ImDrawIdx));
+            vtx_dst += cmd_list->VtxBuffer.Size;
+            idx_dst += cmd_list->IdxBuffer.Size;
+        }
+        return true;
+    }
+
+    // Clip rect of a draw command in framebuffer pixels, rounded the way a scissor would be; empty when nothing is visible.
+    static auto GetClipPixels(const ImDrawCmd& draw_cmd, ImDrawData* draw_data, i32 fb_width, i32 fb_height) -> vk::Rect2D {
+        auto clip_off = draw_data->DisplayPos;
+        auto clip_scale = draw_data->FramebufferScale;
+
+        auto clip_rect = ImRect(
+            (ImVec2(draw_cmd.ClipRect.x, draw_cmd.ClipRect.y) - clip_off) * clip_scale,
+            (ImVec2(draw_cmd.ClipRect.z, draw_cmd.ClipRect.w) - clip_off) * clip_scale
+        );
+        clip_rect.ClipWith(ImRect(0, 0, static_cast<f32>(fb_width), static_cast<f32>(fb_height)));
+
+        if (clip_rect.Min.x >= clip_rect.Max.x || clip_rect.Min.y >= clip_rect.Max.y) {
+            return vk::Rect2D{};
+        }
+
+        return vk::Rect2D{
+            vk::Offset2D{
+                static_cast<i32>(clip_rect.Min.x),
+                static_cast<i32>(clip_rect.Min.y),
+            },
+            vk::Extent2D{
+                static_cast<u32>(clip_rect.GetWidth()),
+                static_cast<u32>(clip_rect.GetHeight())
+            }
+        };
+    }
+
+    // Returns the number of draw calls recorded.
+    auto RecordCommandBuffer(GpuCommandBuffer* command_buffer, ImDrawData* draw_data) -> u32 {
         auto fb_width = static_cast<i32>(draw_data->DisplaySize.x * draw_data->FramebufferScale.x);
         auto fb_height = static_cast<i32>(draw_data->DisplaySize.y * draw_data->FramebufferScale.y);
         if (fb_width <= 0 || fb_height <= 0) {
-            return;
+            return 0;
         }
 
         GpuBufferInfo ia = {};
         GpuBufferInfo va = {};
-
-        if (draw_data->TotalVtxCount > 0) {
-            // Create or resize the vertex/index buffers
-            if (!gpu_command_buffer_allocate(&vulkan->context, command_buffer, &ia, draw_data->TotalVtxCount * sizeof(ImDrawVert), alignof(ImDrawVert))) {
-                fprintf(stderr, "Failed to allocate vertex buffer for ImGui\n");
-                return;
-            }
-            if (!gpu_command_buffer_allocate(&vulkan->context, command_buffer, &va, draw_data->TotalIdxCount * sizeof(ImDrawIdx), alignof(ImDrawIdx))) {
-                fprintf(stderr, "Failed to allocate index buffer for ImGui\n");
-                return;
-            }
-
-            // Upload vertex/index data into a single contiguous GPU buffer
-            auto* vtx_dst = reinterpret_cast<ImDrawVert*>(gpu_buffer_contents(&va));
-            auto* idx_dst = reinterpret_cast<ImDrawIdx*>(gpu_buffer_contents(&ia));
-
-            for (auto cmd_list : std::span(draw_data->CmdLists, draw_data->CmdListsCount)) {
-                std::memcpy(vtx_dst, cmd_list->VtxBuffer.Data, cmd_list->VtxBuffer.Size * sizeof(ImDrawVert));
-                std::memcpy(idx_dst, cmd_list->IdxBuffer.Data, cmd_list->IdxBuffer.Size * sizeof(ImDrawIdx));
-                vtx_dst += cmd_list->VtxBuffer.Size;
-                idx_dst += cmd_list->IdxBuffer.Size;
-            }
+        if (!UploadGeometry(command_buffer, draw_data, &va, &ia)) {
+            return 0;
         }
 
         SetupRenderState(command_buffer, draw_data, &va, &ia, fb_width, fb_height);
 
-        auto clip_off = draw_data->DisplayPos;
-        auto clip_scale = draw_data->FramebufferScale;
-
+        u32 draw_call_count = 0;
         i32 global_vtx_offset = 0;
         i32 global_idx_offset = 0;
         for (auto cmd_list : std::span(draw_data->CmdLists, draw_data->CmdListsCount)) {
@@ -184,66 +237,134 @@ public:
                 if (draw_cmd.UserCallback != nullptr) {
                     if (draw_cmd.UserCallback == ImDrawCallback_ResetRenderState) {
                         SetupRenderState(command_buffer, draw_data, &va, &ia, fb_width, fb_height);
-                    } else {
+                    } else if (draw_cmd.UserCallback != ImDrawCallback_FullResolution) {
                         draw_cmd.UserCallback(cmd_list, &draw_cmd);
                     }
                     continue;
                 }
 
-                auto clip_rect = ImRect(
-                    (ImVec2(draw_cmd.ClipRect.x, draw_cmd.ClipRect.y) - clip_off) * clip_scale,
-                    (ImVec2(draw_cmd.ClipRect.z, draw_cmd.ClipRect.w) - clip_off) * clip_scale
-                );
-                clip_rect.ClipWith(ImRect(0, 0, static_cast<f32>(fb_width), static_cast<f32>(fb_height)));
-
-                if (clip_rect.Min.x >= clip_rect.Max.x || clip_rect.Min.y >= clip_rect.Max.y) {
+                auto scissor = GetClipPixels(draw_cmd, draw_data, fb_width, fb_height);
+                if (scissor.extent.width == 0 || scissor.extent.height == 0) {
                     continue;
                 }
+                command_buffer->cmd_buffer.setScissor(0, 1, &scissor);
+
+                // the texture table is bound once in SetupRenderState, each draw only selects its slot
+                auto texture_index = BindlessTextureTable::GetIndex(static_cast<GpuTexture*>(draw_cmd.TextureId), &texture);
+                command_buffer->cmd_buffer.pushConstants(graphics_pipeline_state.pipeline_layout, PUSH_CONSTANT_STAGES, sizeof(float) * 4, sizeof(u32), &texture_index);
+                command_buffer->cmd_buffer.drawIndexed(draw_cmd.ElemCount, 1, draw_cmd.IdxOffset + global_idx_offset, static_cast<i32>(draw_cmd.VtxOffset + global_vtx_offset), 0);
+                draw_call_count += 1;
+            }
+            global_idx_offset += cmd_list->IdxBuffer.Size;
+            global_vtx_offset += cmd_list->VtxBuffer.Size;
+        }
+        return draw_call_count;
+    }
+
+    // GPU-driven variant of RecordCommandBuffer: draw commands are written into an indirect buffer and a buffer of per-draw
+    // clip rects and texture slots, then drawn with one multi-draw per run of commands between user callbacks. Clipping
+    // happens in imgui_indirect.frag instead of through per-draw scissors. Returns the number of draw calls recorded.
+    auto RecordCommandBufferIndirect(GpuCommandBuffer* command_buffer, ImDrawData* draw_data) -> u32 {
+        auto fb_width = static_cast<i32>(draw_data->DisplaySize.x * draw_data->FramebufferScale.x);
+        auto fb_height = static_cast<i32>(draw_data->DisplaySize.y * draw_data->FramebufferScale.y);
+        if (fb_width <= 0 || fb_height <= 0) {
+            return 0;
+        }
 
-                auto scissor = vk::Rect2D{
-                    vk::Offset2D{
-                        static_cast<i32>(clip_rect.Min.x),
-                        static_cast<i32>(clip_rect.Min.y),
-                    },
-                    vk::Extent2D{
-                        static_cast<u32>(clip_rect.GetWidth()),
-                        static_cast<u32>(clip_rect.GetHeight())
+        GpuBufferInfo ia = {};
+        GpuBufferInfo va = {};
+        if (!UploadGeometry(command_buffer, draw_data, &va, &ia)) {
+            return 0;
+        }
+
+        usize max_draw_count = 0;
+        for (auto cmd_list : std::span(draw_data->CmdLists, draw_data->CmdListsCount)) {
+            max_draw_count += static_cast<usize>(cmd_list->CmdBuffer.Size);
+        }
+        if (max_draw_count == 0) {
+            return 0;
+        }
+
+        GpuBufferInfo indirect_buffer = {};
+        GpuBufferInfo draw_buffer = {};
+        if (!gpu_command_buffer_allocate(&vulkan->context, command_buffer, &indirect_buffer, max_draw_count * sizeof(vk::DrawIndexedIndirectCommand), alignof(vk::DrawIndexedIndirectCommand))) {
+            fprintf(stderr, "Failed to allocate indirect buffer for ImGui\n");
+            return 0;
+        }
+        if (!gpu_command_buffer_allocate(&vulkan->context, command_buffer, &draw_buffer, max_draw_count * sizeof(ImGuiIndirectDraw), 16)) {
+            fprintf(stderr, "Failed to allocate draw buffer for ImGui\n");
+            return 0;
+        }
+
+        auto commands = reinterpret_cast<vk::DrawIndexedIndirectCommand*>(gpu_buffer_contents(&indirect_buffer));
+        auto draws = reinterpret_cast<ImGuiIndirectDraw*>(gpu_buffer_contents(&draw_buffer));
+
+        auto push_constants = SetupIndirectRenderState(command_buffer, draw_data, &va, &ia, fb_width, fb_height);
+
+        u32 draw_call_count = 0;
+        u32 first_draw = 0;
+        u32 draw_count = 0;
+
+        // gl_DrawID restarts at zero with every call, so the draw buffer address is moved to the first draw of the run
+        auto flush = [&] {
+            if (draw_count == first_draw) {
+                return;
+            }
+            push_constants.draw_buffer_reference = gpu_buffer_device_address(&draw_buffer) + first_draw * sizeof(ImGuiIndirectDraw);
+            command_buffer->cmd_buffer.pushConstants(indirect_pipeline_state.pipeline_layout, vk::ShaderStageFlagBits::eVertex, 0, sizeof(push_constants), &push_constants);
+            command_buffer->cmd_buffer.drawIndexedIndirect(indirect_buffer.buffer, indirect_buffer.offset + first_draw * sizeof(vk::DrawIndexedIndirectCommand), draw_count - first_draw, sizeof(vk::DrawIndexedIndirectCommand));
+            draw_call_count += 1;
+            first_draw = draw_count;
+        };
+
+        i32 global_vtx_offset = 0;
+        i32 global_idx_offset = 0;
+        for (auto cmd_list : std::span(draw_data->CmdLists, draw_data->CmdListsCount)) {
+            for (auto& draw_cmd : std::span(cmd_list->CmdBuffer.Data, cmd_list->CmdBuffer.Size)) {
+                if (draw_cmd.UserCallback != nullptr) {
+                    flush();
+                    if (draw_cmd.UserCallback == ImDrawCallback_ResetRenderState) {
+                        push_constants = SetupIndirectRenderState(command_buffer, draw_data, &va, &ia, fb_width, fb_height);
+                    } else if (draw_cmd.UserCallback != ImDrawCallback_FullResolution) {
+                        draw_cmd.UserCallback(cmd_list, &draw_cmd);
                     }
-                };
-                command_buffer->cmd_buffer.setScissor(0, 1, &scissor);
+                    continue;
+                }
 
-                auto bind_group = gpu_command_buffer_allocate_bind_group(&vulkan->context, command_buffer, bind_group_layout);
-                {
-                    auto p_texture = static_cast<GpuTexture*>(draw_cmd.TextureId);
-
-                    auto image_info = vk::DescriptorImageInfo()
-                        .setSampler(p_texture->sampler)
-                        .setImageView(p_texture->view)
-                        .setImageLayout(vk::ImageLayout::eShaderReadOnlyOptimal);
-
-                    auto writes = std::array{
-                        vk::WriteDescriptorSet()
-                            .setDstSet(bind_group)
-                            .setDstBinding(0)
-                            .setDstArrayElement(0)
-                            .setDescriptorType(vk::DescriptorType::eCombinedImageSampler)
-                            .setDescriptorCount(1)
-                            .setPImageInfo(&image_info),
-                    };
-
-                    vulkan->context.logical_device.updateDescriptorSets(writes, nullptr);
+                auto clip = GetClipPixels(draw_cmd, draw_data, fb_width, fb_height);
+                if (clip.extent.width == 0 || clip.extent.height == 0) {
+                    continue;
                 }
 
-                command_buffer->cmd_buffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, graphics_pipeline_state.pipeline_layout, 0, 1, &bind_group, 0, nullptr);
-                command_buffer->cmd_buffer.drawIndexed(draw_cmd.ElemCount, 1, draw_cmd.IdxOffset + global_idx_offset, static_cast<i32>(draw_cmd.VtxOffset + global_vtx_offset), 0);
+                commands[draw_count] = vk::DrawIndexedIndirectCommand()
+                    .setIndexCount(draw_cmd.ElemCount)
+                    .setInstanceCount(1)
+                    .setFirstIndex(draw_cmd.IdxOffset + static_cast<u32>(global_idx_offset))
+                    .setVertexOffset(static_cast<i32>(draw_cmd.VtxOffset) + global_vtx_offset)
+                    .setFirstInstance(0);
+
+                draws[draw_count] = ImGuiIndirectDraw{
+                    .clip_rect = ImVec4(
+                        static_cast<f32>(clip.offset.x),
+                        static_cast<f32>(clip.offset.y),
+                        static_cast<f32>(clip.offset.x + static_cast<i32>(clip.extent.width)),
+                        static_cast<f32>(clip.offset.y + static_cast<i32>(clip.extent.height))
+                    ),
+                    .texture_index = BindlessTextureTable::GetIndex(static_cast<GpuTexture*>(draw_cmd.TextureId), &texture),
+                };
+                draw_count += 1;
             }
             global_idx_offset += cmd_list->IdxBuffer.Size;
             global_vtx_offset += cmd_list->VtxBuffer.Size;
         }
+        flush();
+
+        return draw_call_count;
     }
 
     void SetupRenderState(GpuCommandBuffer* command_buffer, ImDrawData* draw_data, GpuBufferInfo* va, GpuBufferInfo* ia, int fb_width, int fb_height) {
         command_buffer->cmd_buffer.bindPipeline(vk::PipelineBindPoint::eGraphics, graphics_pipeline_state.pipeline);
+        command_buffer->cmd_buffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, graphics_pipeline_state.pipeline_layout, BindlessTextureTable::BIND_GROUP_INDEX, 1, &vulkan->textures->bind_group, 0, nullptr);
 
         if (draw_data->TotalVtxCount > 0) {
             command_buffer->cmd_buffer.bindVertexBuffers(0, 1, &va->buffer, &va->offset);
@@ -259,7 +380,31 @@ public:
         float translate[2];
         translate[0] = -1.0f - draw_data->DisplayPos.x * scale[0];
         translate[1] = -1.0f - draw_data->DisplayPos.y * scale[1];
-        command_buffer->cmd_buffer.pushConstants(graphics_pipeline_state.pipeline_layout, vk::ShaderStageFlagBits::eVertex, sizeof(float) * 0, sizeof(float) * 2, scale);
-        command_buffer->cmd_buffer.pushConstants(graphics_pipeline_state.pipeline_layout, vk::ShaderStageFlagBits::eVertex, sizeof(float) * 2, sizeof(float) * 2, translate);
+        command_buffer->cmd_buffer.pushConstants(graphics_pipeline_state.pipeline_layout, PUSH_CONSTANT_STAGES, sizeof(float) * 0, sizeof(float) * 2, scale);
+        command_buffer->cmd_buffer.pushConstants(graphics_pipeline_state.pipeline_layout, PUSH_CONSTANT_STAGES, sizeof(float) * 2, sizeof(float) * 2, translate);
+    }
+
+    // Like SetupRenderState with a scissor covering the whole framebuffer, returns the push constants without the draw buffer.
+    auto SetupIndirectRenderState(GpuCommandBuffer* command_buffer, ImDrawData* draw_data, GpuBufferInfo* va, GpuBufferInfo* ia, int fb_width, int fb_height) -> ImGuiIndirectPushConstants {
+        command_buffer->cmd_buffer.bindPipeline(vk::PipelineBindPoint::eGraphics, indirect_pipeline_state.pipeline);
+        command_buffer->cmd_buffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, indirect_pipeline_state.pipeline_layout, BindlessTextureTable::BIND_GROUP_INDEX, 1, &vulkan->textures->bind_group, 0, nullptr);
+
+        if (draw_data->TotalVtxCount > 0) {
+            command_buffer->cmd_buffer.bindVertexBuffers(0, 1, &va->buffer, &va->offset);
+            command_buffer->cmd_buffer.bindIndexBuffer(ia->buffer, ia->offset, vk::IndexType::eUint32);
+        }
+
+        auto viewport = vk::Viewport(0, 0, static_cast<f32>(fb_width), static_cast<f32>(fb_height), 0.0f, 1.0f);
+        command_buffer->cmd_buffer.setViewport(0, 1, &viewport);
+
+        auto scissor = vk::Rect2D(vk::Offset2D(0, 0), vk::Extent2D(static_cast<u32>(fb_width), static_cast<u32>(fb_height)));
+        command_buffer->cmd_buffer.setScissor(0, 1, &scissor);
+
+        auto scale = ImVec2(2.0f / draw_data->DisplaySize.x, 2.0f / draw_data->DisplaySize.y);
+        return ImGuiIndirectPushConstants{
+            .scale = scale,
+            .translate = ImVec2(-1.0f - draw_data->DisplayPos.x * scale.x, -1.0f - draw_data->DisplayPos.y * scale.y),
+            .draw_buffer_reference = 0,
+        };
     }
 };
\ No newline at end of file
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <imgui.h>
+#include <imgui_internal.h>
+
+enum class OcclusionResult {
+    eVisible,
+    eTrimmed,   // part of the rect is hidden, what is left is still a rect
+    eOccluded,
+};
+
+// Finds the pixels that opaque rectangles of later draw lists cover, so the rasterizer can skip the parts of earlier lists
+// hidden behind them, like windows below another window.
+//
+// Occluders are solid quads, both triangles in white pixel of solid_texture at full alpha and axis-aligned, the way window
+// backgrounds and title bars are filled without rounding. Each is shrunk to the pixels it covers completely, inside its
+// clip rect. A trimmed rect no longer covers all of the triangle, so its dispatch has to test against the rect, with the
+// clipped rasterizer variant, to leave the hidden pixels alone. Otherwise the lanes that round the dispatch up to whole
+// workgroups write behind the occluder, outside the rect the dispatch is ordered by, and race with it.
+class OcclusionCuller {
+public:
+    // smaller quads are mostly widget frames, which hide little and only make the occluder list longer
+    static constexpr f32 MIN_OCCLUDER_PIXELS = 64.0F * 64.0F;
+
+    // Scales are the rasterizer's, for positions and clip rects, and bounds is the part of the target in pixels it draws to.
+    // Occluders shrink by margin pixels on every side.
+    void Build(const ImDrawData* draw_data, ImVec2 viewport_scale, ImVec2 clip_scale, ImTextureID solid_texture, ImVec2 white_pixel, const ImRect& bounds, f32 margin) {
+        occluders.clear();
+        front_occluder_counts.assign(static_cast<usize>(draw_data->CmdListsCount), 0);
+
+        // lists draw back to front, so walking them backwards appends the occluders in front of a list before its own
+        for (auto i = draw_data->CmdListsCount - 1; i >= 0; --i) {
+            front_occluder_counts[static_cast<usize>(i)] = occluders.size();
+            AddOccluders(draw_data, draw_data->CmdLists[i], viewport_scale, clip_scale, solid_texture, white_pixel, bounds, margin);
+        }
+    }
+
+    // Shrinks pixels, an integer rect of list_index, by the occluders of the lists in front of it.
+    auto Cull(usize list_index, ImRect* pixels) const -> OcclusionResult {
+        auto result = OcclusionResult::eVisible;
+        for (auto& occluder : std::span(occluders.data(), front_occluder_counts[list_index])) {
+            if (occluder.Contains(*pixels)) {
+                return OcclusionResult::eOccluded;
+            }
+
+            // an occluder spanning the whole height or width cuts off a side, anything else would leave more than a rect
+            auto spans_y = occluder.Min.y <= pixels->Min.y && occluder.Max.y >= pixels->Max.y;
+            auto spans_x = occluder.Min.x <= pixels->Min.x && occluder.Max.x >= pixels->Max.x;
+            if (spans_y && occluder.Min.x <= pixels->Min.x && occluder.Max.x > pixels->Min.x) {
+                pixels->Min.x = occluder.Max.x;
+            } else if (spans_y && occluder.Max.x >= pixels->Max.x && occluder.Min.x < pixels->Max.x) {
+                pixels->Max.x = occluder.Min.x;
+            } else if (spans_x && occluder.Min.y <= pixels->Min.y && occluder.Max.y > pixels->Min.y) {
+                pixels->Min.y = occluder.Max.y;
+            } else if (spans_x && occluder.Max.y >= pixels->Max.y && occluder.Min.y < pixels->Max.y) {
+                pixels->Max.y = occluder.Min.y;
+            } else {
+                continue;
+            }
+            result = OcclusionResult::eTrimmed;
+        }
+        return result;
+    }
+
+    auto GetOccluderCount() const -> u32 {
+        return static_cast<u32>(occluders.size());
+    }
+
+private:
+    void AddOccluders(const ImDrawData* draw_data, const ImDrawList* list, ImVec2 viewport_scale, ImVec2 clip_scale, ImTextureID solid_texture, ImVec2 white_pixel, const ImRect& bounds, f32 margin) {
+        auto clip_off = draw_data->DisplayPos;
+
+        for (auto& cmd : std::span(list->CmdBuffer.Data, list->CmdBuffer.Size)) {
+            if (cmd.UserCallback != nullptr || cmd.TextureId != solid_texture) {
+                continue;
+            }
+
+            // only pixels entirely inside the clip rect, the opposite rounding of the rasterizer's
+            auto clip = InnerPixels(ImRect(
+                (ImVec2(cmd.ClipRect.x, cmd.ClipRect.y) - clip_off) * clip_scale,
+                (ImVec2(cmd.ClipRect.z, cmd.ClipRect.w) - clip_off) * clip_scale
+            ));
+            clip.ClipWithFull(bounds);
+
+            for (u32 i = 0; i + 6 <= cmd.ElemCount; i += 3) {
+                auto quad = GetOpaqueQuad(list, cmd.IdxOffset + i, cmd.VtxOffset, white_pixel);
+                if (!quad.has_value()) {
+                    continue;
+                }
+
+                auto occluder = InnerPixels(ImRect(quad->Min * viewport_scale, quad->Max * viewport_scale));
+                occluder.ClipWithFull(clip);
+                occluder.Expand(-margin);
+                if (occluder.GetWidth() > 0.0F && occluder.GetHeight() > 0.0F && occluder.GetArea() >= MIN_OCCLUDER_PIXELS) {
+                    occluders.push_back(occluder);
+                }
+                i += 3;
+            }
+        }
+    }
+
+    static auto InnerPixels(const ImRect& rect) -> ImRect {
+        return ImRect(std::ceil(rect.Min.x), std::ceil(rect.Min.y), std::floor(rect.Max.x), std::floor(rect.Max.y));
+    }
+
+    // The rect the two triangles at index_offset fill, when they are opaque, solid and split the rect along one diagonal.
+    static auto GetOpaqueQuad(const ImDrawList* list, u32 index_offset, u32 vertex_offset, ImVec2 white_pixel) -> std::optional<ImRect> {
+        auto alpha_mask = static_cast<ImU32>(IM_COL32_A_MASK);
+
+        std::array<const ImDrawVert*, 6> vertices = {};
+        auto rect = ImRect(FLT_MAX, FLT_MAX, -FLT_MAX, -FLT_MAX);
+        for (u32 i = 0; i < 6; ++i) {
+            auto& vertex = list->VtxBuffer.Data[list->IdxBuffer.Data[index_offset + i] + vertex_offset];
+            if (vertex.uv.x != white_pixel.x || vertex.uv.y != white_pixel.y || (vertex.col & alpha_mask) != alpha_mask) {
+                return std::nullopt;
+            }
+            vertices[i] = &vertex;
+            rect.Add(vertex.pos);
+        }
+
+        // each triangle uses three different corners, and the corners they leave out are diagonally opposite
+        std::array<u32, 2> missing_corners = {};
+        for (u32 triangle = 0; triangle < 2; ++triangle) {
+            u32 corner_mask = 0;
+            for (u32 i = 0; i < 3; ++i) {
+                auto pos = vertices[triangle * 3 + i]->pos;
+                auto on_x = pos.x == rect.Min.x || pos.x == rect.Max.x;
+                auto on_y = pos.y == rect.Min.y || pos.y == rect.Max.y;
+                if (!on_x || !on_y) {
+                    return std::nullopt;
+                }
+                corner_mask |= 1u << ((pos.x == rect.Max.x ? 1u : 0u) | (pos.y == rect.Max.y ? 2u : 0u));
+            }
+            if (std::popcount(corner_mask) != 3) {
+                return std::nullopt;
+            }
+            missing_corners[triangle] = static_cast<u32>(std::countr_zero(~corner_mask & 0xFu));
+        }
+        if ((missing_corners[0] ^ missing_corners[1]) != 3u) {
+            return std::nullopt;
+        }
+        return rect;
+    }
+
+private:
+    std::vector<ImRect>     occluders               = {};   // front to back
+    std::vector<usize>      front_occluder_counts   = {};   // per list, how many of occluders are in front of it
+};
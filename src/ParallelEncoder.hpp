@@ -0,0 +1,158 @@
+#pragma once
+
+#include "VulkanRenderer.hpp"
+
+// Records independent parts of a command stream on worker threads, each into a secondary command buffer that the primary
+// then executes in task order.
+//
+// Every task has its own command pool and bind group allocator per frame slot and queue family, used by whichever thread
+// claimed the task, and allocates its transient buffers from a slice of the primary's buffer allocator, so recording needs
+// no locks. The calling thread records tasks too. Only for commands outside of rendering, and at most once per frame and
+// queue family, since a second call would reset the command buffers of the first.
+class ParallelEncoder : public ManagedObject {
+public:
+    static constexpr u32 MAX_WORKER_COUNT = 8;
+    static constexpr u32 MAX_TASK_COUNT = MAX_WORKER_COUNT + 1;
+
+    using TaskCallback = std::function<void(u32 task_index, GpuCommandBuffer* command_buffer)>;
+
+    VulkanRenderer*     vulkan;
+
+private:
+    // [frame slot][queue family: graphics, compute][task]
+    using TaskCommandBuffers = std::array<std::array<std::array<GpuCommandBuffer, MAX_TASK_COUNT>, 2>, MAX_FRAMES_IN_FLIGHT>;
+
+    std::vector<std::thread>    workers;
+    TaskCommandBuffers          command_buffers     = {};
+
+    // the job, written by the caller before job_generation is bumped
+    const TaskCallback*         job_callback        = {};
+    std::array<GpuCommandBuffer*, MAX_TASK_COUNT> job_command_buffers = {};
+    u32                         job_task_count      = 0;
+    std::atomic<u64>            job_generation      = 0;
+    std::atomic<u32>            next_task           = 0;
+    std::atomic<u32>            finished_workers    = 0;
+    std::atomic<bool>           stopping            = false;
+
+    std::mutex                  error_mutex;
+    std::exception_ptr          error;
+
+public:
+    explicit ParallelEncoder(VulkanRenderer* vulkan) : vulkan(vulkan) {
+        auto hardware_threads = std::max(std::thread::hardware_concurrency(), 2u);
+        auto worker_count = std::min(hardware_threads - 1, MAX_WORKER_COUNT);
+        for (u32 i = 0; i < worker_count; ++i) {
+            workers.emplace_back([this] { WorkerMain(); });
+        }
+    }
+
+    ~ParallelEncoder() override {
+        stopping.store(true, std::memory_order_release);
+        job_generation.fetch_add(1, std::memory_order_release);
+        job_generation.notify_all();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+
+        for (auto& families : command_buffers) {
+            for (auto& tasks : families) {
+                for (auto& command_buffer : tasks) {
+                    if (command_buffer.cmd_pool) {
+                        gpu_destroy_command_buffer(&vulkan->context, &command_buffer);
+                    }
+                }
+            }
+        }
+    }
+
+    // Threads recording tasks, the caller included.
+    auto GetThreadCount() const -> u32 {
+        return static_cast<u32>(workers.size()) + 1;
+    }
+
+    // Runs callback once per entry of arena_sizes, at most MAX_TASK_COUNT, each task getting that many bytes of primary's
+    // buffer allocator and a secondary command buffer begun for compute and transfer work. Returns once all of them are
+    // executed in primary. When primary's allocator runs out, the allocations of the remaining tasks fail.
+    void Encode(GpuCommandBuffer* primary, Slice<vk::DeviceSize> arena_sizes, const TaskCallback& callback) {
+        assert(arena_sizes.size() <= MAX_TASK_COUNT);
+
+        auto family = primary->queue_family_index == vulkan->context.graphics_queue_family_index ? 0 : 1;
+        auto& task_command_buffers = command_buffers[vulkan->current_frame_index][family];
+
+        for (u32 i = 0; i < arena_sizes.size(); ++i) {
+            auto command_buffer = &task_command_buffers[i];
+            if (!command_buffer->cmd_pool) {
+                gpu_create_command_buffer(&vulkan->context, command_buffer, primary->queue_family_index, vk::CommandBufferLevel::eSecondary);
+            }
+
+            // the frame slot came back, so the GPU is done with what the pool recorded last time
+            vulkan->context.logical_device.resetCommandPool(command_buffer->cmd_pool, {});
+            gpu_reset_command_buffer(&vulkan->context, command_buffer);
+            gpu_allocator_slice(&primary->buffer_allocator, &command_buffer->buffer_allocator, arena_sizes.data()[i], 16);
+
+            job_command_buffers[i] = command_buffer;
+        }
+
+        job_callback = &callback;
+        job_task_count = arena_sizes.size();
+        next_task.store(0, std::memory_order_relaxed);
+        finished_workers.store(0, std::memory_order_relaxed);
+        job_generation.fetch_add(1, std::memory_order_release);
+        job_generation.notify_all();
+
+        RunTasks();
+
+        auto worker_count = static_cast<u32>(workers.size());
+        for (auto finished = finished_workers.load(std::memory_order_acquire); finished != worker_count; finished = finished_workers.load(std::memory_order_acquire)) {
+            finished_workers.wait(finished, std::memory_order_acquire);
+        }
+        job_callback = nullptr;
+
+        if (error) {
+            std::rethrow_exception(std::exchange(error, nullptr));
+        }
+
+        std::array<vk::CommandBuffer, MAX_TASK_COUNT> secondaries;
+        for (u32 i = 0; i < job_task_count; ++i) {
+            secondaries[i] = job_command_buffers[i]->cmd_buffer;
+        }
+        if (job_task_count != 0) {
+            primary->cmd_buffer.executeCommands(job_task_count, secondaries.data());
+        }
+    }
+
+private:
+    void RunTasks() {
+        for (auto task = next_task.fetch_add(1, std::memory_order_relaxed); task < job_task_count; task = next_task.fetch_add(1, std::memory_order_relaxed)) {
+            auto command_buffer = job_command_buffers[task];
+            try {
+                auto inheritance_info = vk::CommandBufferInheritanceInfo();
+                command_buffer->cmd_buffer.begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit, &inheritance_info));
+                (*job_callback)(task, command_buffer);
+                command_buffer->cmd_buffer.end();
+            } catch (...) {
+                auto lock = std::lock_guard(error_mutex);
+                if (!error) {
+                    error = std::current_exception();
+                }
+            }
+        }
+    }
+
+    void WorkerMain() {
+        // workers start before the first job, loading the generation here could already see it and miss it
+        u64 seen_generation = 0;
+        while (true) {
+            job_generation.wait(seen_generation, std::memory_order_acquire);
+            seen_generation = job_generation.load(std::memory_order_acquire);
+            if (stopping.load(std::memory_order_acquire)) {
+                return;
+            }
+
+            RunTasks();
+
+            finished_workers.fetch_add(1, std::memory_order_release);
+            finished_workers.notify_all();
+        }
+    }
+};
@@ -0,0 +1,310 @@
+#pragma once
+
+#include "VulkanRenderer.hpp"
+#include "ManagedObject.hpp"
+
+// Identifies a readback in flight, ready once the frame with frame_value has finished on the GPU.
+struct ReadbackTicket {
+    u32 slot        = {};
+    u64 frame_value = {};
+};
+
+// Pixels of a finished readback, tightly packed rows of texel_size bytes per texel.
+struct ReadbackResult {
+    const u8*       pixels      = {};
+    vk::Extent2D    extent      = {};
+    vk::Format      format      = {};
+    u32             texel_size  = {};
+};
+
+struct ReadbackSlot {
+    GpuBufferInfo   buffer      = {};
+    vk::Extent2D    extent      = {};
+    vk::Format      format      = {};
+    u32             texel_size  = {};
+    u64             frame_value = {};
+    bool            busy        = false;
+};
+
+struct ReadbackPushConstants {
+    vk::DeviceAddress   pixel_buffer_reference;
+    i32                 offset_x;
+    i32                 offset_y;
+    u32                 width;
+    u32                 height;
+};
+
+// Copies image regions into a ring of host-cached buffers at the end of a frame, without waiting for the GPU.
+//
+// A slot stays busy from RequestReadback until Release, RequestReadback returns nothing while every slot is busy.
+class ReadbackService : public ManagedObject {
+public:
+    static constexpr u32 SLOT_COUNT = 4;
+
+    VulkanRenderer*                         vulkan;
+    std::array<ReadbackSlot, SLOT_COUNT>    slots;
+    GpuComputePipelineState                 convert_pipeline_state;
+
+public:
+    explicit ReadbackService(VulkanRenderer* vulkan) : vulkan(vulkan) {
+        CreateConvertPipelineState();
+    }
+
+    ~ReadbackService() override {
+        for (auto& slot : slots) {
+            gpu_buffer_destroy(&vulkan->context, &slot.buffer);
+        }
+        gpu_destroy_compute_pipeline_state(&vulkan->context, &convert_pipeline_state);
+    }
+
+    // Records a copy of rect from an image in the given layout, last accessed by src_stages, and puts it back into that layout.
+    auto RequestReadback(GpuCommandBuffer* command_buffer, vk::Image image, vk::Format format, vk::ImageLayout layout, vk::PipelineStageFlags2 src_stages, vk::Rect2D rect) -> std::optional<ReadbackTicket> {
+        auto texel_size = GetTexelSize(format);
+        auto slot_index = AcquireSlot(rect.extent, format, texel_size);
+        if (!slot_index) {
+            return std::nullopt;
+        }
+        auto& slot = slots[*slot_index];
+
+        auto subresource_range = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1);
+        {
+            auto barriers = std::array{
+                vk::ImageMemoryBarrier2()
+                    .setSrcStageMask(src_stages)
+                    .setDstStageMask(vk::PipelineStageFlagBits2::eTransfer)
+                    .setSrcAccessMask(vk::AccessFlagBits2::eMemoryWrite)
+                    .setDstAccessMask(vk::AccessFlagBits2::eTransferRead)
+                    .setOldLayout(layout)
+                    .setNewLayout(vk::ImageLayout::eTransferSrcOptimal)
+                    .setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+                    .setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+                    .setImage(image)
+                    .setSubresourceRange(subresource_range),
+            };
+            command_buffer->cmd_buffer.pipelineBarrier2(vk::DependencyInfo({}, {}, {}, barriers));
+        }
+
+        auto region = vk::BufferImageCopy()
+            .setBufferOffset(0)
+            .setImageSubresource(vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, 0, 1))
+            .setImageOffset(vk::Offset3D(rect.offset.x, rect.offset.y, 0))
+            .setImageExtent(vk::Extent3D(rect.extent.width, rect.extent.height, 1));
+
+        command_buffer->cmd_buffer.copyImageToBuffer(image, vk::ImageLayout::eTransferSrcOptimal, slot.buffer.buffer, 1, &region);
+
+        {
+            auto image_barriers = std::array{
+                vk::ImageMemoryBarrier2()
+                    .setSrcStageMask(vk::PipelineStageFlagBits2::eTransfer)
+                    .setDstStageMask(vk::PipelineStageFlagBits2::eAllCommands)
+                    .setSrcAccessMask(vk::AccessFlagBits2::eNone)
+                    .setDstAccessMask(vk::AccessFlagBits2::eNone)
+                    .setOldLayout(vk::ImageLayout::eTransferSrcOptimal)
+                    .setNewLayout(layout)
+                    .setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+                    .setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+                    .setImage(image)
+                    .setSubresourceRange(subresource_range),
+            };
+            auto buffer_barriers = std::array{
+                GetHostReadBarrier(&slot, vk::PipelineStageFlagBits2::eTransfer, vk::AccessFlagBits2::eTransferWrite)
+            };
+            command_buffer->cmd_buffer.pipelineBarrier2(vk::DependencyInfo({}, {}, buffer_barriers, image_barriers));
+        }
+
+        return ReadbackTicket{ *slot_index, slot.frame_value };
+    }
+
+    // Like RequestReadback for an RGBA32F texture with storage usage, packed to RGBA8 by a compute pass that writes
+    // straight into the readback buffer, a quarter of the bytes of a plain copy.
+    auto RequestConvertedReadback(GpuCommandBuffer* command_buffer, GpuTexture* texture, vk::ImageLayout layout, vk::PipelineStageFlags2 src_stages, vk::Rect2D rect) -> std::optional<ReadbackTicket> {
+        auto slot_index = AcquireSlot(rect.extent, vk::Format::eR8G8B8A8Unorm, 4);
+        if (!slot_index) {
+            return std::nullopt;
+        }
+        auto& slot = slots[*slot_index];
+
+        auto subresource_range = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1);
+        {
+            auto barriers = std::array{
+                vk::ImageMemoryBarrier2()
+                    .setSrcStageMask(src_stages)
+                    .setDstStageMask(vk::PipelineStageFlagBits2::eComputeShader)
+                    .setSrcAccessMask(vk::AccessFlagBits2::eMemoryWrite)
+                    .setDstAccessMask(vk::AccessFlagBits2::eShaderStorageRead)
+                    .setOldLayout(layout)
+                    .setNewLayout(vk::ImageLayout::eGeneral)
+                    .setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+                    .setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+                    .setImage(texture->image)
+                    .setSubresourceRange(subresource_range),
+            };
+            command_buffer->cmd_buffer.pipelineBarrier2(vk::DependencyInfo({}, {}, {}, barriers));
+        }
+
+        auto image_info = vk::DescriptorImageInfo()
+            .setImageView(texture->view)
+            .setImageLayout(vk::ImageLayout::eGeneral);
+
+        auto writes = std::array{
+            vk::WriteDescriptorSet()
+                .setDstBinding(0)
+                .setDstArrayElement(0)
+                .setDescriptorType(vk::DescriptorType::eStorageImage)
+                .setDescriptorCount(1)
+                .setPImageInfo(&image_info)
+        };
+
+        auto push_constants = ReadbackPushConstants{
+            .pixel_buffer_reference = slot.buffer.address,
+            .offset_x = rect.offset.x,
+            .offset_y = rect.offset.y,
+            .width = rect.extent.width,
+            .height = rect.extent.height,
+        };
+
+        command_buffer->cmd_buffer.bindPipeline(vk::PipelineBindPoint::eCompute, convert_pipeline_state.pipeline);
+        gpu_command_buffer_push_bind_group(command_buffer, vk::PipelineBindPoint::eCompute, convert_pipeline_state.pipeline_layout, 0, writes);
+        command_buffer->cmd_buffer.pushConstants(convert_pipeline_state.pipeline_layout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(push_constants), &push_constants);
+        gpu_dispatch_threads(command_buffer->cmd_buffer, &convert_pipeline_state, rect.extent.width, rect.extent.height, 1);
+
+        {
+            auto image_barriers = std::array{
+                vk::ImageMemoryBarrier2()
+                    .setSrcStageMask(vk::PipelineStageFlagBits2::eComputeShader)
+                    .setDstStageMask(vk::PipelineStageFlagBits2::eAllCommands)
+                    .setSrcAccessMask(vk::AccessFlagBits2::eNone)
+                    .setDstAccessMask(vk::AccessFlagBits2::eNone)
+                    .setOldLayout(vk::ImageLayout::eGeneral)
+                    .setNewLayout(layout)
+                    .setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+                    .setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+                    .setImage(texture->image)
+                    .setSubresourceRange(subresource_range),
+            };
+            auto buffer_barriers = std::array{
+                GetHostReadBarrier(&slot, vk::PipelineStageFlagBits2::eComputeShader, vk::AccessFlagBits2::eShaderStorageWrite)
+            };
+            command_buffer->cmd_buffer.pipelineBarrier2(vk::DependencyInfo({}, {}, buffer_barriers, image_barriers));
+        }
+
+        return ReadbackTicket{ *slot_index, slot.frame_value };
+    }
+
+    auto IsReady(ReadbackTicket ticket) -> bool {
+        return vulkan->IsFrameValueCompleted(ticket.frame_value);
+    }
+
+    // Returns the pixels once the ticket is ready, they stay valid until Release.
+    auto GetResult(ReadbackTicket ticket) -> std::optional<ReadbackResult> {
+        if (!IsReady(ticket)) {
+            return std::nullopt;
+        }
+
+        auto& slot = slots[ticket.slot];
+
+        // host-cached memory is not necessarily coherent
+        if (!(slot.buffer.allocation.memory_property_flags & vk::MemoryPropertyFlagBits::eHostCoherent)) {
+            auto range = vk::MappedMemoryRange()
+                .setMemory(slot.buffer.allocation.device_memory)
+                .setOffset(0)
+                .setSize(VK_WHOLE_SIZE);
+
+            vk::resultCheck(vulkan->context.logical_device.invalidateMappedMemoryRanges(1, &range), "Failed to invalidate readback memory");
+        }
+
+        return ReadbackResult{
+            .pixels = static_cast<const u8*>(gpu_buffer_contents(&slot.buffer)),
+            .extent = slot.extent,
+            .format = slot.format,
+            .texel_size = slot.texel_size,
+        };
+    }
+
+    void Release(ReadbackTicket ticket) {
+        slots[ticket.slot].busy = false;
+    }
+
+private:
+    static auto GetTexelSize(vk::Format format) -> u32 {
+        switch (format) {
+            case vk::Format::eR32G32B32A32Sfloat:
+                return 16;
+            case vk::Format::eR16G16B16A16Sfloat:
+                return 8;
+            default:
+                return 4;
+        }
+    }
+
+    auto AcquireSlot(vk::Extent2D extent, vk::Format format, u32 texel_size) -> std::optional<u32> {
+        for (u32 i = 0; i < SLOT_COUNT; ++i) {
+            auto& slot = slots[i];
+            if (slot.busy) {
+                continue;
+            }
+
+            auto size = static_cast<vk::DeviceSize>(extent.width) * extent.height * texel_size;
+            if (slot.buffer.size < size) {
+                // the slot is free, so its previous readback has finished and the buffer can go right away
+                gpu_buffer_destroy(&vulkan->context, &slot.buffer);
+                CreateSlotBuffer(&slot.buffer, size);
+            }
+
+            slot.extent = extent;
+            slot.format = format;
+            slot.texel_size = texel_size;
+            slot.frame_value = vulkan->current_frame_value;
+            slot.busy = true;
+            return i;
+        }
+        return std::nullopt;
+    }
+
+    void CreateSlotBuffer(GpuBufferInfo* buffer, vk::DeviceSize size) {
+        auto buffer_create_info = vk::BufferCreateInfo()
+            .setSize(size)
+            .setUsage(vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eShaderDeviceAddress)
+            .setSharingMode(vk::SharingMode::eExclusive);
+
+        *buffer = {};
+        buffer->size = size;
+        vk::resultCheck(vulkan->context.logical_device.createBuffer(&buffer_create_info, nullptr, &buffer->buffer), "Failed to create buffer.");
+        gpu_buffer_storage(&vulkan->context, buffer, GpuStorageMode::eManaged, vk::MemoryAllocateFlagBits::eDeviceAddress);
+    }
+
+    static auto GetHostReadBarrier(ReadbackSlot* slot, vk::PipelineStageFlags2 src_stage, vk::AccessFlags2 src_access) -> vk::BufferMemoryBarrier2 {
+        return vk::BufferMemoryBarrier2()
+            .setSrcStageMask(src_stage)
+            .setDstStageMask(vk::PipelineStageFlagBits2::eHost)
+            .setSrcAccessMask(src_access)
+            .setDstAccessMask(vk::AccessFlagBits2::eHostRead)
+            .setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+            .setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+            .setBuffer(slot->buffer.buffer)
+            .setOffset(0)
+            .setSize(VK_WHOLE_SIZE);
+    }
+
+    void CreateConvertPipelineState() {
+        auto comp_bytes = vulkan->ReadBytes("shaders/readback_convert.comp.spv").value();
+
+        GpuShaderObjectCreateInfo shader_object_info = {};
+        shader_object_info.stage = vk::ShaderStageFlagBits::eCompute;
+        shader_object_info.codeSize = comp_bytes.size();
+        shader_object_info.pCode = comp_bytes.data();
+        shader_object_info.pName = "main";
+
+        GpuShaderObject shader_object;
+        gpu_create_shader_object(&vulkan->context, &shader_object, &shader_object_info);
+
+        // the converted texture changes with every request, so its binding is pushed instead of allocated
+        auto state_create_info = GpuComputePipelineStateCreateInfo{
+            .shader_object = &shader_object,
+            .push_bind_group_mask = 1u << 0,
+        };
+        gpu_create_compute_pipeline_state(&vulkan->context, &state_create_info, &convert_pipeline_state);
+
+        gpu_destroy_shader_object(&vulkan->context, &shader_object);
+    }
+};
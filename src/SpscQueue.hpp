@@ -0,0 +1,101 @@
+#pragma once
+
+// Bounded single-producer/single-consumer queue over preallocated slots, written and read in place.
+//
+// The producer fills the slot returned by BeginWrite and publishes it with EndWrite, the consumer reads the slot returned
+// by BeginRead and hands it back with EndRead. Slots are reused, so whatever the consumer leaves in a slot is visible to
+// the producer the next time that slot comes round. The fast path is two atomic counters, blocking only happens when the
+// queue is full or empty and waits on an event counter bumped by every state change.
+template<typename T, usize Capacity>
+class SpscQueue {
+public:
+    // Blocks while every slot is in use, returns nullptr once the queue is closed.
+    auto BeginWrite() -> T* {
+        auto write_index = tail.load(std::memory_order_relaxed);
+        while (true) {
+            auto event = events.load(std::memory_order_acquire);
+            if (write_index - head.load(std::memory_order_acquire) < Capacity) {
+                return &slots[write_index % Capacity];
+            }
+            if (closed.load(std::memory_order_acquire)) {
+                return nullptr;
+            }
+            events.wait(event, std::memory_order_acquire);
+        }
+    }
+
+    // Non-blocking BeginWrite, returns nullptr when full or closed.
+    auto TryBeginWrite() -> T* {
+        auto write_index = tail.load(std::memory_order_relaxed);
+        if (closed.load(std::memory_order_acquire) || write_index - head.load(std::memory_order_acquire) >= Capacity) {
+            return nullptr;
+        }
+        return &slots[write_index % Capacity];
+    }
+
+    void EndWrite() {
+        tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        Signal();
+    }
+
+    // Blocks while the queue is empty, returns nullptr once the queue is closed and drained.
+    auto BeginRead() -> T* {
+        auto read_index = head.load(std::memory_order_relaxed);
+        while (true) {
+            auto event = events.load(std::memory_order_acquire);
+            if (tail.load(std::memory_order_acquire) != read_index) {
+                return &slots[read_index % Capacity];
+            }
+            if (closed.load(std::memory_order_acquire)) {
+                return nullptr;
+            }
+            events.wait(event, std::memory_order_acquire);
+        }
+    }
+
+    void EndRead() {
+        head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        Signal();
+    }
+
+    // Blocks until the consumer has handed back every published slot.
+    void WaitEmpty() {
+        while (true) {
+            auto event = events.load(std::memory_order_acquire);
+            if (tail.load(std::memory_order_acquire) == head.load(std::memory_order_acquire)) {
+                return;
+            }
+            events.wait(event, std::memory_order_acquire);
+        }
+    }
+
+    // Wakes both sides, the consumer still drains whatever was published before.
+    void Close() {
+        closed.store(true, std::memory_order_release);
+        Signal();
+    }
+
+    // Only valid while neither side is running.
+    void Reopen() {
+        closed.store(false, std::memory_order_relaxed);
+    }
+
+    auto GetSize() const -> usize {
+        return static_cast<usize>(tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire));
+    }
+
+private:
+    void Signal() {
+        events.fetch_add(1, std::memory_order_release);
+        events.notify_all();
+    }
+
+private:
+    std::array<T, Capacity>     slots   = {};
+
+    // counters only grow, the slot is the counter modulo Capacity
+    alignas(64) std::atomic<u64> head   = 0;
+    alignas(64) std::atomic<u64> tail   = 0;
+    alignas(64) std::atomic<u32> events = 0;
+    std::atomic<bool>            closed = false;
+};
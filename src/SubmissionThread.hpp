@@ -0,0 +1,266 @@
+#pragma once
+
+#include "gpu.hpp"
+#include "SpscQueue.hpp"
+#include "ManagedObject.hpp"
+
+// Copy of one vkQueueSubmit2 with an optional present after it, everything by value so the recording side can move on.
+struct SubmissionItem {
+    vk::Queue                                   queue                   = {};
+    std::array<vk::SemaphoreSubmitInfo, 4>      wait_infos              = {};
+    std::array<vk::CommandBufferSubmitInfo, 2>  command_buffer_infos    = {};
+    std::array<vk::SemaphoreSubmitInfo, 4>      signal_infos            = {};
+    u32                                         wait_count              = 0;
+    u32                                         command_buffer_count    = 0;
+    u32                                         signal_count            = 0;
+    vk::Fence                                   fence                   = {};
+
+    // presented after the submit when swapchain is set
+    vk::Queue                                   present_queue           = {};
+    vk::SwapchainKHR                            swapchain               = {};
+    vk::Semaphore                               present_wait_semaphore  = {};
+    u32                                         image_index             = 0;
+};
+
+// Owns queue submission and presentation, optionally on a thread of its own so a present blocked by vsync never stalls
+// the thread recording the next frame.
+//
+// Every vkQueueSubmit2 and vkQueuePresentKHR goes through here, which also keeps aliased queues externally synchronized.
+// Items are taken from one recording thread at a time and executed in order. While the thread is stopped they run inline.
+// Present results arrive late on the thread, so out-of-date swapchains are reported through ConsumeSwapchainOutOfDate.
+// Swapchains are externally synchronized between acquire and present, so images are acquired through AcquireNextImage
+// and anything else touching a swapchain holds LockSwapchain.
+class SubmissionThread : public ManagedObject {
+public:
+    static constexpr usize QUEUE_CAPACITY = 8;
+    // how long WaitSemaphore blocks before checking for a failure again
+    static constexpr u64 ERROR_CHECK_INTERVAL_NS = 100'000'000;
+
+    GpuContext*                                     context;
+
+    // counters, readable from any thread
+    std::atomic<f64>                                submit_time_ms      = 0.0;  // exponential moving averages
+    std::atomic<f64>                                present_time_ms     = 0.0;
+    std::atomic<u64>                                submitted_count     = 0;
+    std::atomic<u64>                                presented_count     = 0;
+    std::atomic<u64>                                executed_count      = 0;
+    std::atomic<usize>                              max_queue_depth     = 0;
+
+private:
+    SpscQueue<SubmissionItem, QUEUE_CAPACITY>       items;
+    std::thread                                     thread;
+    std::atomic<bool>                               swapchain_out_of_date = false;
+    std::exception_ptr                              error;  // written by the thread once, before failed is set, never cleared
+    std::atomic<bool>                               failed = false;
+    std::mutex                                      swapchain_mutex;
+
+public:
+    explicit SubmissionThread(GpuContext* context) : context(context) {}
+
+    ~SubmissionThread() override {
+        if (thread.joinable()) {
+            items.Close();
+            thread.join();
+        }
+    }
+
+    auto IsRunning() const -> bool {
+        return thread.joinable();
+    }
+
+    void Start() {
+        if (thread.joinable()) {
+            return;
+        }
+        items.Reopen();
+        thread = std::thread([this] { ThreadMain(); });
+    }
+
+    // Executes everything still queued before returning.
+    void Stop() {
+        if (!thread.joinable()) {
+            return;
+        }
+        items.Close();
+        thread.join();
+        RethrowError();
+    }
+
+    // Blocks until every queued item has been submitted and presented, the GPU may still be busy with them.
+    void WaitIdle() {
+        if (thread.joinable()) {
+            items.WaitEmpty();
+            RethrowError();
+        }
+    }
+
+    auto GetQueueDepth() const -> usize {
+        return items.GetSize();
+    }
+
+    void Submit(vk::Queue queue, const vk::SubmitInfo2& submit_info, vk::Fence fence = {}) {
+        auto item = SubmissionItem{ .queue = queue, .fence = fence };
+        CopySubmitInfo(&item, submit_info);
+        Enqueue(item);
+    }
+
+    void SubmitAndPresent(vk::Queue queue, const vk::SubmitInfo2& submit_info, vk::Queue present_queue, vk::SwapchainKHR swapchain, u32 image_index, vk::Semaphore present_wait_semaphore) {
+        auto item = SubmissionItem{
+            .queue = queue,
+            .present_queue = present_queue,
+            .swapchain = swapchain,
+            .present_wait_semaphore = present_wait_semaphore,
+            .image_index = image_index,
+        };
+        CopySubmitInfo(&item, submit_info);
+        Enqueue(item);
+    }
+
+    auto LockSwapchain() -> std::unique_lock<std::mutex> {
+        return std::unique_lock(swapchain_mutex);
+    }
+
+    // Never holds the swapchain lock while blocking on a queued present, that present may be what frees the next image.
+    auto AcquireNextImage(vk::Device device, vk::SwapchainKHR swapchain, vk::Semaphore semaphore, u32* image_index) -> vk::Result {
+        while (true) {
+            auto executed = executed_count.load(std::memory_order_acquire);
+            auto pending = items.GetSize() != 0;
+
+            auto lock = LockSwapchain();
+            auto result = device.acquireNextImageKHR(swapchain, pending ? 0 : UINT64_MAX, semaphore, nullptr, image_index);
+            lock.unlock();
+
+            if (!pending || (result != vk::Result::eNotReady && result != vk::Result::eTimeout)) {
+                return result;
+            }
+            executed_count.wait(executed, std::memory_order_acquire);
+        }
+    }
+
+    // Waits for a timeline value signaled by a queued submit. A failed submit drops everything queued after it, so their
+    // values would never arrive; the wait checks for that in between and rethrows the failure instead of hanging.
+    void WaitSemaphore(vk::Semaphore semaphore, u64 value, const char* message) {
+        auto wait_info = vk::SemaphoreWaitInfo()
+            .setSemaphores(semaphore)
+            .setValues(value);
+
+        while (true) {
+            RethrowError();
+            auto result = context->logical_device.waitSemaphores(wait_info, thread.joinable() ? ERROR_CHECK_INTERVAL_NS : UINT64_MAX);
+            if (result != vk::Result::eTimeout) {
+                vk::resultCheck(result, message);
+                return;
+            }
+        }
+    }
+
+    auto HasFailed() const -> bool {
+        return failed.load(std::memory_order_acquire);
+    }
+
+    // Rethrows the failure that stopped the thread, every time, since nothing queued after it was submitted.
+    void RethrowError() {
+        if (failed.load(std::memory_order_acquire)) {
+            std::rethrow_exception(error);
+        }
+    }
+
+    // True once after a present reported the swapchain as out of date or suboptimal.
+    auto ConsumeSwapchainOutOfDate() -> bool {
+        return swapchain_out_of_date.exchange(false, std::memory_order_acq_rel);
+    }
+
+private:
+    static void CopySubmitInfo(SubmissionItem* item, const vk::SubmitInfo2& submit_info) {
+        assert(submit_info.waitSemaphoreInfoCount <= item->wait_infos.size());
+        assert(submit_info.commandBufferInfoCount <= item->command_buffer_infos.size());
+        assert(submit_info.signalSemaphoreInfoCount <= item->signal_infos.size());
+
+        item->wait_count = submit_info.waitSemaphoreInfoCount;
+        item->command_buffer_count = submit_info.commandBufferInfoCount;
+        item->signal_count = submit_info.signalSemaphoreInfoCount;
+        std::copy_n(submit_info.pWaitSemaphoreInfos, item->wait_count, item->wait_infos.begin());
+        std::copy_n(submit_info.pCommandBufferInfos, item->command_buffer_count, item->command_buffer_infos.begin());
+        std::copy_n(submit_info.pSignalSemaphoreInfos, item->signal_count, item->signal_infos.begin());
+    }
+
+    void Enqueue(const SubmissionItem& item) {
+        if (!thread.joinable()) {
+            Execute(item);
+            return;
+        }
+
+        RethrowError();
+
+        auto slot = items.BeginWrite();
+        *slot = item;
+        items.EndWrite();
+
+        auto depth = items.GetSize();
+        auto max_depth = max_queue_depth.load(std::memory_order_relaxed);
+        while (depth > max_depth && !max_queue_depth.compare_exchange_weak(max_depth, depth, std::memory_order_relaxed)) {}
+    }
+
+    void Execute(const SubmissionItem& item) {
+        constexpr f64 smoothing = 0.1;
+
+        auto submit_start = std::chrono::steady_clock::now();
+        auto submit_info = vk::SubmitInfo2()
+            .setWaitSemaphoreInfoCount(item.wait_count)
+            .setPWaitSemaphoreInfos(item.wait_infos.data())
+            .setCommandBufferInfoCount(item.command_buffer_count)
+            .setPCommandBufferInfos(item.command_buffer_infos.data())
+            .setSignalSemaphoreInfoCount(item.signal_count)
+            .setPSignalSemaphoreInfos(item.signal_infos.data());
+
+        item.queue.submit2(submit_info, item.fence);
+
+        auto submit_end = std::chrono::steady_clock::now();
+        auto submit_ms = std::chrono::duration<f64, std::milli>(submit_end - submit_start).count();
+        submit_time_ms.store(submit_time_ms.load(std::memory_order_relaxed) + (submit_ms - submit_time_ms.load(std::memory_order_relaxed)) * smoothing, std::memory_order_relaxed);
+        submitted_count.fetch_add(1, std::memory_order_relaxed);
+
+        if (!item.swapchain) {
+            return;
+        }
+
+        auto present_info = vk::PresentInfoKHR()
+            .setWaitSemaphoreCount(1)
+            .setPWaitSemaphores(&item.present_wait_semaphore)
+            .setSwapchainCount(1)
+            .setPSwapchains(&item.swapchain)
+            .setPImageIndices(&item.image_index);
+
+        auto result = [&] {
+            auto lock = LockSwapchain();
+            return item.present_queue.presentKHR(&present_info);
+        }();
+        if (result == vk::Result::eErrorOutOfDateKHR || result == vk::Result::eSuboptimalKHR) {
+            swapchain_out_of_date.store(true, std::memory_order_release);
+        } else {
+            vk::resultCheck(result, "Failed to present swapchain image");
+        }
+
+        auto present_ms = std::chrono::duration<f64, std::milli>(std::chrono::steady_clock::now() - submit_end).count();
+        present_time_ms.store(present_time_ms.load(std::memory_order_relaxed) + (present_ms - present_time_ms.load(std::memory_order_relaxed)) * smoothing, std::memory_order_relaxed);
+        presented_count.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void ThreadMain() {
+        while (auto item = items.BeginRead()) {
+            // after a failure the remaining items are dropped, the recording side rethrows on its next call
+            if (!failed.load(std::memory_order_relaxed)) {
+                try {
+                    Execute(*item);
+                } catch (...) {
+                    error = std::current_exception();
+                    failed.store(true, std::memory_order_release);
+                }
+            }
+            items.EndRead();
+
+            executed_count.fetch_add(1, std::memory_order_release);
+            executed_count.notify_all();
+        }
+    }
+};
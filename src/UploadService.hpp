@@ -0,0 +1,378 @@
+#pragma once
+
+#include "gpu.hpp"
+#include "ManagedObject.hpp"
+#include "SubmissionThread.hpp"
+
+// Returned by every upload, the data is on the GPU once the upload timeline reaches value.
+struct UploadTicket {
+    u64 value = 0;
+};
+
+// Uploads recorded since the last flush, submitted together as one batch.
+struct UploadBatch {
+    vk::CommandBuffer           cmd_buffer          = {};
+    u64                         value               = {};
+    vk::DeviceSize              staging_end         = {};
+    std::vector<GpuBufferInfo>  temporary_buffers   = {};
+    std::vector<vk::Image>      images              = {};
+};
+
+// Copies data into device-local resources through a staging ring on the transfer queue, batched until RecordAcquires,
+// whose graphics submit must wait on timeline_semaphore for the returned value.
+class UploadService : public ManagedObject {
+public:
+    static constexpr vk::DeviceSize STAGING_CAPACITY = 32ull * 1024ull * 1024ull;
+
+    GpuContext*                             context;
+    SubmissionThread*                       submissions;
+
+    vk::Semaphore                           timeline_semaphore;
+    u64                                     next_value = 1;
+
+    vk::CommandPool                         cmd_pool;
+    std::vector<vk::CommandBuffer>          free_cmd_buffers;
+
+    GpuBufferInfo                           staging_buffer;
+    vk::DeviceSize                          staging_head = 0;
+    vk::DeviceSize                          staging_tail = 0;
+    vk::DeviceSize                          staging_alignment = 16;
+
+    std::optional<UploadBatch>              current_batch;
+    std::deque<UploadBatch>                 submitted_batches;
+
+    // acquire halves of the ownership transfers, recorded by the next RecordAcquires
+    std::vector<vk::ImageMemoryBarrier2>    pending_image_acquires;
+    std::vector<vk::BufferMemoryBarrier2>   pending_buffer_acquires;
+
+    u64                                     uploaded_bytes = 0;
+    u64                                     submitted_batch_count = 0;
+
+public:
+    UploadService(GpuContext* context, SubmissionThread* submissions) : context(context), submissions(submissions) {
+        auto timeline_create_info = vk::SemaphoreTypeCreateInfo()
+            .setSemaphoreType(vk::SemaphoreType::eTimeline)
+            .setInitialValue(0);
+
+        timeline_semaphore = context->logical_device.createSemaphore(vk::SemaphoreCreateInfo().setPNext(&timeline_create_info));
+
+        auto command_pool_create_info = vk::CommandPoolCreateInfo()
+            .setFlags(vk::CommandPoolCreateFlagBits::eResetCommandBuffer)
+            .setQueueFamilyIndex(context->transfer_queue_family_index);
+
+        cmd_pool = context->logical_device.createCommandPool(command_pool_create_info);
+
+        auto buffer_create_info = vk::BufferCreateInfo()
+            .setSize(STAGING_CAPACITY)
+            .setUsage(vk::BufferUsageFlagBits::eTransferSrc)
+            .setSharingMode(vk::SharingMode::eExclusive);
+
+        vk::resultCheck(context->logical_device.createBuffer(&buffer_create_info, nullptr, &staging_buffer.buffer), "Failed to create buffer.");
+        staging_buffer.size = STAGING_CAPACITY;
+        gpu_buffer_storage(context, &staging_buffer, GpuStorageMode::eShared, {});
+
+        auto limits = context->physical_device.getProperties().limits;
+        staging_alignment = std::max<vk::DeviceSize>(staging_alignment, limits.optimalBufferCopyOffsetAlignment);
+    }
+
+    ~UploadService() override {
+        // after a failed submit nothing queued reaches the GPU anymore and waiting would rethrow while unwinding
+        if (!submissions->HasFailed()) {
+            Flush();
+            if (next_value > 1) {
+                WaitForTicket(UploadTicket{ next_value - 1 });
+            }
+            Reclaim();
+        }
+
+        gpu_buffer_destroy(context, &staging_buffer);
+        context->logical_device.destroyCommandPool(cmd_pool);
+        context->logical_device.destroySemaphore(timeline_semaphore);
+    }
+
+    auto GetCompletedValue() -> u64 {
+        return context->logical_device.getSemaphoreCounterValue(timeline_semaphore);
+    }
+
+    auto IsComplete(UploadTicket ticket) -> bool {
+        return GetCompletedValue() >= ticket.value;
+    }
+
+    void WaitForTicket(UploadTicket ticket) {
+        if (current_batch && current_batch->value <= ticket.value) {
+            Flush();
+        }
+
+        submissions->WaitSemaphore(timeline_semaphore, ticket.value, "Failed to wait for upload");
+    }
+
+    // Queues a copy of size_in_bytes tightly packed texels into the whole first mip of the image, which ends up in
+    // ShaderReadOnlyOptimal. Exclusive images are released to the graphics queue family.
+    auto UploadImage(vk::Image image, vk::Extent2D extent, const void* pixels, vk::DeviceSize size_in_bytes, bool exclusive) -> UploadTicket {
+        auto& batch = GetCurrentBatch();
+
+        GpuBufferInfo staging;
+        AllocateStaging(&staging, size_in_bytes);
+        std::memcpy(gpu_buffer_contents(&staging), pixels, size_in_bytes);
+
+        auto subresource_range = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1);
+        {
+            auto barriers = std::array{
+                vk::ImageMemoryBarrier2()
+                    .setSrcStageMask(vk::PipelineStageFlagBits2::eNone)
+                    .setDstStageMask(vk::PipelineStageFlagBits2::eTransfer)
+                    .setSrcAccessMask(vk::AccessFlagBits2::eNone)
+                    .setDstAccessMask(vk::AccessFlagBits2::eTransferWrite)
+                    .setOldLayout(vk::ImageLayout::eUndefined)
+                    .setNewLayout(vk::ImageLayout::eTransferDstOptimal)
+                    .setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+                    .setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+                    .setImage(image)
+                    .setSubresourceRange(subresource_range),
+            };
+            batch.cmd_buffer.pipelineBarrier2(vk::DependencyInfo({}, {}, {}, barriers));
+        }
+
+        auto region = vk::BufferImageCopy()
+            .setBufferOffset(staging.offset)
+            .setImageSubresource(vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, 0, 1))
+            .setImageExtent(vk::Extent3D(extent.width, extent.height, 1));
+
+        batch.cmd_buffer.copyBufferToImage(staging.buffer, image, vk::ImageLayout::eTransferDstOptimal, 1, &region);
+
+        auto barrier = vk::ImageMemoryBarrier2()
+            .setSrcStageMask(vk::PipelineStageFlagBits2::eTransfer)
+            .setDstStageMask(vk::PipelineStageFlagBits2::eNone)
+            .setSrcAccessMask(vk::AccessFlagBits2::eTransferWrite)
+            .setDstAccessMask(vk::AccessFlagBits2::eNone)
+            .setOldLayout(vk::ImageLayout::eTransferDstOptimal)
+            .setNewLayout(vk::ImageLayout::eShaderReadOnlyOptimal)
+            .setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+            .setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+            .setImage(image)
+            .setSubresourceRange(subresource_range);
+
+        if (exclusive && context->transfer_queue_family_index != context->graphics_queue_family_index) {
+            barrier.setSrcQueueFamilyIndex(context->transfer_queue_family_index);
+            barrier.setDstQueueFamilyIndex(context->graphics_queue_family_index);
+
+            pending_image_acquires.emplace_back(vk::ImageMemoryBarrier2(barrier)
+                .setSrcStageMask(vk::PipelineStageFlagBits2::eNone)
+                .setSrcAccessMask(vk::AccessFlagBits2::eNone)
+                .setDstStageMask(vk::PipelineStageFlagBits2::eFragmentShader | vk::PipelineStageFlagBits2::eComputeShader)
+                .setDstAccessMask(vk::AccessFlagBits2::eShaderRead));
+        }
+
+        batch.cmd_buffer.pipelineBarrier2(vk::DependencyInfo({}, {}, {}, barrier));
+        batch.images.emplace_back(image);
+
+        uploaded_bytes += size_in_bytes;
+        return UploadTicket{ batch.value };
+    }
+
+    // Queues a copy into a device-local buffer. Exclusive buffers are released to the graphics queue family.
+    auto UploadBuffer(GpuBufferInfo* buffer, vk::DeviceSize offset, const void* data, vk::DeviceSize size_in_bytes, bool exclusive) -> UploadTicket {
+        auto& batch = GetCurrentBatch();
+
+        GpuBufferInfo staging;
+        AllocateStaging(&staging, size_in_bytes);
+        std::memcpy(gpu_buffer_contents(&staging), data, size_in_bytes);
+
+        auto region = vk::BufferCopy()
+            .setSrcOffset(staging.offset)
+            .setDstOffset(buffer->offset + offset)
+            .setSize(size_in_bytes);
+
+        batch.cmd_buffer.copyBuffer(staging.buffer, buffer->buffer, 1, &region);
+
+        if (exclusive && context->transfer_queue_family_index != context->graphics_queue_family_index) {
+            auto barrier = vk::BufferMemoryBarrier2()
+                .setSrcStageMask(vk::PipelineStageFlagBits2::eTransfer)
+                .setDstStageMask(vk::PipelineStageFlagBits2::eNone)
+                .setSrcAccessMask(vk::AccessFlagBits2::eTransferWrite)
+                .setDstAccessMask(vk::AccessFlagBits2::eNone)
+                .setSrcQueueFamilyIndex(context->transfer_queue_family_index)
+                .setDstQueueFamilyIndex(context->graphics_queue_family_index)
+                .setBuffer(buffer->buffer)
+                .setOffset(buffer->offset + offset)
+                .setSize(size_in_bytes);
+
+            batch.cmd_buffer.pipelineBarrier2(vk::DependencyInfo({}, {}, barrier, {}));
+
+            pending_buffer_acquires.emplace_back(vk::BufferMemoryBarrier2(barrier)
+                .setSrcStageMask(vk::PipelineStageFlagBits2::eNone)
+                .setSrcAccessMask(vk::AccessFlagBits2::eNone)
+                .setDstStageMask(vk::PipelineStageFlagBits2::eAllCommands)
+                .setDstAccessMask(vk::AccessFlagBits2::eMemoryRead));
+        }
+
+        uploaded_bytes += size_in_bytes;
+        return UploadTicket{ batch.value };
+    }
+
+    // Submits everything recorded since the last flush as one batch.
+    void Flush() {
+        if (!current_batch) {
+            return;
+        }
+
+        auto& batch = *current_batch;
+        batch.cmd_buffer.end();
+        batch.staging_end = staging_head;
+
+        auto command_buffer_infos = std::array{
+            vk::CommandBufferSubmitInfo(batch.cmd_buffer)
+        };
+
+        auto signal_infos = std::array{
+            vk::SemaphoreSubmitInfo(timeline_semaphore, batch.value, vk::PipelineStageFlagBits2::eAllCommands)
+        };
+
+        submissions->Submit(context->transfer_queue, vk::SubmitInfo2({}, {}, command_buffer_infos, signal_infos));
+
+        submitted_batches.emplace_back(std::move(batch));
+        current_batch.reset();
+        submitted_batch_count += 1;
+    }
+
+    // Makes an image of an earlier UploadImage ready for graphics commands recorded into cmd_buffer before the next
+    // RecordAcquires. Waits for the upload while it may still be in flight, so the submit has nothing to wait for, and
+    // records the image's acquire if it is still pending.
+    void PrepareImage(vk::CommandBuffer cmd_buffer, vk::Image image) {
+        auto has_image = [&](const UploadBatch& batch) {
+            return std::find(batch.images.begin(), batch.images.end(), image) != batch.images.end();
+        };
+
+        u64 wait_value = 0;
+        if (current_batch && has_image(*current_batch)) {
+            wait_value = current_batch->value;
+        }
+        for (auto& batch : submitted_batches) {
+            if (has_image(batch)) {
+                wait_value = std::max(wait_value, batch.value);
+            }
+        }
+        if (wait_value != 0) {
+            WaitForTicket(UploadTicket{ wait_value });
+        }
+
+        auto it = std::find_if(pending_image_acquires.begin(), pending_image_acquires.end(), [&](auto& barrier) {
+            return barrier.image == image;
+        });
+        if (it != pending_image_acquires.end()) {
+            cmd_buffer.pipelineBarrier2(vk::DependencyInfo({}, {}, {}, *it));
+            pending_image_acquires.erase(it);
+        }
+    }
+
+    // Flushes pending uploads and records the acquire barriers for them into a graphics command buffer.
+    // Returns the upload timeline value that command buffer's submit has to wait for, 0 if there is nothing to wait for.
+    auto RecordAcquires(vk::CommandBuffer cmd_buffer) -> u64 {
+        Flush();
+        Reclaim();
+
+        if (!pending_image_acquires.empty() || !pending_buffer_acquires.empty()) {
+            cmd_buffer.pipelineBarrier2(vk::DependencyInfo({}, {}, pending_buffer_acquires, pending_image_acquires));
+            pending_image_acquires.clear();
+            pending_buffer_acquires.clear();
+        }
+
+        auto last_submitted_value = next_value - 1;
+        return GetCompletedValue() >= last_submitted_value ? 0 : last_submitted_value;
+    }
+
+private:
+    auto GetCurrentBatch() -> UploadBatch& {
+        if (!current_batch) {
+            Reclaim();
+
+            auto& batch = current_batch.emplace();
+            batch.value = next_value++;
+
+            if (free_cmd_buffers.empty()) {
+                auto allocate_info = vk::CommandBufferAllocateInfo()
+                    .setCommandPool(cmd_pool)
+                    .setLevel(vk::CommandBufferLevel::ePrimary)
+                    .setCommandBufferCount(1);
+
+                vk::resultCheck(context->logical_device.allocateCommandBuffers(&allocate_info, &batch.cmd_buffer), "Failed to allocate command buffer");
+            } else {
+                batch.cmd_buffer = free_cmd_buffers.back();
+                free_cmd_buffers.pop_back();
+            }
+
+            batch.cmd_buffer.begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+        }
+        return *current_batch;
+    }
+
+    // Returns the command buffers and staging space of finished batches.
+    void Reclaim() {
+        auto completed_value = GetCompletedValue();
+        while (!submitted_batches.empty() && submitted_batches.front().value <= completed_value) {
+            auto& batch = submitted_batches.front();
+            for (auto& buffer : batch.temporary_buffers) {
+                gpu_buffer_destroy(context, &buffer);
+            }
+            free_cmd_buffers.emplace_back(batch.cmd_buffer);
+            staging_tail = batch.staging_end;
+            submitted_batches.pop_front();
+        }
+
+        if (submitted_batches.empty() && !current_batch) {
+            staging_head = 0;
+            staging_tail = 0;
+        }
+    }
+
+    // Ring allocation, the free space is [head, capacity) + [0, tail) while head >= tail and [head, tail) after a wrap.
+    auto TryAllocateStaging(GpuBufferInfo* info, vk::DeviceSize size) -> bool {
+        auto offset = gpu_calculate_alignment(staging_head, staging_alignment);
+        if (staging_head >= staging_tail) {
+            if (offset + size > STAGING_CAPACITY) {
+                // head must never catch up with tail, equal offsets mean an empty ring
+                if (size >= staging_tail) {
+                    return false;
+                }
+                offset = 0;
+            }
+        } else if (offset + size >= staging_tail) {
+            return false;
+        }
+
+        info->buffer = staging_buffer.buffer;
+        info->size = size;
+        info->offset = offset;
+        info->address = 0;
+        info->allocation = staging_buffer.allocation;
+
+        staging_head = offset + size;
+        return true;
+    }
+
+    void AllocateStaging(GpuBufferInfo* info, vk::DeviceSize size) {
+        auto& batch = GetCurrentBatch();
+
+        while (!TryAllocateStaging(info, size)) {
+            if (submitted_batches.empty()) {
+                // larger than what is free with nothing left to retire, use a buffer of its own
+                auto buffer_create_info = vk::BufferCreateInfo()
+                    .setSize(size)
+                    .setUsage(vk::BufferUsageFlagBits::eTransferSrc)
+                    .setSharingMode(vk::SharingMode::eExclusive);
+
+                *info = {};
+                info->size = size;
+                vk::resultCheck(context->logical_device.createBuffer(&buffer_create_info, nullptr, &info->buffer), "Failed to create buffer.");
+                gpu_buffer_storage(context, info, GpuStorageMode::eShared, {});
+
+                batch.temporary_buffers.emplace_back(*info);
+                return;
+            }
+
+            // the ring is full of in-flight uploads, wait for the oldest batch to free its space
+            submissions->WaitSemaphore(timeline_semaphore, submitted_batches.front().value, "Failed to wait for upload");
+            Reclaim();
+        }
+    }
+};
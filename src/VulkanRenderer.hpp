@@ -5,9 +5,17 @@
 #pragma once
 
 #include "gpu.hpp"
+#include "enum.hpp"
 #include "result.hpp"
 #include "ManagedObject.hpp"
 #include "WindowPlatform.hpp"
+#include "UploadService.hpp"
+#include "SubmissionThread.hpp"
+#include "BindlessTextureTable.hpp"
+#include "BindGroupCache.hpp"
+
+// Upper bound of VulkanRenderer::max_frames_in_flight, arrays indexed by frame slot are sized by it.
+constexpr i32 MAX_FRAMES_IN_FLIGHT = 3;
 
 struct SurfaceConfiguration {
     vk::Extent2D        extent          = {};
@@ -17,78 +25,191 @@ struct SurfaceConfiguration {
     u32                 min_image_count = {};
 };
 
+using DeferredObject = Enum<
+    vk::Buffer,
+    vk::Image,
+    vk::ImageView,
+    vk::Sampler,
+    vk::Pipeline,
+    vk::PipelineLayout,
+    vk::DescriptorSetLayout,
+    vk::SwapchainKHR,
+    GpuAllocation,
+    GpuBufferInfo,
+    GpuTexture,
+    GpuGraphicsPipelineState,
+    GpuComputePipelineState
+>;
+
+// Object handed to DestroyDeferred, freed once the frame with this timeline value has finished.
+struct DeferredDeletion {
+    DeferredObject  object;
+    u64             frame_value = {};
+};
+
+// Source of one UpdateTextureRegions rectangle: pixels points at its first texel, rows are row_pitch bytes apart.
+struct TextureRegion {
+    vk::Offset2D    offset      = {};
+    vk::Extent2D    extent      = {};
+    const void*     pixels      = {};
+    u32             row_pitch   = {};
+};
+
 class VulkanRenderer : public ManagedObject {
 public:
-    i32 max_frames_in_flight = 3;
+    i32 max_frames_in_flight = MAX_FRAMES_IN_FLIGHT;
 
+    WindowPlatform*                 platform;
     vk::DynamicLoader               loader;
     GpuContext                      context;
+    SubmissionThread*               submissions;
+    UploadService*                  uploads;
+    BindlessTextureTable*           textures;
+    BindGroupCache*                 bind_groups;
 
     vk::SwapchainKHR                swapchain;
     SurfaceConfiguration            configuration;
+    std::vector<vk::PresentModeKHR> supported_present_modes;
+    bool                            swapchain_dirty = false;
 
     std::vector<vk::Image>          swapchain_images;
     std::vector<vk::ImageView>      swapchain_views;
 
-    std::vector<vk::Fence>          in_flight_fences;
+    std::deque<DeferredDeletion>    deletion_queue;
+
+    // frame N signals value N on completion of its graphics submit, 0 means no frame has finished yet
+    vk::Semaphore                   frame_timeline_semaphore;
+    u64                             current_frame_value = 1;
+
     std::vector<vk::Semaphore>      image_available_semaphores;
     std::vector<vk::Semaphore>      render_finished_semaphores;
 
     std::vector<GpuCommandBuffer>   command_buffers;
+
+    // primaries a frame slot has recorded into, SubmitPartial moves on to the next; the first is the slot's own cmd_buffer
+    std::vector<std::vector<vk::CommandBuffer>> frame_command_buffers;
+    u32                             partial_submit_count = 0;   // of the frame being recorded
+
+    // only created when the compute queue lives in its own family, see async_compute_supported
+    std::vector<GpuCommandBuffer>   compute_command_buffers;
+    std::vector<vk::Semaphore>      compute_finished_semaphores;
     
     u32                             current_image_index = 0;
     usize                           current_frame_index = 0;
     GpuCommandBuffer*               current_command_buffer = {};
+    GpuCommandBuffer*               current_compute_command_buffer = {};
+    bool                            async_compute_supported = false;
+    bool                            compute_submitted = false;
+    u64                             upload_wait_value = 0; // uploads timeline value this frame's submits wait for
 
 public:
-    VulkanRenderer(WindowPlatform* platform) {
+    VulkanRenderer(WindowPlatform* platform) : platform(platform) {
         gpu_create_context(&context, platform, loader.getProcAddress<PFN_vkGetInstanceProcAddr>("vkGetInstanceProcAddr"));
 
+        async_compute_supported = context.compute_queue_family_index != context.graphics_queue_family_index;
+
+        submissions = new SubmissionThread(&context);
+        uploads = new UploadService(&context, submissions);
+        textures = new BindlessTextureTable(&context);
+        bind_groups = new BindGroupCache(&context);
+
         configuration.format = vk::Format::eB8G8R8A8Unorm;
         configuration.color_space = vk::ColorSpaceKHR::eSrgbNonlinear;
-        configuration.min_image_count = 3u;
+        configuration.present_mode = vk::PresentModeKHR::eFifo;
+
+        supported_present_modes = context.physical_device.getSurfacePresentModesKHR(context.surface);
 
         ConfigureSwapchain();
         CreateDeviceResources();
     }
 
     ~VulkanRenderer() override {
+        // the upload service flushes through the submission thread, which then runs what is left before joining
+        uploads->release();
+        submissions->release();
+
         CleanupDeviceResources();
         CleanupSwapchain();
+        CollectDeletionQueue(std::numeric_limits<u64>::max());
+        textures->release();
+        bind_groups->release();
 
         gpu_destroy_context(&context);
     }
 
     void CreateDeviceResources() {
+        auto timeline_create_info = vk::SemaphoreTypeCreateInfo()
+            .setSemaphoreType(vk::SemaphoreType::eTimeline)
+            .setInitialValue(current_frame_value - 1);
+
+        frame_timeline_semaphore = context.logical_device.createSemaphore(vk::SemaphoreCreateInfo().setPNext(&timeline_create_info));
+
         command_buffers.resize(max_frames_in_flight);
-        in_flight_fences.resize(max_frames_in_flight);
+        frame_command_buffers.resize(max_frames_in_flight);
         image_available_semaphores.resize(max_frames_in_flight);
         render_finished_semaphores.resize(max_frames_in_flight);
 
         for (size_t i = 0; i < max_frames_in_flight; i++) {
-            gpu_create_command_buffer(&context, &command_buffers[i]);
+            gpu_create_command_buffer(&context, &command_buffers[i], context.graphics_queue_family_index);
+            frame_command_buffers[i] = { command_buffers[i].cmd_buffer };
 
-            in_flight_fences[i] = context.logical_device.createFence(vk::FenceCreateInfo(vk::FenceCreateFlagBits::eSignaled));
             image_available_semaphores[i] = context.logical_device.createSemaphore(vk::SemaphoreCreateInfo());
             render_finished_semaphores[i] = context.logical_device.createSemaphore(vk::SemaphoreCreateInfo());
         }
+
+        if (async_compute_supported) {
+            compute_command_buffers.resize(max_frames_in_flight);
+            compute_finished_semaphores.resize(max_frames_in_flight);
+
+            for (size_t i = 0; i < max_frames_in_flight; i++) {
+                gpu_create_command_buffer(&context, &compute_command_buffers[i], context.compute_queue_family_index);
+                compute_finished_semaphores[i] = context.logical_device.createSemaphore(vk::SemaphoreCreateInfo());
+            }
+        }
     }
 
     void CleanupDeviceResources() {
         for (size_t i = 0; i < max_frames_in_flight; i++) {
             gpu_destroy_command_buffer(&context, &command_buffers[i]);
 
-            context.logical_device.destroyFence(in_flight_fences[i]);
             context.logical_device.destroySemaphore(image_available_semaphores[i]);
             context.logical_device.destroySemaphore(render_finished_semaphores[i]);
         }
+
+        frame_command_buffers.clear();
+
+        for (size_t i = 0; i < compute_command_buffers.size(); i++) {
+            gpu_destroy_command_buffer(&context, &compute_command_buffers[i]);
+            context.logical_device.destroySemaphore(compute_finished_semaphores[i]);
+        }
+        compute_command_buffers.clear();
+        compute_finished_semaphores.clear();
+
+        context.logical_device.destroySemaphore(frame_timeline_semaphore);
     }
 
-    void ConfigureSwapchain() {
+    // Leaves swapchain empty while the surface has no area, e.g. when the window is minimized.
+    void ConfigureSwapchain(vk::SwapchainKHR old_swapchain = {}) {
         auto formats = context.physical_device.getSurfaceFormatsKHR(context.surface);
         auto capabilities = context.physical_device.getSurfaceCapabilitiesKHR(context.surface);
 
         configuration.extent = capabilities.currentExtent;
+        if (configuration.extent.width == std::numeric_limits<u32>::max()) {
+            // the surface takes its size from the swapchain
+            auto framebuffer_size = platform->GetFramebufferSize();
+            configuration.extent.width = std::clamp(framebuffer_size.width, capabilities.minImageExtent.width, capabilities.maxImageExtent.width);
+            configuration.extent.height = std::clamp(framebuffer_size.height, capabilities.minImageExtent.height, capabilities.maxImageExtent.height);
+        }
+
+        if (configuration.extent.width == 0 || configuration.extent.height == 0) {
+            return;
+        }
+
+        // one image on screen plus one per frame in flight, fewer images means less queued latency
+        configuration.min_image_count = std::max(capabilities.minImageCount, static_cast<u32>(max_frames_in_flight) + 1u);
+        if (capabilities.maxImageCount != 0) {
+            configuration.min_image_count = std::min(configuration.min_image_count, capabilities.maxImageCount);
+        }
 
         std::vector<uint32_t> queue_family_indices = {};
         if (context.graphics_queue_family_index != context.present_queue_family_index) {
@@ -110,10 +231,15 @@ public:
             .setQueueFamilyIndices(queue_family_indices)
             .setPreTransform(capabilities.currentTransform)
             .setCompositeAlpha(vk::CompositeAlphaFlagBitsKHR::eOpaque)
-            .setPresentMode(vk::PresentModeKHR::eFifo)
-            .setClipped(VK_TRUE);
+            .setPresentMode(configuration.present_mode)
+            .setClipped(VK_TRUE)
+            .setOldSwapchain(old_swapchain);
 
-        swapchain = context.logical_device.createSwapchainKHR(swapchain_create_info);
+        swapchain = [&] {
+            // old_swapchain may still be presented from the submission thread
+            auto lock = submissions->LockSwapchain();
+            return context.logical_device.createSwapchainKHR(swapchain_create_info);
+        }();
 
         swapchain_images = context.logical_device.getSwapchainImagesKHR(swapchain);
 
@@ -136,61 +262,308 @@ public:
             context.logical_device.destroyImageView(swapchain_views[i]);
 //            context.logical_device.destroyFramebuffer(swapchain_framebuffers[i]);
         }
-        context.logical_device.destroySwapchainKHR(swapchain);
+        if (swapchain) {
+            context.logical_device.destroySwapchainKHR(swapchain);
+        }
+        swapchain = nullptr;
+        swapchain_images.clear();
+        swapchain_views.clear();
     }
 
+    // Replaces the swapchain without waiting for the GPU, the old one is handed to the driver as oldSwapchain and destroyed later.
     void RebuildSwapchain() {
+        auto old_swapchain = swapchain;
+        if (old_swapchain) {
+            for (auto view : swapchain_views) {
+                DestroyDeferred(view);
+            }
+            DestroyDeferred(old_swapchain);
+        }
+
+        swapchain = nullptr;
+        swapchain_images.clear();
+        swapchain_views.clear();
+
+        ConfigureSwapchain(old_swapchain);
+        swapchain_dirty = false;
+    }
+
+    // Destroys the object once every frame recorded so far, including the current one, has finished on the GPU.
+    void DestroyDeferred(DeferredObject object) {
+        deletion_queue.emplace_back(DeferredDeletion{
+            .object = std::move(object),
+            .frame_value = current_frame_value,
+        });
+    }
+
+    void CollectDeletionQueue(u64 completed_frame_value) {
+        // frame values only grow, so the queue is ordered by them
+        while (!deletion_queue.empty() && deletion_queue.front().frame_value <= completed_frame_value) {
+            DestroyObject(&deletion_queue.front().object);
+            deletion_queue.pop_front();
+        }
+    }
+
+    void DestroyObject(DeferredObject* object) {
+        std::visit([&](auto& value) {
+            using T = std::decay_t<decltype(value)>;
+            if constexpr (std::is_same_v<T, vk::Buffer>) {
+                context.logical_device.destroyBuffer(value);
+            } else if constexpr (std::is_same_v<T, vk::Image>) {
+                context.logical_device.destroyImage(value);
+            } else if constexpr (std::is_same_v<T, vk::ImageView>) {
+                context.logical_device.destroyImageView(value);
+            } else if constexpr (std::is_same_v<T, vk::Sampler>) {
+                context.logical_device.destroySampler(value);
+            } else if constexpr (std::is_same_v<T, vk::Pipeline>) {
+                context.logical_device.destroyPipeline(value);
+            } else if constexpr (std::is_same_v<T, vk::PipelineLayout>) {
+                context.logical_device.destroyPipelineLayout(value);
+            } else if constexpr (std::is_same_v<T, vk::DescriptorSetLayout>) {
+                bind_groups->ForgetBindGroupLayout(value);
+                context.logical_device.destroyDescriptorSetLayout(value);
+            } else if constexpr (std::is_same_v<T, vk::SwapchainKHR>) {
+                context.logical_device.destroySwapchainKHR(value);
+            } else if constexpr (std::is_same_v<T, GpuAllocation>) {
+                gpu_free_memory(&context, &value);
+            } else if constexpr (std::is_same_v<T, GpuBufferInfo>) {
+                gpu_buffer_destroy(&context, &value);
+            } else if constexpr (std::is_same_v<T, GpuTexture>) {
+                CleanupTexture(&value);
+            } else if constexpr (std::is_same_v<T, GpuGraphicsPipelineState>) {
+                ForgetBindGroupLayouts(value, context.graphics_pipeline_cache);
+                gpu_destroy_graphics_pipeline_state(&context, &value);
+            } else if constexpr (std::is_same_v<T, GpuComputePipelineState>) {
+                ForgetBindGroupLayouts(value, context.compute_pipeline_cache);
+                gpu_destroy_compute_pipeline_state(&context, &value);
+            }
+        }, static_cast<DeferredObject::variant&>(*object));
+    }
+
+    // A pipeline state destroys its derived layouts along with its last reference, their cached sets go first.
+    template<typename State>
+    void ForgetBindGroupLayouts(const State& state, const std::unordered_map<std::string, GpuPipelineCacheEntry<State>>& cache) {
+        if (!state.cache_key.empty()) {
+            auto it = cache.find(state.cache_key);
+            if (it != cache.end() && it->second.refs > 1) {
+                return;
+            }
+        }
+        for (auto bind_group_layout : state.bind_group_layouts) {
+            bind_groups->ForgetBindGroupLayout(bind_group_layout);
+        }
+    }
+
+    auto IsPresentModeSupported(vk::PresentModeKHR present_mode) -> bool {
+        return std::find(supported_present_modes.begin(), supported_present_modes.end(), present_mode) != supported_present_modes.end();
+    }
+
+    // Must be called outside of a frame, the swapchain is recreated.
+    void SetPresentMode(vk::PresentModeKHR present_mode) {
+        if (present_mode == configuration.present_mode || !IsPresentModeSupported(present_mode)) {
+            return;
+        }
+        configuration.present_mode = present_mode;
+        RebuildSwapchain();
+    }
+
+    // Must be called outside of a frame, per-frame resources and the swapchain are recreated.
+    void SetMaxFramesInFlight(i32 count) {
+        count = std::clamp(count, 1, MAX_FRAMES_IN_FLIGHT);
+        if (count == max_frames_in_flight) {
+            return;
+        }
+
+        WaitIdle();
+        CleanupDeviceResources();
+
+        max_frames_in_flight = count;
+        current_frame_index = 0;
+
+        CreateDeviceResources();
+        RebuildSwapchain();
+    }
+
+    // Waits for queued submissions to reach the GPU and for the GPU to finish them.
+    void WaitIdle() {
+        submissions->WaitIdle();
         context.logical_device.waitIdle();
+    }
 
-        CleanupSwapchain();
-        ConfigureSwapchain();
+    // Moves submit and present onto a thread of their own; must be called outside of a frame by the thread recording frames.
+    void SetSubmissionThreadEnabled(bool enabled) {
+        if (enabled) {
+            submissions->Start();
+        } else {
+            submissions->Stop();
+        }
     }
 
-    void WaitAndBeginNewFrame() {
-        vk::resultCheck(context.logical_device.waitForFences(in_flight_fences[current_frame_index], VK_TRUE, UINT64_MAX), "Failed to wait for fence");
+    // Value of the last frame whose graphics submit has finished on the GPU.
+    auto GetCompletedFrameValue() -> u64 {
+        return context.logical_device.getSemaphoreCounterValue(frame_timeline_semaphore);
+    }
+
+    auto IsFrameValueCompleted(u64 value) -> bool {
+        return GetCompletedFrameValue() >= value;
+    }
 
-        auto result = context.logical_device.acquireNextImageKHR(swapchain, UINT64_MAX, image_available_semaphores[current_frame_index], nullptr, &current_image_index);
-        if (result != vk::Result::eErrorOutOfDateKHR && result != vk::Result::eSuboptimalKHR) {
+    void WaitForFrameValue(u64 value) {
+        submissions->WaitSemaphore(frame_timeline_semaphore, value, "Failed to wait for frame");
+    }
+
+    // Blocks until the frame that last used the current per-frame resources has finished.
+    void WaitForFrameSlot() {
+        if (current_frame_value > static_cast<u64>(max_frames_in_flight)) {
+            WaitForFrameValue(current_frame_value - static_cast<u64>(max_frames_in_flight));
+        }
+    }
+
+    // Returns false when there is nothing to render into this frame, the caller skips it.
+    auto WaitAndBeginNewFrame() -> bool {
+        WaitForFrameSlot();
+
+        auto completed_frame_value = GetCompletedFrameValue();
+        CollectDeletionQueue(completed_frame_value);
+        bind_groups->BeginFrame(current_frame_value, completed_frame_value);
+
+        if (submissions->ConsumeSwapchainOutOfDate()) {
+            swapchain_dirty = true;
+        }
+        if (swapchain_dirty || !swapchain) {
+            RebuildSwapchain();
+        }
+        if (!swapchain) {
+            return false;
+        }
+
+        auto result = submissions->AcquireNextImage(context.logical_device, swapchain, image_available_semaphores[current_frame_index], &current_image_index);
+        if (result == vk::Result::eErrorOutOfDateKHR) {
+            swapchain_dirty = true;
+            return false;
+        }
+        if (result == vk::Result::eSuboptimalKHR) {
+            // the image is acquired and still presentable, recreate after this frame
+            swapchain_dirty = true;
+        } else {
             vk::resultCheck(result, "Failed to acquire swapchain image");
         }
 
         current_command_buffer = &command_buffers[current_frame_index];
+        current_command_buffer->cmd_buffer = frame_command_buffers[current_frame_index][0];
+        partial_submit_count = 0;
 
         gpu_reset_command_buffer(&context, current_command_buffer);
         current_command_buffer->cmd_buffer.begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+
+        // everything uploaded before this point is usable by the frame
+        upload_wait_value = uploads->RecordAcquires(current_command_buffer->cmd_buffer);
+
+        current_compute_command_buffer = nullptr;
+        compute_submitted = false;
+        return true;
     }
 
-    void SubmitFrameAndPresent() {
+    // Starts recording this frame's command buffer for the compute queue; requires async_compute_supported.
+    auto BeginComputeCommands() -> GpuCommandBuffer* {
+        current_compute_command_buffer = &compute_command_buffers[current_frame_index];
+
+        gpu_reset_command_buffer(&context, current_compute_command_buffer);
+        current_compute_command_buffer->cmd_buffer.begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+        return current_compute_command_buffer;
+    }
+
+    // Submits the compute command buffer; the graphics submit of this frame waits for it in the fragment stage.
+    // A non-zero wait_frame_value delays the compute work until that frame has finished on the graphics queue.
+    void SubmitComputeCommands(u64 wait_frame_value) {
+        current_compute_command_buffer->cmd_buffer.end();
+
+        std::vector<vk::SemaphoreSubmitInfo> wait_infos;
+        if (wait_frame_value != 0) {
+            wait_infos.emplace_back(frame_timeline_semaphore, wait_frame_value, vk::PipelineStageFlagBits2::eComputeShader);
+        }
+        if (upload_wait_value != 0) {
+            wait_infos.emplace_back(uploads->timeline_semaphore, upload_wait_value, vk::PipelineStageFlagBits2::eComputeShader);
+        }
+
+        auto command_buffer_infos = std::array{
+            vk::CommandBufferSubmitInfo(current_compute_command_buffer->cmd_buffer)
+        };
+
+        auto signal_infos = std::array{
+            vk::SemaphoreSubmitInfo(compute_finished_semaphores[current_frame_index], 0, vk::PipelineStageFlagBits2::eComputeShader)
+        };
+
+        submissions->Submit(context.compute_queue, vk::SubmitInfo2({}, wait_infos, command_buffer_infos, signal_infos));
+        compute_submitted = true;
+    }
+
+    // Submits what the frame has recorded so far and continues in another primary of the frame slot, so the GPU starts on
+    // the frame while the rest is still being recorded. Later submits to the queue are ordered after it by the barriers
+    // they record, so nothing is signalled in between. Bound state does not carry over to the new command buffer.
+    void SubmitPartial() {
         current_command_buffer->cmd_buffer.end();
 
-        auto wait_stages = std::array{
-            vk::PipelineStageFlags(vk::PipelineStageFlagBits::eColorAttachmentOutput)
+        std::vector<vk::SemaphoreSubmitInfo> wait_infos;
+        if (upload_wait_value != 0) {
+            wait_infos.emplace_back(uploads->timeline_semaphore, upload_wait_value, vk::PipelineStageFlagBits2::eAllCommands);
+        }
+
+        auto command_buffer_infos = std::array{
+            vk::CommandBufferSubmitInfo(current_command_buffer->cmd_buffer)
         };
 
-        auto submit_info = vk::SubmitInfo()
-            .setWaitSemaphoreCount(1)
-            .setPWaitSemaphores(&image_available_semaphores[current_frame_index])
-            .setPWaitDstStageMask(wait_stages.data())
-            .setCommandBufferCount(1)
-            .setPCommandBuffers(&current_command_buffer->cmd_buffer)
-            .setSignalSemaphoreCount(1)
-            .setPSignalSemaphores(&render_finished_semaphores[current_frame_index]);
-
-        context.logical_device.resetFences(in_flight_fences[current_frame_index]);
-        context.graphics_queue.submit(submit_info, in_flight_fences[current_frame_index]);
-
-        auto present_info = vk::PresentInfoKHR()
-            .setWaitSemaphoreCount(1)
-            .setPWaitSemaphores(&render_finished_semaphores[current_frame_index])
-            .setSwapchainCount(1)
-            .setPSwapchains(&swapchain)
-            .setPImageIndices(&current_image_index);
-
-        auto result = context.present_queue.presentKHR(present_info);
-        if (result != vk::Result::eErrorOutOfDateKHR && result != vk::Result::eSuboptimalKHR) {
-            vk::resultCheck(result, "Failed to present swapchain image");
+        submissions->Submit(context.graphics_queue, vk::SubmitInfo2({}, wait_infos, command_buffer_infos, {}));
+
+        // the slot's earlier frames have finished, so every command buffer already in the chain can be recorded again
+        auto& chain = frame_command_buffers[current_frame_index];
+        partial_submit_count += 1;
+        if (partial_submit_count == chain.size()) {
+            auto allocate_info = vk::CommandBufferAllocateInfo()
+                .setCommandPool(current_command_buffer->cmd_pool)
+                .setLevel(vk::CommandBufferLevel::ePrimary)
+                .setCommandBufferCount(1);
+
+            chain.push_back(context.logical_device.allocateCommandBuffers(allocate_info).front());
+        }
+
+        current_command_buffer->cmd_buffer = chain[partial_submit_count];
+        current_command_buffer->cmd_buffer.begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+    }
+
+    void SubmitFrameAndPresent() {
+        current_command_buffer->cmd_buffer.end();
+
+        std::vector<vk::SemaphoreSubmitInfo> wait_infos = {
+            vk::SemaphoreSubmitInfo(image_available_semaphores[current_frame_index], 0, vk::PipelineStageFlagBits2::eColorAttachmentOutput)
+        };
+        if (compute_submitted) {
+            wait_infos.emplace_back(compute_finished_semaphores[current_frame_index], 0, vk::PipelineStageFlagBits2::eFragmentShader);
+        }
+        if (upload_wait_value != 0) {
+            wait_infos.emplace_back(uploads->timeline_semaphore, upload_wait_value, vk::PipelineStageFlagBits2::eAllCommands);
         }
+
+        auto command_buffer_infos = std::array{
+            vk::CommandBufferSubmitInfo(current_command_buffer->cmd_buffer)
+        };
+
+        auto signal_infos = std::array{
+            vk::SemaphoreSubmitInfo(render_finished_semaphores[current_frame_index], 0, vk::PipelineStageFlagBits2::eAllCommands),
+            vk::SemaphoreSubmitInfo(frame_timeline_semaphore, current_frame_value, vk::PipelineStageFlagBits2::eAllCommands)
+        };
+
+        // an out-of-date result from the present marks the swapchain dirty at the start of the next frame
+        submissions->SubmitAndPresent(
+            context.graphics_queue,
+            vk::SubmitInfo2({}, wait_infos, command_buffer_infos, signal_infos),
+            context.present_queue,
+            swapchain,
+            current_image_index,
+            render_finished_semaphores[current_frame_index]);
+
         current_frame_index = (current_frame_index + 1) % max_frames_in_flight;
+        current_frame_value += 1;
     }
 
     auto ReadBytes(const std::string& filename) -> Result<std::vector<char>, std::runtime_error> {
@@ -202,7 +575,9 @@ public:
         return std::vector(std::istreambuf_iterator<char>(file), {});
     }
 
-    void CreateTextureFromMemory(GpuTexture* texture, u32 width, u32 height, void* pixels) {
+    // Creates an RGBA8 texture and queues its contents on the upload service, the returned ticket completes once they landed.
+    // The texture is registered in the bindless table, so shaders can sample it through texture->bindless_index.
+    auto CreateTextureFromMemory(GpuTexture* texture, u32 width, u32 height, const void* pixels) -> UploadTicket {
         vk::ImageCreateInfo image_create_info = {};
         image_create_info.setImageType(vk::ImageType::e2D);
         image_create_info.setFormat(vk::Format::eR8G8B8A8Unorm);
@@ -212,11 +587,23 @@ public:
         image_create_info.setSamples(vk::SampleCountFlagBits::e1);
         image_create_info.setTiling(vk::ImageTiling::eOptimal);
         image_create_info.setUsage(vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferDst);
-        image_create_info.setSharingMode(vk::SharingMode::eExclusive);
-        image_create_info.setQueueFamilyIndices({});
+
+        // textures are read by both queues when async compute is available, skip ownership transfers for them
+        auto queue_family_indices = std::vector{ context.graphics_queue_family_index, context.compute_queue_family_index };
+        if (context.transfer_queue_family_index != context.graphics_queue_family_index && context.transfer_queue_family_index != context.compute_queue_family_index) {
+            queue_family_indices.emplace_back(context.transfer_queue_family_index);
+        }
+        if (async_compute_supported) {
+            image_create_info.setSharingMode(vk::SharingMode::eConcurrent);
+            image_create_info.setQueueFamilyIndices(queue_family_indices);
+        } else {
+            image_create_info.setSharingMode(vk::SharingMode::eExclusive);
+            image_create_info.setQueueFamilyIndices({});
+        }
         image_create_info.setInitialLayout(vk::ImageLayout::eUndefined);
 
         vk::resultCheck(context.logical_device.createImage(&image_create_info, nullptr, &texture->image), "Failed to create image");
+        texture->extent = vk::Extent2D(width, height);
 
         gpu_texture_storage(&context, &texture->allocation, texture->image, GpuStorageMode::ePrivate, {});
 
@@ -247,73 +634,98 @@ public:
 
         vk::resultCheck(context.logical_device.createSampler(&sampler_create_info, nullptr, &texture->sampler), "Failed to create sampler");
 
-//        // TODO: simplify this
-        auto size_in_bytes = static_cast<vk::DeviceSize>(width * height * 4);
-        {
-            GpuCommandBuffer command_buffer;
-            gpu_create_command_buffer(&context, &command_buffer);
-
-            GpuBufferInfo tmp;
-            gpu_command_buffer_allocate(&context, &command_buffer, &tmp, size_in_bytes, context.physical_device.getProperties().limits.optimalBufferCopyOffsetAlignment);
-
-            std::memcpy(gpu_buffer_contents(&tmp), pixels, size_in_bytes);
-
-            command_buffer.cmd_buffer.begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
-            {
-                auto barriers = std::array{
-                    vk::ImageMemoryBarrier2()
-                        .setSrcAccessMask(vk::AccessFlagBits2KHR::eHostWrite)
-                        .setDstAccessMask(vk::AccessFlagBits2KHR::eTransferWrite)
-                        .setSrcStageMask(vk::PipelineStageFlagBits2KHR::eHost)
-                        .setDstStageMask(vk::PipelineStageFlagBits2KHR::eTransfer)
-                        .setOldLayout(vk::ImageLayout::eUndefined)
-                        .setNewLayout(vk::ImageLayout::eTransferDstOptimal)
-                        .setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
-                        .setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
-                        .setImage(texture->image)
-                        .setSubresourceRange(vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1)),
-                };
-                command_buffer.cmd_buffer.pipelineBarrier2(vk::DependencyInfo({}, {}, {}, barriers));
+        textures->Register(texture);
+
+        auto size_in_bytes = static_cast<vk::DeviceSize>(width) * height * 4;
+        return uploads->UploadImage(texture->image, texture->extent, pixels, size_in_bytes, !async_compute_supported);
+    }
+
+    // Streams dirty rectangles of an RGBA8 texture in ShaderReadOnlyOptimal through the command buffer's staging memory,
+    // one copy for all of them. Record it on the queue that samples the texture, reader_stages are the stages that do.
+    // A texture from CreateTextureFromMemory may be updated before its ticket completes, with the command buffer on the
+    // graphics queue: the update waits for the upload and acquires the texture itself.
+    void UpdateTextureRegions(GpuCommandBuffer* command_buffer, GpuTexture* texture, std::span<const TextureRegion> regions, vk::PipelineStageFlags2 reader_stages = vk::PipelineStageFlagBits2::eFragmentShader | vk::PipelineStageFlagBits2::eComputeShader) {
+        constexpr vk::DeviceSize texel_size = 4;
+
+        if (regions.empty()) {
+            return;
+        }
+
+        // regions are packed tightly, each one starts at a texel-aligned offset
+        vk::DeviceSize staging_size = 0;
+        for (auto& region : regions) {
+            staging_size += static_cast<vk::DeviceSize>(region.extent.width) * region.extent.height * texel_size;
+        }
+
+        GpuBufferInfo staging;
+        if (!gpu_command_buffer_allocate(&context, command_buffer, &staging, staging_size, 16)) {
+            fprintf(stderr, "Failed to allocate %llu bytes for texture update\n", static_cast<unsigned long long>(staging_size));
+            return;
+        }
+
+        uploads->PrepareImage(command_buffer->cmd_buffer, texture->image);
+
+        std::vector<vk::BufferImageCopy> copies;
+        copies.reserve(regions.size());
+
+        auto contents = static_cast<u8*>(gpu_buffer_contents(&staging));
+        vk::DeviceSize offset = 0;
+        for (auto& region : regions) {
+            auto row_size = static_cast<vk::DeviceSize>(region.extent.width) * texel_size;
+            for (u32 y = 0; y < region.extent.height; ++y) {
+                std::memcpy(contents + offset + y * row_size, static_cast<const u8*>(region.pixels) + static_cast<usize>(y) * region.row_pitch, row_size);
             }
 
-            auto region = vk::BufferImageCopy()
-                .setBufferOffset(tmp.offset)
+            copies.emplace_back(vk::BufferImageCopy()
+                .setBufferOffset(staging.offset + offset)
                 .setImageSubresource(vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, 0, 1))
-                .setImageExtent(vk::Extent3D(width, height, 1));
-
-            command_buffer.cmd_buffer.copyBufferToImage(tmp.buffer, texture->image, vk::ImageLayout::eTransferDstOptimal, 1, &region);
-
-            {
-                auto barriers = std::array{
-                    vk::ImageMemoryBarrier2()
-                        .setSrcAccessMask(vk::AccessFlagBits2KHR::eTransferWrite)
-                        .setDstAccessMask(vk::AccessFlagBits2KHR::eShaderRead)
-                        .setSrcStageMask(vk::PipelineStageFlagBits2KHR::eTransfer)
-                        .setDstStageMask(vk::PipelineStageFlagBits2KHR::eFragmentShader | vk::PipelineStageFlagBits2KHR::eComputeShader)
-                        .setOldLayout(vk::ImageLayout::eTransferDstOptimal)
-                        .setNewLayout(vk::ImageLayout::eShaderReadOnlyOptimal)
-                        .setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
-                        .setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
-                        .setImage(texture->image)
-                        .setSubresourceRange(vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1)),
-                };
-                command_buffer.cmd_buffer.pipelineBarrier2(vk::DependencyInfo({}, {}, {}, barriers));
-            }
+                .setImageOffset(vk::Offset3D(region.offset.x, region.offset.y, 0))
+                .setImageExtent(vk::Extent3D(region.extent.width, region.extent.height, 1)));
 
-            command_buffer.cmd_buffer.end();
+            offset += row_size * region.extent.height;
+        }
 
-            auto fence = context.logical_device.createFence(vk::FenceCreateInfo());
-            auto submit_info = vk::SubmitInfo(0, nullptr, nullptr, 1, &command_buffer.cmd_buffer, 0, nullptr);
+        {
+            // earlier reads have to finish before the texels change under them
+            auto barriers = std::array{
+                vk::ImageMemoryBarrier2()
+                    .setSrcStageMask(reader_stages)
+                    .setDstStageMask(vk::PipelineStageFlagBits2::eTransfer)
+                    .setSrcAccessMask(vk::AccessFlagBits2::eNone)
+                    .setDstAccessMask(vk::AccessFlagBits2::eTransferWrite)
+                    .setOldLayout(vk::ImageLayout::eShaderReadOnlyOptimal)
+                    .setNewLayout(vk::ImageLayout::eTransferDstOptimal)
+                    .setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+                    .setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+                    .setImage(texture->image)
+                    .setSubresourceRange(vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1)),
+            };
+            command_buffer->cmd_buffer.pipelineBarrier2(vk::DependencyInfo({}, {}, {}, barriers));
+        }
 
-            vk::resultCheck(context.graphics_queue.submit(1, &submit_info, fence), "Failed to submit command buffer");
-            vk::resultCheck(context.logical_device.waitForFences(1, &fence, VK_TRUE, UINT64_MAX), "Failed to wait for fence");
-            context.logical_device.destroyFence(fence);
+        command_buffer->cmd_buffer.copyBufferToImage(staging.buffer, texture->image, vk::ImageLayout::eTransferDstOptimal, copies);
 
-            gpu_destroy_command_buffer(&context, &command_buffer);
+        {
+            auto barriers = std::array{
+                vk::ImageMemoryBarrier2()
+                    .setSrcStageMask(vk::PipelineStageFlagBits2::eTransfer)
+                    .setDstStageMask(reader_stages)
+                    .setSrcAccessMask(vk::AccessFlagBits2::eTransferWrite)
+                    .setDstAccessMask(vk::AccessFlagBits2::eShaderRead)
+                    .setOldLayout(vk::ImageLayout::eTransferDstOptimal)
+                    .setNewLayout(vk::ImageLayout::eShaderReadOnlyOptimal)
+                    .setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+                    .setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+                    .setImage(texture->image)
+                    .setSubresourceRange(vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1)),
+            };
+            command_buffer->cmd_buffer.pipelineBarrier2(vk::DependencyInfo({}, {}, {}, barriers));
         }
     }
 
     void CleanupTexture(GpuTexture* texture) {
+        textures->Unregister(texture);
+        bind_groups->ForgetImageView(texture->view);
         if (texture->sampler) {
             context.logical_device.destroySampler(texture->sampler);
         }
@@ -18,6 +18,8 @@ public:
         glfwInit();
         glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
         window = glfwCreateWindow(static_cast<i32>(width), static_cast<i32>(height), title, nullptr, nullptr);
+        InstallEventCallbacks();
+        UpdateFramebufferSize();
     }
 
     ~WindowPlatform() override {
@@ -36,9 +38,65 @@ public:
 
     auto PumpEvents() -> bool {
         glfwPollEvents();
+        UpdateFramebufferSize();
         return !glfwWindowShouldClose(window);
     }
 
+    void WaitEvents() {
+        glfwWaitEvents();
+        UpdateFramebufferSize();
+    }
+
+    void WaitEventsTimeout(f64 timeout_seconds) {
+        glfwWaitEventsTimeout(timeout_seconds);
+        UpdateFramebufferSize();
+    }
+
+    // Callable from any thread, wakes up WaitEvents and WaitEventsTimeout without counting as an event.
+    void PostEmptyEvent() {
+        glfwPostEmptyEvent();
+    }
+
+    // Input and window events processed so far, for telling whether anything happened while waiting or polling.
+    auto GetEventCount() const -> u64 {
+        return event_count;
+    }
+
+    // Callable from any thread, glfw itself may only be queried on the main thread so the size is sampled with the events.
+    auto GetFramebufferSize() -> vk::Extent2D {
+        auto size = framebuffer_size.load(std::memory_order_relaxed);
+        return vk::Extent2D(static_cast<u32>(size >> 32), static_cast<u32>(size));
+    }
+
+private:
+    // Installed before the ImGui backend, which calls the callbacks it replaces, so every event is counted either way.
+    void InstallEventCallbacks() {
+        glfwSetWindowUserPointer(window, this);
+        glfwSetKeyCallback(window, [](GLFWwindow* window, i32, i32, i32, i32) { CountEvent(window); });
+        glfwSetCharCallback(window, [](GLFWwindow* window, u32) { CountEvent(window); });
+        glfwSetMouseButtonCallback(window, [](GLFWwindow* window, i32, i32, i32) { CountEvent(window); });
+        glfwSetCursorPosCallback(window, [](GLFWwindow* window, f64, f64) { CountEvent(window); });
+        glfwSetCursorEnterCallback(window, [](GLFWwindow* window, i32) { CountEvent(window); });
+        glfwSetScrollCallback(window, [](GLFWwindow* window, f64, f64) { CountEvent(window); });
+        glfwSetWindowFocusCallback(window, [](GLFWwindow* window, i32) { CountEvent(window); });
+        glfwSetWindowIconifyCallback(window, [](GLFWwindow* window, i32) { CountEvent(window); });
+        glfwSetWindowRefreshCallback(window, [](GLFWwindow* window) { CountEvent(window); });
+        glfwSetFramebufferSizeCallback(window, [](GLFWwindow* window, i32, i32) { CountEvent(window); });
+        glfwSetDropCallback(window, [](GLFWwindow* window, i32, const char**) { CountEvent(window); });
+    }
+
+    static void CountEvent(GLFWwindow* window) {
+        static_cast<WindowPlatform*>(glfwGetWindowUserPointer(window))->event_count += 1;
+    }
+
+    void UpdateFramebufferSize() {
+        i32 width, height;
+        glfwGetFramebufferSize(window, &width, &height);
+        framebuffer_size.store((static_cast<u64>(width) << 32) | static_cast<u32>(height), std::memory_order_relaxed);
+    }
+
 private:
-    GLFWwindow* window;
+    GLFWwindow*         window;
+    std::atomic<u64>    framebuffer_size = 0;
+    u64                 event_count = 0;        // main thread only, callbacks run inside the glfw event functions
 };
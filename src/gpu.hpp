@@ -79,11 +79,17 @@ struct GpuBufferInfo {
     GpuAllocation       allocation  = {};
 };
 
+// Runtime descriptor arrays (e.g. `sampler2D textures[]`) are created with this many partially bound descriptors.
+constexpr u32 GPU_BINDLESS_DESCRIPTOR_COUNT = 1024;
+constexpr u32 GPU_BINDLESS_INVALID_INDEX = std::numeric_limits<u32>::max();
+
 struct GpuTexture {
     vk::Image     image         = {};
     vk::ImageView view          = {};
     vk::Sampler   sampler       = {};
     GpuAllocation allocation    = {};
+    vk::Extent2D  extent        = {};
+    u32           bindless_index = GPU_BINDLESS_INVALID_INDEX; // slot in the bindless texture table, if registered
 };
 
 struct GpuShaderObjectCreateInfo {
@@ -91,16 +97,25 @@ struct GpuShaderObjectCreateInfo {
     u64                             codeSize        = {};
     void*                           pCode           = {};
     const char*                     pName           = {};
-    Slice<vk::DescriptorSetLayout>  set_layouts     = {};
-    Slice<vk::PushConstantRange>    push_constants  = {};
+};
+
+struct GpuShaderBinding {
+    u32                 set                 = {};
+    u32                 binding             = {};
+    vk::DescriptorType  descriptor_type     = {};
+    u32                 descriptor_count    = {};
 };
 
 struct GpuShaderObject {
-    vk::ShaderStageFlagBits                 stage           = {};
-    vk::ShaderModule                        shader_module   = {};
-    std::string                             name            = {};
-    std::vector<vk::DescriptorSetLayout>    set_layouts     = {};
-    std::vector<vk::PushConstantRange>      push_constants  = {};
+    vk::ShaderStageFlagBits             stage           = {};
+    vk::ShaderModule                    shader_module   = {};
+    std::vector<u32>                    code            = {};   // SPIR-V words, part of the pipeline cache key
+    std::string                         name            = {};
+    std::vector<GpuShaderBinding>       bindings        = {};
+    std::vector<vk::PushConstantRange>  push_constants  = {};
+    std::array<u32, 3>                  workgroup_size  = { 1, 1, 1 };
+    // Specialization constant ids that override workgroup_size, or u32 max when the size is fixed.
+    std::array<u32, 3>                  workgroup_size_spec_ids = { std::numeric_limits<u32>::max(), std::numeric_limits<u32>::max(), std::numeric_limits<u32>::max() };
 };
 
 struct GpuGraphicsPipelineStateCreateInfo {
@@ -112,22 +127,36 @@ struct GpuGraphicsPipelineStateCreateInfo {
     GpuVertexInputState             vertex_input_state      = {};
     Slice<vk::DescriptorSetLayout>  bind_group_layouts      = {};
     Slice<vk::PushConstantRange>    push_constant_ranges    = {};
+    // Reflected sets in this mask get push descriptor layouts, see gpu_command_buffer_push_bind_group.
+    u32                             push_bind_group_mask    = {};
 };
 
 struct GpuGraphicsPipelineState {
-    vk::Pipeline        pipeline        = {};
-    vk::PipelineLayout  pipeline_layout = {};
+    vk::Pipeline                            pipeline            = {};
+    vk::PipelineLayout                      pipeline_layout     = {};
+    // Layouts derived from shader reflection, empty when the caller supplied its own.
+    std::vector<vk::DescriptorSetLayout>    bind_group_layouts  = {};
+    // Key in GpuContext::graphics_pipeline_cache, empty when the state is not shared.
+    std::string                             cache_key           = {};
 };
 
 struct GpuComputePipelineStateCreateInfo {
     GpuShaderObject*                shader_object           = {};
+    const vk::SpecializationInfo*   specialization_info     = {};
     Slice<vk::DescriptorSetLayout>  bind_group_layouts      = {};
     Slice<vk::PushConstantRange>    push_constant_ranges    = {};
+    // Reflected sets in this mask get push descriptor layouts, see gpu_command_buffer_push_bind_group.
+    u32                             push_bind_group_mask    = {};
 };
 
 struct GpuComputePipelineState {
-    vk::Pipeline        pipeline        = {};
-    vk::PipelineLayout  pipeline_layout = {};
+    vk::Pipeline                            pipeline            = {};
+    vk::PipelineLayout                      pipeline_layout     = {};
+    // Layouts derived from shader reflection, empty when the caller supplied its own.
+    std::vector<vk::DescriptorSetLayout>    bind_group_layouts  = {};
+    std::array<u32, 3>                      workgroup_size      = { 1, 1, 1 };
+    // Key in GpuContext::compute_pipeline_cache, empty when the state is not shared.
+    std::string                             cache_key           = {};
 };
 
 struct GpuLinearAllocator {
@@ -135,11 +164,25 @@ struct GpuLinearAllocator {
     vk::DeviceSize  offset  = {};
 };
 
+// Chain of descriptor pools, a new pool is appended when the current ones run out instead of failing the allocation.
+struct GpuBindGroupAllocator {
+    std::vector<vk::DescriptorPool> pools       = {};
+    usize                           pool_index  = {};
+};
+
 struct GpuCommandBuffer {
-    vk::CommandPool     cmd_pool                = {};
-    vk::CommandBuffer   cmd_buffer              = {};
-    GpuLinearAllocator  buffer_allocator        = {};
-    vk::DescriptorPool  bind_group_allocator    = {};
+    vk::CommandPool         cmd_pool                = {};
+    vk::CommandBuffer       cmd_buffer              = {};
+    GpuLinearAllocator      buffer_allocator        = {};   // for secondaries a slice of the primary's, see gpu_allocator_slice
+    GpuBindGroupAllocator   bind_group_allocator    = {};
+    vk::CommandBufferLevel  level                   = vk::CommandBufferLevel::ePrimary;
+    u32                     queue_family_index      = {};
+};
+
+template<typename State>
+struct GpuPipelineCacheEntry {
+    State   state   = {};
+    u64     refs    = {};
 };
 
 struct GpuContext {
@@ -154,6 +197,15 @@ struct GpuContext {
     uint32_t                        present_queue_family_index;
     vk::Queue                       compute_queue;
     uint32_t                        compute_queue_family_index;
+    vk::Queue                       transfer_queue;
+    uint32_t                        transfer_queue_family_index;
+    vk::PhysicalDeviceSubgroupProperties subgroup_properties;
+    // core features enabled on the device, every one the device supports
+    vk::PhysicalDeviceFeatures      features;
+
+    // keyed by everything that affects the pipeline, see gpu_graphics_pipeline_key and gpu_compute_pipeline_key
+    std::unordered_map<std::string, GpuPipelineCacheEntry<GpuGraphicsPipelineState>>    graphics_pipeline_cache;
+    std::unordered_map<std::string, GpuPipelineCacheEntry<GpuComputePipelineState>>     compute_pipeline_cache;
 };
 
 auto debug_utils_messenger_callback(vk::DebugUtilsMessageSeverityFlagBitsEXT messageSeverity, unsigned int messageType, const vk::DebugUtilsMessengerCallbackDataEXT* pCallbackData, void* pUserData) -> vk::Bool32 {
@@ -365,6 +417,10 @@ void gpu_create_context(GpuContext* context, WindowPlatform* platform, PFN_vkGet
 
     context->physical_device = context->instance.enumeratePhysicalDevices().front();
 
+    auto properties_chain = context->physical_device.getProperties2<vk::PhysicalDeviceProperties2, vk::PhysicalDeviceSubgroupProperties>();
+    context->subgroup_properties = properties_chain.get<vk::PhysicalDeviceSubgroupProperties>();
+    context->subgroup_properties.pNext = nullptr;
+
     auto queue_families = context->physical_device.getQueueFamilyProperties();
 
     std::vector<vk::DeviceQueueCreateInfo> queue_create_infos;
@@ -375,7 +431,24 @@ void gpu_create_context(GpuContext* context, WindowPlatform* platform, PFN_vkGet
         queue_create_infos.emplace_back(vk::DeviceQueueCreateInfo({}, i, priorities));
     }
 
+    vk::PhysicalDeviceDescriptorIndexingFeatures descriptor_indexing_features{};
+    descriptor_indexing_features.runtimeDescriptorArray = VK_TRUE;
+    descriptor_indexing_features.descriptorBindingPartiallyBound = VK_TRUE;
+    descriptor_indexing_features.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+    descriptor_indexing_features.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+    descriptor_indexing_features.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+
+    // gl_DrawID in the indirect ImGui shaders
+    vk::PhysicalDeviceShaderDrawParametersFeatures shader_draw_parameters_features{};
+    shader_draw_parameters_features.pNext = &descriptor_indexing_features;
+    shader_draw_parameters_features.shaderDrawParameters = VK_TRUE;
+
+    vk::PhysicalDeviceTimelineSemaphoreFeatures timeline_semaphore_features{};
+    timeline_semaphore_features.pNext = &shader_draw_parameters_features;
+    timeline_semaphore_features.timelineSemaphore = VK_TRUE;
+
     vk::PhysicalDeviceBufferDeviceAddressFeatures buffer_device_address_features{};
+    buffer_device_address_features.pNext = &timeline_semaphore_features;
     buffer_device_address_features.bufferDeviceAddress = VK_TRUE;
 
     vk::PhysicalDevicePortabilitySubsetFeaturesKHR portability_subset_features{};
@@ -391,12 +464,15 @@ void gpu_create_context(GpuContext* context, WindowPlatform* platform, PFN_vkGet
 
     auto features2 = context->physical_device.getFeatures2();
     features2.pNext = &synchronization_2_features;
+    context->features = features2.features;
 
     auto device_extensions = std::vector<const char*>();
     device_extensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
     device_extensions.push_back(VK_KHR_PUSH_DESCRIPTOR_EXTENSION_NAME);
     device_extensions.push_back(VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME);
     device_extensions.push_back(VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME);
+    device_extensions.push_back(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+    device_extensions.push_back(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
 #if __APPLE__
     device_extensions.push_back(VK_KHR_PORTABILITY_SUBSET_EXTENSION_NAME);
 #endif
@@ -428,17 +504,55 @@ void gpu_create_context(GpuContext* context, WindowPlatform* platform, PFN_vkGet
     }
     context->present_queue = context->logical_device.getQueue(context->present_queue_family_index, 0);
 
+    // prefer a dedicated compute family, so compute work can run alongside graphics
     context->compute_queue_family_index = std::numeric_limits<uint32_t>::max();
     for (uint32_t i = 0; i < queue_families.size(); i++) {
-        if (queue_families[i].queueFlags & vk::QueueFlagBits::eCompute) {
+        if ((queue_families[i].queueFlags & vk::QueueFlagBits::eCompute) && !(queue_families[i].queueFlags & vk::QueueFlagBits::eGraphics)) {
             context->compute_queue_family_index = i;
             break;
         }
     }
+    if (context->compute_queue_family_index == std::numeric_limits<uint32_t>::max()) {
+        context->compute_queue_family_index = context->graphics_queue_family_index;
+    }
     context->compute_queue = context->logical_device.getQueue(context->compute_queue_family_index, 0);
+
+    // prefer a transfer-only family (usually the copy engine), uploads then stay off the graphics queue
+    context->transfer_queue_family_index = std::numeric_limits<uint32_t>::max();
+    for (uint32_t i = 0; i < queue_families.size(); i++) {
+        auto flags = queue_families[i].queueFlags;
+        if ((flags & vk::QueueFlagBits::eTransfer) && !(flags & vk::QueueFlagBits::eGraphics) && !(flags & vk::QueueFlagBits::eCompute)) {
+            context->transfer_queue_family_index = i;
+            break;
+        }
+    }
+    if (context->transfer_queue_family_index == std::numeric_limits<uint32_t>::max()) {
+        context->transfer_queue_family_index = context->graphics_queue_family_index;
+    }
+    context->transfer_queue = context->logical_device.getQueue(context->transfer_queue_family_index, 0);
 }
 
 void gpu_destroy_context(GpuContext* context) {
+    auto destroy_pipeline_state = [&](auto& state) {
+        context->logical_device.destroyPipeline(state.pipeline);
+        context->logical_device.destroyPipelineLayout(state.pipeline_layout);
+        for (auto bind_group_layout : state.bind_group_layouts) {
+            context->logical_device.destroyDescriptorSetLayout(bind_group_layout);
+        }
+    };
+
+    if (!context->graphics_pipeline_cache.empty() || !context->compute_pipeline_cache.empty()) {
+        fprintf(stderr, "Destroying %zu pipeline states that are still referenced\n", context->graphics_pipeline_cache.size() + context->compute_pipeline_cache.size());
+    }
+    for (auto& [key, entry] : context->graphics_pipeline_cache) {
+        destroy_pipeline_state(entry.state);
+    }
+    for (auto& [key, entry] : context->compute_pipeline_cache) {
+        destroy_pipeline_state(entry.state);
+    }
+    context->graphics_pipeline_cache.clear();
+    context->compute_pipeline_cache.clear();
+
     context->logical_device.destroy();
 
     context->instance.destroyDebugUtilsMessengerEXT(context->messenger);
@@ -464,10 +578,612 @@ auto gpu_allocator_allocate(GpuLinearAllocator* allocator, GpuBufferInfo* info,
     return true;
 }
 
+// Hands size bytes of allocator to slice, which then allocates from them only; slice owns nothing and allocates nothing
+// when allocator is out of space.
+auto gpu_allocator_slice(GpuLinearAllocator* allocator, GpuLinearAllocator* slice, vk::DeviceSize size, vk::DeviceSize alignment) -> bool {
+    GpuBufferInfo info;
+    auto allocated = gpu_allocator_allocate(allocator, &info, size, alignment);
+
+    slice->storage = allocator->storage;
+    slice->storage.size = allocated ? info.offset + size : 0;
+    slice->offset = allocated ? info.offset : 0;
+    return allocated;
+}
+
+namespace spirv {
+    constexpr u32 MagicNumber = 0x07230203;
+
+    enum Op : u32 {
+        OpEntryPoint                = 15,
+        OpExecutionMode             = 16,
+        OpTypeBool                  = 20,
+        OpTypeInt                   = 21,
+        OpTypeFloat                 = 22,
+        OpTypeVector                = 23,
+        OpTypeMatrix                = 24,
+        OpTypeImage                 = 25,
+        OpTypeSampler               = 26,
+        OpTypeSampledImage          = 27,
+        OpTypeArray                 = 28,
+        OpTypeRuntimeArray          = 29,
+        OpTypeStruct                = 30,
+        OpTypePointer               = 32,
+        OpConstant                  = 43,
+        OpConstantComposite         = 44,
+        OpSpecConstant              = 50,
+        OpSpecConstantComposite     = 51,
+        OpVariable                  = 59,
+        OpDecorate                  = 71,
+        OpMemberDecorate            = 72,
+        OpExecutionModeId           = 331,
+        OpTypeAccelerationStructure = 5341,
+    };
+
+    enum Decoration : u32 {
+        DecorationSpecId        = 1,
+        DecorationBlock         = 2,
+        DecorationBufferBlock   = 3,
+        DecorationArrayStride   = 6,
+        DecorationMatrixStride  = 7,
+        DecorationBuiltIn       = 11,
+        DecorationBinding       = 33,
+        DecorationDescriptorSet = 34,
+        DecorationOffset        = 35,
+    };
+
+    enum StorageClass : u32 {
+        StorageClassUniformConstant         = 0,
+        StorageClassUniform                 = 2,
+        StorageClassPushConstant            = 9,
+        StorageClassStorageBuffer           = 12,
+        StorageClassPhysicalStorageBuffer   = 5349,
+    };
+
+    enum ExecutionMode : u32 {
+        ExecutionModeLocalSize      = 17,
+        ExecutionModeLocalSizeId    = 38,
+    };
+
+    enum Dim : u32 {
+        DimBuffer       = 5,
+        DimSubpassData  = 6,
+    };
+
+    constexpr u32 BuiltInWorkgroupSize = 25;
+
+    // Everything the reflector needs to know about a single result id.
+    struct Id {
+        u32                 opcode          = {};
+        u32                 type_id         = {};
+        u32                 storage_class   = {};
+        u32                 value           = {};
+        u32                 set             = std::numeric_limits<u32>::max();
+        u32                 binding         = std::numeric_limits<u32>::max();
+        u32                 builtin         = std::numeric_limits<u32>::max();
+        u32                 spec_id         = std::numeric_limits<u32>::max();
+        u32                 array_stride    = {};
+        u32                 image_dim       = {};
+        u32                 image_sampled   = {};
+        bool                block           = {};
+        bool                buffer_block    = {};
+        std::vector<u32>    members         = {};
+        std::vector<u32>    member_offsets  = {};
+        std::vector<u32>    member_strides  = {};
+    };
+}
+
+auto gpu_spirv_type_alignment(const std::vector<spirv::Id>& ids, u32 type_id) -> u32 {
+    auto& type = ids[type_id];
+    switch (type.opcode) {
+        case spirv::OpTypeBool: return 4;
+        case spirv::OpTypeInt:
+        case spirv::OpTypeFloat: return type.value / 8;
+        case spirv::OpTypeVector: return gpu_spirv_type_alignment(ids, type.type_id) * (type.value == 3 ? 4 : type.value);
+        case spirv::OpTypeMatrix:
+        case spirv::OpTypeArray:
+        case spirv::OpTypeRuntimeArray: return gpu_spirv_type_alignment(ids, type.type_id);
+        case spirv::OpTypePointer: return 8;
+        case spirv::OpTypeStruct: {
+            u32 alignment = 1;
+            for (auto member : type.members) {
+                alignment = std::max(alignment, gpu_spirv_type_alignment(ids, member));
+            }
+            return alignment;
+        }
+        default: return 4;
+    }
+}
+
+auto gpu_spirv_type_size(const std::vector<spirv::Id>& ids, u32 type_id, u32 matrix_stride) -> u32 {
+    auto& type = ids[type_id];
+    switch (type.opcode) {
+        case spirv::OpTypeBool: return 4;
+        case spirv::OpTypeInt:
+        case spirv::OpTypeFloat: return type.value / 8;
+        case spirv::OpTypeVector: return gpu_spirv_type_size(ids, type.type_id, 0) * type.value;
+        case spirv::OpTypeMatrix: {
+            auto column_size = matrix_stride != 0 ? matrix_stride : gpu_spirv_type_size(ids, type.type_id, 0);
+            return column_size * type.value;
+        }
+        case spirv::OpTypeArray: {
+            auto element_size = type.array_stride != 0 ? type.array_stride : gpu_spirv_type_size(ids, type.type_id, matrix_stride);
+            return element_size * ids[type.value].value;
+        }
+        case spirv::OpTypePointer: return 8;
+        case spirv::OpTypeStruct: {
+            u32 size = 0;
+            for (usize i = 0; i < type.members.size(); ++i) {
+                size = std::max(size, type.member_offsets[i] + gpu_spirv_type_size(ids, type.members[i], type.member_strides[i]));
+            }
+            return size;
+        }
+        default: return 0;
+    }
+}
+
+void gpu_reflect_shader_object(GpuShaderObject* shader_object, const u32* code, usize word_count) {
+    if (word_count < 5 || code[0] != spirv::MagicNumber) {
+        throw std::runtime_error("Invalid SPIR-V module");
+    }
+
+    auto ids = std::vector<spirv::Id>(code[3]);
+    auto entry_point_id = std::numeric_limits<u32>::max();
+    auto workgroup_size_ids = std::array<u32, 3>{};
+    auto has_workgroup_size_ids = false;
+
+    auto member = [](std::vector<u32>& values, u32 index) -> u32& {
+        if (values.size() <= index) {
+            values.resize(index + 1);
+        }
+        return values[index];
+    };
+
+    for (usize offset = 5; offset < word_count;) {
+        auto opcode = code[offset] & 0xFFFFu;
+        auto length = code[offset] >> 16u;
+        if (length == 0 || offset + length > word_count) {
+            throw std::runtime_error("Invalid SPIR-V instruction");
+        }
+        auto args = code + offset + 1;
+
+        switch (opcode) {
+            case spirv::OpEntryPoint: {
+                if (std::strcmp(reinterpret_cast<const char*>(args + 2), shader_object->name.c_str()) == 0) {
+                    entry_point_id = args[1];
+                }
+                break;
+            }
+            case spirv::OpExecutionMode: {
+                if (args[0] == entry_point_id && args[1] == spirv::ExecutionModeLocalSize) {
+                    shader_object->workgroup_size = { args[2], args[3], args[4] };
+                }
+                break;
+            }
+            case spirv::OpExecutionModeId: {
+                if (args[0] == entry_point_id && args[1] == spirv::ExecutionModeLocalSizeId) {
+                    workgroup_size_ids = { args[2], args[3], args[4] };
+                    has_workgroup_size_ids = true;
+                }
+                break;
+            }
+            case spirv::OpDecorate: {
+                auto& id = ids[args[0]];
+                switch (args[1]) {
+                    case spirv::DecorationBlock: id.block = true; break;
+                    case spirv::DecorationBufferBlock: id.buffer_block = true; break;
+                    case spirv::DecorationArrayStride: id.array_stride = args[2]; break;
+                    case spirv::DecorationBuiltIn: id.builtin = args[2]; break;
+                    case spirv::DecorationSpecId: id.spec_id = args[2]; break;
+                    case spirv::DecorationBinding: id.binding = args[2]; break;
+                    case spirv::DecorationDescriptorSet: id.set = args[2]; break;
+                    default: break;
+                }
+                break;
+            }
+            case spirv::OpMemberDecorate: {
+                auto& id = ids[args[0]];
+                switch (args[2]) {
+                    case spirv::DecorationOffset: member(id.member_offsets, args[1]) = args[3]; break;
+                    case spirv::DecorationMatrixStride: member(id.member_strides, args[1]) = args[3]; break;
+                    default: break;
+                }
+                break;
+            }
+            case spirv::OpTypeBool:
+            case spirv::OpTypeSampler:
+            case spirv::OpTypeAccelerationStructure: {
+                ids[args[0]].opcode = opcode;
+                break;
+            }
+            case spirv::OpTypeInt:
+            case spirv::OpTypeFloat: {
+                ids[args[0]].opcode = opcode;
+                ids[args[0]].value = args[1];
+                break;
+            }
+            case spirv::OpTypeVector:
+            case spirv::OpTypeMatrix:
+            case spirv::OpTypeArray: {
+                ids[args[0]].opcode = opcode;
+                ids[args[0]].type_id = args[1];
+                ids[args[0]].value = args[2];
+                break;
+            }
+            case spirv::OpTypeImage: {
+                ids[args[0]].opcode = opcode;
+                ids[args[0]].image_dim = args[2];
+                ids[args[0]].image_sampled = args[6];
+                break;
+            }
+            case spirv::OpTypeSampledImage:
+            case spirv::OpTypeRuntimeArray: {
+                ids[args[0]].opcode = opcode;
+                ids[args[0]].type_id = args[1];
+                break;
+            }
+            case spirv::OpTypeStruct: {
+                auto& id = ids[args[0]];
+                id.opcode = opcode;
+                id.members.assign(args + 1, args + length - 1);
+                id.member_offsets.resize(id.members.size());
+                id.member_strides.resize(id.members.size());
+                break;
+            }
+            case spirv::OpTypePointer: {
+                ids[args[0]].opcode = opcode;
+                ids[args[0]].storage_class = args[1];
+                ids[args[0]].type_id = args[2];
+                break;
+            }
+            case spirv::OpConstant:
+            case spirv::OpSpecConstant: {
+                ids[args[1]].opcode = opcode;
+                ids[args[1]].type_id = args[0];
+                ids[args[1]].value = args[2];
+                break;
+            }
+            case spirv::OpConstantComposite:
+            case spirv::OpSpecConstantComposite: {
+                ids[args[1]].opcode = opcode;
+                ids[args[1]].type_id = args[0];
+                ids[args[1]].members.assign(args + 2, args + length - 1);
+                break;
+            }
+            case spirv::OpVariable: {
+                ids[args[1]].opcode = opcode;
+                ids[args[1]].type_id = args[0];
+                ids[args[1]].storage_class = args[2];
+                break;
+            }
+            default: {
+                break;
+            }
+        }
+        offset += length;
+    }
+
+    for (auto& id : ids) {
+        if (id.builtin == spirv::BuiltInWorkgroupSize && id.members.size() == 3) {
+            workgroup_size_ids = { id.members[0], id.members[1], id.members[2] };
+            has_workgroup_size_ids = true;
+        }
+    }
+    if (has_workgroup_size_ids) {
+        for (usize i = 0; i < 3; ++i) {
+            shader_object->workgroup_size[i] = ids[workgroup_size_ids[i]].value;
+            shader_object->workgroup_size_spec_ids[i] = ids[workgroup_size_ids[i]].spec_id;
+        }
+    }
+
+    for (auto& variable : ids) {
+        if (variable.opcode != spirv::OpVariable) {
+            continue;
+        }
+
+        auto type_id = ids[variable.type_id].type_id;
+
+        if (variable.storage_class == spirv::StorageClassPushConstant) {
+            auto& block = ids[type_id];
+            auto min_offset = block.member_offsets.empty() ? 0u : *std::min_element(block.member_offsets.begin(), block.member_offsets.end());
+            auto size = gpu_calculate_alignment(gpu_spirv_type_size(ids, type_id, 0), gpu_spirv_type_alignment(ids, type_id));
+            shader_object->push_constants.emplace_back(shader_object->stage, min_offset, static_cast<u32>(size) - min_offset);
+            continue;
+        }
+
+        if (variable.set == std::numeric_limits<u32>::max() || variable.binding == std::numeric_limits<u32>::max()) {
+            continue;
+        }
+
+        u32 descriptor_count = 1;
+        if (ids[type_id].opcode == spirv::OpTypeArray) {
+            descriptor_count = ids[ids[type_id].value].value;
+            type_id = ids[type_id].type_id;
+        } else if (ids[type_id].opcode == spirv::OpTypeRuntimeArray) {
+            descriptor_count = 0;
+            type_id = ids[type_id].type_id;
+        }
+
+        auto& type = ids[type_id];
+
+        vk::DescriptorType descriptor_type;
+        switch (type.opcode) {
+            case spirv::OpTypeSampler: {
+                descriptor_type = vk::DescriptorType::eSampler;
+                break;
+            }
+            case spirv::OpTypeSampledImage: {
+                descriptor_type = vk::DescriptorType::eCombinedImageSampler;
+                break;
+            }
+            case spirv::OpTypeImage: {
+                if (type.image_dim == spirv::DimSubpassData) {
+                    descriptor_type = vk::DescriptorType::eInputAttachment;
+                } else if (type.image_dim == spirv::DimBuffer) {
+                    descriptor_type = type.image_sampled == 2 ? vk::DescriptorType::eStorageTexelBuffer : vk::DescriptorType::eUniformTexelBuffer;
+                } else {
+                    descriptor_type = type.image_sampled == 2 ? vk::DescriptorType::eStorageImage : vk::DescriptorType::eSampledImage;
+                }
+                break;
+            }
+            case spirv::OpTypeAccelerationStructure: {
+                descriptor_type = vk::DescriptorType::eAccelerationStructureKHR;
+                break;
+            }
+            case spirv::OpTypeStruct: {
+                if (variable.storage_class == spirv::StorageClassStorageBuffer || type.buffer_block) {
+                    descriptor_type = vk::DescriptorType::eStorageBuffer;
+                } else {
+                    descriptor_type = vk::DescriptorType::eUniformBuffer;
+                }
+                break;
+            }
+            default: {
+                continue;
+            }
+        }
+
+        shader_object->bindings.emplace_back(GpuShaderBinding{
+            .set                = variable.set,
+            .binding            = variable.binding,
+            .descriptor_type    = descriptor_type,
+            .descriptor_count   = descriptor_count,
+        });
+    }
+}
+
+// Runtime arrays (descriptor_count 0) become GPU_BINDLESS_DESCRIPTOR_COUNT partially bound, update-after-bind descriptors
+// visible to all stages. Every layout goes through here, so a bindless set is compatible with the reflected layout of any
+// shader declaring it the same way.
+auto gpu_create_bind_group_layout(GpuContext* context, Slice<vk::DescriptorSetLayoutBinding> entries, vk::DescriptorSetLayoutCreateFlags flags = {}) -> vk::DescriptorSetLayout {
+    auto bindings = std::vector<vk::DescriptorSetLayoutBinding>(entries.begin(), entries.end());
+    auto binding_flags = std::vector<vk::DescriptorBindingFlags>(bindings.size());
+
+    auto update_after_bind = false;
+    for (usize i = 0; i < bindings.size(); ++i) {
+        if (bindings[i].descriptorCount == 0) {
+            bindings[i].descriptorCount = GPU_BINDLESS_DESCRIPTOR_COUNT;
+            bindings[i].stageFlags = vk::ShaderStageFlagBits::eAll;
+            binding_flags[i] = vk::DescriptorBindingFlagBits::ePartiallyBound
+                | vk::DescriptorBindingFlagBits::eUpdateAfterBind
+                | vk::DescriptorBindingFlagBits::eUpdateUnusedWhilePending;
+            update_after_bind = true;
+        }
+    }
+
+    auto binding_flags_create_info = vk::DescriptorSetLayoutBindingFlagsCreateInfo()
+        .setBindingFlags(binding_flags);
+
+    auto layout_create_info = vk::DescriptorSetLayoutCreateInfo()
+        .setFlags(flags)
+        .setBindings(bindings);
+
+    if (update_after_bind) {
+        layout_create_info.setFlags(flags | vk::DescriptorSetLayoutCreateFlagBits::eUpdateAfterBindPool);
+        layout_create_info.setPNext(&binding_flags_create_info);
+    }
+
+    return context->logical_device.createDescriptorSetLayout(layout_create_info);
+}
+
+void gpu_create_bind_group_layouts(GpuContext* context, Slice<GpuShaderObject*> shader_objects, u32 push_bind_group_mask, std::vector<vk::DescriptorSetLayout>* bind_group_layouts) {
+    std::vector<std::vector<vk::DescriptorSetLayoutBinding>> sets = {};
+    for (auto shader_object : shader_objects) {
+        for (auto& binding : shader_object->bindings) {
+            if (sets.size() <= binding.set) {
+                sets.resize(binding.set + 1);
+            }
+            auto& entries = sets[binding.set];
+            auto it = std::find_if(entries.begin(), entries.end(), [&](auto& entry) { return entry.binding == binding.binding; });
+            if (it != entries.end()) {
+                it->stageFlags |= shader_object->stage;
+                continue;
+            }
+            entries.emplace_back(binding.binding, binding.descriptor_type, binding.descriptor_count, shader_object->stage);
+        }
+    }
+
+    bind_group_layouts->clear();
+    for (u32 set = 0; set < sets.size(); ++set) {
+        auto flags = vk::DescriptorSetLayoutCreateFlags();
+        if (push_bind_group_mask & (1u << set)) {
+            flags |= vk::DescriptorSetLayoutCreateFlagBits::ePushDescriptorKHR;
+        }
+        bind_group_layouts->emplace_back(gpu_create_bind_group_layout(context, sets[set], flags));
+    }
+}
+
+void gpu_merge_push_constant_ranges(Slice<GpuShaderObject*> shader_objects, std::vector<vk::PushConstantRange>* push_constant_ranges) {
+    push_constant_ranges->clear();
+    for (auto shader_object : shader_objects) {
+        for (auto& range : shader_object->push_constants) {
+            auto it = std::find_if(push_constant_ranges->begin(), push_constant_ranges->end(), [&](auto& other) {
+                return other.offset == range.offset && other.size == range.size;
+            });
+            if (it != push_constant_ranges->end()) {
+                it->stageFlags |= range.stageFlags;
+                continue;
+            }
+            push_constant_ranges->emplace_back(range);
+        }
+    }
+}
+
+// Appends the bytes of value to a pipeline cache key. Only for types without padding, whose bytes are their value.
+template<typename T>
+void gpu_key_append(std::string* key, const T& value) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    key->append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+// Variable length parts are prefixed with their size, so two different keys never have the same bytes.
+void gpu_key_append_bytes(std::string* key, const void* data, usize size) {
+    gpu_key_append(key, size);
+    key->append(static_cast<const char*>(data), size);
+}
+
+template<typename T>
+void gpu_key_append_array(std::string* key, Slice<T> values) {
+    gpu_key_append_bytes(key, values.data(), values.size() * sizeof(T));
+}
+
+void gpu_key_append_shader_object(std::string* key, const GpuShaderObject* shader_object) {
+    gpu_key_append(key, shader_object->stage);
+    gpu_key_append_bytes(key, shader_object->code.data(), shader_object->code.size() * sizeof(u32));
+    gpu_key_append_bytes(key, shader_object->name.data(), shader_object->name.size());
+}
+
+// Returns false for layouts the caller supplied. Their handles say nothing about their bindings and may be reused by a
+// different layout once destroyed, so pipelines created with them are not shared.
+auto gpu_key_append_pipeline_layout(std::string* key, Slice<vk::DescriptorSetLayout> bind_group_layouts, Slice<vk::PushConstantRange> push_constant_ranges) -> bool {
+    if (!bind_group_layouts.empty()) {
+        return false;
+    }
+
+    // derived layouts are fully described by the reflected shaders, which are already part of the key
+    gpu_key_append_array(key, push_constant_ranges);
+    return true;
+}
+
+// Returns false when pNext holds a structure whose contents the cache does not know how to key.
+auto gpu_key_append_pipeline_next(std::string* key, const void* pNext) -> bool {
+    for (auto next = static_cast<const vk::BaseInStructure*>(pNext); next != nullptr; next = next->pNext) {
+        if (next->sType != vk::StructureType::ePipelineRenderingCreateInfo) {
+            return false;
+        }
+
+        auto rendering_info = reinterpret_cast<const vk::PipelineRenderingCreateInfo*>(next);
+        gpu_key_append(key, next->sType);
+        gpu_key_append(key, rendering_info->viewMask);
+        gpu_key_append_bytes(key, rendering_info->pColorAttachmentFormats, rendering_info->colorAttachmentCount * sizeof(vk::Format));
+        gpu_key_append(key, rendering_info->depthAttachmentFormat);
+        gpu_key_append(key, rendering_info->stencilAttachmentFormat);
+    }
+    return true;
+}
+
+// Everything that affects the created pipeline, or empty when the state can not be shared.
+auto gpu_graphics_pipeline_key(GpuGraphicsPipelineStateCreateInfo* info, void* pNext) -> std::string {
+    std::string key;
+    if (!gpu_key_append_pipeline_next(&key, pNext)) {
+        return {};
+    }
+
+    gpu_key_append(&key, info->shader_objects.size());
+    for (auto shader_object : info->shader_objects) {
+        gpu_key_append_shader_object(&key, shader_object);
+    }
+
+    gpu_key_append(&key, info->input_assembly_state.topology);
+    gpu_key_append(&key, info->input_assembly_state.primitive_restart_enable);
+
+    gpu_key_append(&key, info->rasterization_state.depth_clamp_enable);
+    gpu_key_append(&key, info->rasterization_state.discard_enable);
+    gpu_key_append(&key, info->rasterization_state.polygon_mode);
+    gpu_key_append(&key, info->rasterization_state.line_width);
+    gpu_key_append(&key, info->rasterization_state.cull_mode);
+    gpu_key_append(&key, info->rasterization_state.front_face);
+    gpu_key_append(&key, info->rasterization_state.depth_bias_enable);
+    gpu_key_append(&key, info->rasterization_state.depth_bias_constant_factor);
+    gpu_key_append(&key, info->rasterization_state.depth_bias_clamp);
+    gpu_key_append(&key, info->rasterization_state.depth_bias_slope_factor);
+
+    gpu_key_append(&key, info->depth_stencil_state.depth_test_enable);
+    gpu_key_append(&key, info->depth_stencil_state.depth_write_enable);
+    gpu_key_append(&key, info->depth_stencil_state.depth_compare_op);
+    gpu_key_append(&key, info->depth_stencil_state.depth_bounds_test_enable);
+    gpu_key_append(&key, info->depth_stencil_state.stencil_test_enable);
+    gpu_key_append(&key, info->depth_stencil_state.front);
+    gpu_key_append(&key, info->depth_stencil_state.back);
+    gpu_key_append(&key, info->depth_stencil_state.min_depth_bounds);
+    gpu_key_append(&key, info->depth_stencil_state.max_depth_bounds);
+
+    gpu_key_append(&key, info->color_blend_state.logic_op_enable);
+    gpu_key_append(&key, info->color_blend_state.logic_op);
+    gpu_key_append(&key, info->color_blend_state.blend_constants);
+    gpu_key_append_bytes(&key, info->color_blend_state.attachments.data(), info->color_blend_state.attachments.size() * sizeof(vk::PipelineColorBlendAttachmentState));
+
+    gpu_key_append_bytes(&key, info->vertex_input_state.bindings.data(), info->vertex_input_state.bindings.size() * sizeof(vk::VertexInputBindingDescription));
+    gpu_key_append_bytes(&key, info->vertex_input_state.attributes.data(), info->vertex_input_state.attributes.size() * sizeof(vk::VertexInputAttributeDescription));
+
+    if (!gpu_key_append_pipeline_layout(&key, info->bind_group_layouts, info->push_constant_ranges)) {
+        return {};
+    }
+    gpu_key_append(&key, info->push_bind_group_mask);
+    return key;
+}
+
+// Everything that affects the created pipeline, or empty when the state can not be shared.
+auto gpu_compute_pipeline_key(GpuComputePipelineStateCreateInfo* info) -> std::string {
+    std::string key;
+    gpu_key_append_shader_object(&key, info->shader_object);
+
+    if (info->specialization_info != nullptr) {
+        auto specialization_info = info->specialization_info;
+        gpu_key_append_bytes(&key, specialization_info->pMapEntries, specialization_info->mapEntryCount * sizeof(vk::SpecializationMapEntry));
+        gpu_key_append_bytes(&key, specialization_info->pData, specialization_info->dataSize);
+    } else {
+        gpu_key_append_bytes(&key, nullptr, 0);
+    }
+
+    if (!gpu_key_append_pipeline_layout(&key, info->bind_group_layouts, info->push_constant_ranges)) {
+        return {};
+    }
+    gpu_key_append(&key, info->push_bind_group_mask);
+    return key;
+}
+
+// Pipeline states are shared through GpuContext::graphics_pipeline_cache, callers must release them with gpu_destroy_graphics_pipeline_state.
 void gpu_create_graphics_pipeline_state(GpuContext* context, GpuGraphicsPipelineState* state, GpuGraphicsPipelineStateCreateInfo* info, void* pNext) {
+    auto key = gpu_graphics_pipeline_key(info, pNext);
+    if (!key.empty()) {
+        auto it = context->graphics_pipeline_cache.find(key);
+        if (it != context->graphics_pipeline_cache.end()) {
+            it->second.refs += 1;
+            *state = it->second.state;
+            return;
+        }
+    }
+
+    std::vector<vk::PushConstantRange> push_constant_ranges = {};
+    if (info->push_constant_ranges.empty()) {
+        gpu_merge_push_constant_ranges(info->shader_objects, &push_constant_ranges);
+    } else {
+        push_constant_ranges.assign(info->push_constant_ranges.begin(), info->push_constant_ranges.end());
+    }
+
+    state->bind_group_layouts.clear();
+    if (info->bind_group_layouts.empty()) {
+        gpu_create_bind_group_layouts(context, info->shader_objects, info->push_bind_group_mask, &state->bind_group_layouts);
+    }
+
     auto layout_create_info = vk::PipelineLayoutCreateInfo()
-        .setSetLayouts(info->bind_group_layouts)
-        .setPushConstantRanges(info->push_constant_ranges);
+        .setPushConstantRanges(push_constant_ranges);
+
+    if (info->bind_group_layouts.empty()) {
+        layout_create_info.setSetLayouts(state->bind_group_layouts);
+    } else {
+        layout_create_info.setSetLayouts(info->bind_group_layouts);
+    }
 
     vk::resultCheck(context->logical_device.createPipelineLayout(&layout_create_info, nullptr, &state->pipeline_layout), "Failed to create pipeline layout");
 
@@ -556,23 +1272,85 @@ void gpu_create_graphics_pipeline_state(GpuContext* context, GpuGraphicsPipeline
         .setBasePipelineIndex(-1);
 
     vk::resultCheck(context->logical_device.createGraphicsPipelines(nullptr, 1, &graphics_pipeline_create_info, nullptr, &state->pipeline), "Failed to create graphics pipeline");
+
+    state->cache_key = key;
+    if (!key.empty()) {
+        context->graphics_pipeline_cache.emplace(std::move(key), GpuPipelineCacheEntry<GpuGraphicsPipelineState>{ .state = *state, .refs = 1 });
+    }
 }
 
 void gpu_destroy_graphics_pipeline_state(GpuContext* context, GpuGraphicsPipelineState* state) {
+    if (!state->cache_key.empty()) {
+        auto it = context->graphics_pipeline_cache.find(state->cache_key);
+        if (it != context->graphics_pipeline_cache.end()) {
+            it->second.refs -= 1;
+            if (it->second.refs > 0) {
+                *state = {};
+                return;
+            }
+            context->graphics_pipeline_cache.erase(it);
+        }
+    }
+
     context->logical_device.destroyPipeline(state->pipeline);
     context->logical_device.destroyPipelineLayout(state->pipeline_layout);
+    for (auto bind_group_layout : state->bind_group_layouts) {
+        context->logical_device.destroyDescriptorSetLayout(bind_group_layout);
+    }
+    state->bind_group_layouts.clear();
 }
 
+// Pipeline states are shared through GpuContext::compute_pipeline_cache, callers must release them with gpu_destroy_compute_pipeline_state.
 void gpu_create_compute_pipeline_state(GpuContext* context, GpuComputePipelineStateCreateInfo* info, GpuComputePipelineState* state) {
+    auto key = gpu_compute_pipeline_key(info);
+    if (!key.empty()) {
+        auto it = context->compute_pipeline_cache.find(key);
+        if (it != context->compute_pipeline_cache.end()) {
+            it->second.refs += 1;
+            *state = it->second.state;
+            return;
+        }
+    }
+
     auto shader_stage_create_info = vk::PipelineShaderStageCreateInfo()
         .setStage(info->shader_object->stage)
         .setModule(info->shader_object->shader_module)
-        .setPName(info->shader_object->name.c_str());
+        .setPName(info->shader_object->name.c_str())
+        .setPSpecializationInfo(info->specialization_info);
+
+    auto shader_objects = Slice<GpuShaderObject*>(info->shader_object);
+
+    std::vector<vk::PushConstantRange> push_constant_ranges = {};
+    if (info->push_constant_ranges.empty()) {
+        gpu_merge_push_constant_ranges(shader_objects, &push_constant_ranges);
+    } else {
+        push_constant_ranges.assign(info->push_constant_ranges.begin(), info->push_constant_ranges.end());
+    }
+
+    state->bind_group_layouts.clear();
+    if (info->bind_group_layouts.empty()) {
+        gpu_create_bind_group_layouts(context, shader_objects, info->push_bind_group_mask, &state->bind_group_layouts);
+    }
 
     auto layout_create_info = vk::PipelineLayoutCreateInfo()
-        .setSetLayouts(info->bind_group_layouts)
-        .setPushConstantRanges(info->push_constant_ranges);
+        .setPushConstantRanges(push_constant_ranges);
+
+    if (info->bind_group_layouts.empty()) {
+        layout_create_info.setSetLayouts(state->bind_group_layouts);
+    } else {
+        layout_create_info.setSetLayouts(info->bind_group_layouts);
+    }
 
+    state->workgroup_size = info->shader_object->workgroup_size;
+    if (info->specialization_info != nullptr) {
+        for (usize i = 0; i < 3; ++i) {
+            for (auto& entry : std::span(info->specialization_info->pMapEntries, info->specialization_info->mapEntryCount)) {
+                if (entry.constantID == info->shader_object->workgroup_size_spec_ids[i]) {
+                    std::memcpy(&state->workgroup_size[i], static_cast<const u8*>(info->specialization_info->pData) + entry.offset, sizeof(u32));
+                }
+            }
+        }
+    }
     state->pipeline_layout = context->logical_device.createPipelineLayout(layout_create_info);
 
     auto compute_pipeline_create_info = vk::ComputePipelineCreateInfo()
@@ -582,11 +1360,39 @@ void gpu_create_compute_pipeline_state(GpuContext* context, GpuComputePipelineSt
         .setBasePipelineIndex(-1);
 
     vk::resultCheck(context->logical_device.createComputePipelines(nullptr, 1, &compute_pipeline_create_info, nullptr, &state->pipeline), "Failed to create compute pipeline");
+
+    state->cache_key = key;
+    if (!key.empty()) {
+        context->compute_pipeline_cache.emplace(std::move(key), GpuPipelineCacheEntry<GpuComputePipelineState>{ .state = *state, .refs = 1 });
+    }
 }
 
 void gpu_destroy_compute_pipeline_state(GpuContext* context, GpuComputePipelineState* state) {
+    if (!state->cache_key.empty()) {
+        auto it = context->compute_pipeline_cache.find(state->cache_key);
+        if (it != context->compute_pipeline_cache.end()) {
+            it->second.refs -= 1;
+            if (it->second.refs > 0) {
+                *state = {};
+                return;
+            }
+            context->compute_pipeline_cache.erase(it);
+        }
+    }
+
     context->logical_device.destroyPipeline(state->pipeline);
     context->logical_device.destroyPipelineLayout(state->pipeline_layout);
+    for (auto bind_group_layout : state->bind_group_layouts) {
+        context->logical_device.destroyDescriptorSetLayout(bind_group_layout);
+    }
+    state->bind_group_layouts.clear();
+}
+
+void gpu_dispatch_threads(vk::CommandBuffer cmd, GpuComputePipelineState* state, u32 thread_count_x, u32 thread_count_y, u32 thread_count_z) {
+    auto group_count_x = (thread_count_x + state->workgroup_size[0] - 1) / state->workgroup_size[0];
+    auto group_count_y = (thread_count_y + state->workgroup_size[1] - 1) / state->workgroup_size[1];
+    auto group_count_z = (thread_count_z + state->workgroup_size[2] - 1) / state->workgroup_size[2];
+    cmd.dispatch(group_count_x, group_count_y, group_count_z);
 }
 
 void gpu_update_buffer(vk::CommandBuffer cmd, GpuBufferInfo* info, void* src, vk::DeviceSize size) {
@@ -605,10 +1411,7 @@ void gpu_update_buffer(vk::CommandBuffer cmd, GpuBufferInfo* info, void* src, vk
     }
 }
 
-void gpu_create_command_buffer(GpuContext* context, GpuCommandBuffer* command_buffer) {
-    // todo: lazy init ???
-    gpu_create_allocator(context, &command_buffer->buffer_allocator, 5ull * 1024ull * 1024ull);
-
+auto gpu_create_bind_group_pool(GpuContext* context) -> vk::DescriptorPool {
     auto pool_sizes = std::array{
         vk::DescriptorPoolSize{vk::DescriptorType::eSampler, 1024},
         vk::DescriptorPoolSize{vk::DescriptorType::eSampledImage, 1024},
@@ -626,25 +1429,81 @@ void gpu_create_command_buffer(GpuContext* context, GpuCommandBuffer* command_bu
     descriptor_pool_create_info.setMaxSets(1024);
     descriptor_pool_create_info.setPoolSizes(pool_sizes);
 
-    vk::resultCheck(context->logical_device.createDescriptorPool(&descriptor_pool_create_info, nullptr, &command_buffer->bind_group_allocator), "Failed to create descriptor pool");
+    vk::DescriptorPool pool;
+    vk::resultCheck(context->logical_device.createDescriptorPool(&descriptor_pool_create_info, nullptr, &pool), "Failed to create descriptor pool");
+    return pool;
+}
+
+void gpu_destroy_bind_group_allocator(GpuContext* context, GpuBindGroupAllocator* allocator) {
+    for (auto pool : allocator->pools) {
+        context->logical_device.destroyDescriptorPool(pool);
+    }
+    allocator->pools.clear();
+    allocator->pool_index = 0;
+}
+
+// Every set allocated so far becomes invalid, the pools are kept for the next round.
+void gpu_reset_bind_group_allocator(GpuContext* context, GpuBindGroupAllocator* allocator) {
+    for (usize i = 0; i < allocator->pools.size() && i <= allocator->pool_index; ++i) {
+        context->logical_device.resetDescriptorPool(allocator->pools[i], {});
+    }
+    allocator->pool_index = 0;
+}
+
+// Layouts created with eUpdateAfterBindPool need a pool of their own, see BindlessTextureTable.
+auto gpu_bind_group_allocator_allocate(GpuContext* context, GpuBindGroupAllocator* allocator, vk::DescriptorSetLayout bind_group_layout) -> vk::DescriptorSet {
+    vk::DescriptorSetAllocateInfo allocate_info = {};
+    allocate_info.setDescriptorSetCount(1);
+    allocate_info.setPSetLayouts(&bind_group_layout);
+
+    while (true) {
+        auto new_pool = allocator->pool_index == allocator->pools.size();
+        if (new_pool) {
+            allocator->pools.emplace_back(gpu_create_bind_group_pool(context));
+        }
+        allocate_info.setDescriptorPool(allocator->pools[allocator->pool_index]);
+
+        vk::DescriptorSet bind_group;
+        auto result = context->logical_device.allocateDescriptorSets(&allocate_info, &bind_group);
+        if (result == vk::Result::eSuccess) {
+            return bind_group;
+        }
+        // an empty pool that can not hold the set means the layout needs more than any pool provides
+        if (new_pool || (result != vk::Result::eErrorOutOfPoolMemory && result != vk::Result::eErrorFragmentedPool)) {
+            vk::resultCheck(result, "Failed to allocate descriptor set");
+        }
+        allocator->pool_index += 1;
+    }
+}
+
+// Secondary command buffers get no buffer allocator of their own, they are given a slice of their primary's.
+void gpu_create_command_buffer(GpuContext* context, GpuCommandBuffer* command_buffer, u32 queue_family_index, vk::CommandBufferLevel level = vk::CommandBufferLevel::ePrimary) {
+    // todo: lazy init ???
+    if (level == vk::CommandBufferLevel::ePrimary) {
+        gpu_create_allocator(context, &command_buffer->buffer_allocator, 5ull * 1024ull * 1024ull);
+    }
+    command_buffer->level = level;
+    command_buffer->queue_family_index = queue_family_index;
 
     vk::CommandPoolCreateInfo command_pool_create_info = {};
-    command_pool_create_info.setQueueFamilyIndex(context->graphics_queue_family_index);
+    command_pool_create_info.setQueueFamilyIndex(queue_family_index);
     command_pool_create_info.setFlags(vk::CommandPoolCreateFlagBits::eResetCommandBuffer);
 
     vk::resultCheck(context->logical_device.createCommandPool(&command_pool_create_info, nullptr, &command_buffer->cmd_pool), "Failed to create command pool");
 
     vk::CommandBufferAllocateInfo command_buffer_allocate_info = {};
     command_buffer_allocate_info.setCommandPool(command_buffer->cmd_pool);
-    command_buffer_allocate_info.setLevel(vk::CommandBufferLevel::ePrimary);
+    command_buffer_allocate_info.setLevel(level);
     command_buffer_allocate_info.setCommandBufferCount(1);
 
     vk::resultCheck(context->logical_device.allocateCommandBuffers(&command_buffer_allocate_info, &command_buffer->cmd_buffer), "Failed to allocate command buffer");
 }
 
 void gpu_destroy_command_buffer(GpuContext* context, GpuCommandBuffer* command_buffer) {
-    gpu_destroy_allocator(context, &command_buffer->buffer_allocator);
-    context->logical_device.destroyDescriptorPool(command_buffer->bind_group_allocator);
+    if (command_buffer->level == vk::CommandBufferLevel::ePrimary) {
+        gpu_destroy_allocator(context, &command_buffer->buffer_allocator);
+    }
+    gpu_destroy_bind_group_allocator(context, &command_buffer->bind_group_allocator);
     context->logical_device.destroyCommandPool(command_buffer->cmd_pool);
 }
 
@@ -652,22 +1511,22 @@ void gpu_reset_command_buffer(GpuContext* context, GpuCommandBuffer* command_buf
     command_buffer->buffer_allocator.offset = 0;
 
 //    context->logical_device.resetCommandPool(command_buffer->cmd_pool, {});
-    context->logical_device.resetDescriptorPool(command_buffer->bind_group_allocator, {});
+    gpu_reset_bind_group_allocator(context, &command_buffer->bind_group_allocator);
 }
 
 auto gpu_command_buffer_allocate(GpuContext* context, GpuCommandBuffer* command_buffer, GpuBufferInfo* info, vk::DeviceSize size, vk::DeviceSize alignment) -> bool {
     return gpu_allocator_allocate(&command_buffer->buffer_allocator, info, size, alignment);
 }
 
+// Transient set, valid until the command buffer is reset.
 auto gpu_command_buffer_allocate_bind_group(GpuContext* context, GpuCommandBuffer* command_buffer, vk::DescriptorSetLayout bind_group_layout) -> vk::DescriptorSet {
-    vk::DescriptorSetAllocateInfo allocate_info = {};
-    allocate_info.setDescriptorPool(command_buffer->bind_group_allocator);
-    allocate_info.setDescriptorSetCount(1);
-    allocate_info.setPSetLayouts(&bind_group_layout);
+    return gpu_bind_group_allocator_allocate(context, &command_buffer->bind_group_allocator, bind_group_layout);
+}
 
-    vk::DescriptorSet bind_group;
-    vk::resultCheck(context->logical_device.allocateDescriptorSets(&allocate_info, &bind_group), "Failed to allocate descriptor set");
-    return bind_group;
+// Records the bindings straight into the command buffer, no set is allocated or updated. The set must have been created
+// with push_bind_group_mask, dstSet of the writes is ignored.
+void gpu_command_buffer_push_bind_group(GpuCommandBuffer* command_buffer, vk::PipelineBindPoint bind_point, vk::PipelineLayout pipeline_layout, u32 set, Slice<vk::WriteDescriptorSet> writes) {
+    command_buffer->cmd_buffer.pushDescriptorSetKHR(bind_point, pipeline_layout, set, writes.size(), writes.data());
 }
 
 void gpu_create_shader_object(GpuContext* context, GpuShaderObject* shader_object, const GpuShaderObjectCreateInfo* create_info) {
@@ -680,14 +1539,20 @@ void gpu_create_shader_object(GpuContext* context, GpuShaderObject* shader_objec
 
     shader_object->stage = create_info->stage;
     shader_object->shader_module = shader_module;
+    shader_object->code.assign(static_cast<const u32*>(create_info->pCode), static_cast<const u32*>(create_info->pCode) + create_info->codeSize / sizeof(u32));
     shader_object->name = create_info->pName;
-    shader_object->set_layouts.assign(create_info->set_layouts.begin(), create_info->set_layouts.end());
-    shader_object->push_constants.assign(create_info->push_constants.begin(), create_info->push_constants.end());
+    shader_object->bindings.clear();
+    shader_object->push_constants.clear();
+    shader_object->workgroup_size = { 1, 1, 1 };
+    shader_object->workgroup_size_spec_ids.fill(std::numeric_limits<u32>::max());
+
+    gpu_reflect_shader_object(shader_object, reinterpret_cast<const u32*>(create_info->pCode), create_info->codeSize / sizeof(u32));
 }
 
 void gpu_destroy_shader_object(GpuContext* context, GpuShaderObject* shader_object) {
+    shader_object->code.clear();
     shader_object->name.clear();
-    shader_object->set_layouts.clear();
+    shader_object->bindings.clear();
     shader_object->push_constants.clear();
     context->logical_device.destroyShaderModule(shader_object->shader_module);
 }
\ No newline at end of file
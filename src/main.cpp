@@ -1,6 +1,14 @@
 #include "WindowPlatform.hpp"
 #include "VulkanRenderer.hpp"
 #include "ImGuiRenderer.hpp"
+#include "ReadbackService.hpp"
+#include "DrawDataSnapshot.hpp"
+#include "DrawBatcher.hpp"
+#include "OcclusionCuller.hpp"
+#include "DynamicResolution.hpp"
+#include "FrameGraph.hpp"
+#include "ParallelEncoder.hpp"
+#include "SpscQueue.hpp"
 
 #include <imgui_demo.cpp>
 #include <backends/imgui_impl_glfw.cpp>
@@ -16,8 +24,157 @@ struct RasterizerPushConstants {
     f32                 clip_rect_min_y;
     f32                 clip_rect_max_x;
     f32                 clip_rect_max_y;
+    u32                 texture_index;      // slot in the bindless texture table
 };
 
+// Matches RasterizerUpscalePushConstants in rasterizer_upscale.comp.
+struct RasterizerUpscalePushConstants {
+    ImVec2              uv_scale;
+    ImVec2              uv_max;
+    u32                 width;
+    u32                 height;
+};
+
+// Rasterizer pipeline variants, selected with specialization constants 0..2 in rasterizer.comp and rasterizer_subgroup.comp.
+enum RasterizerVariantFlagBits : u32 {
+    eRasterizerTextured = 1u << 0,
+    eRasterizerClipped  = 1u << 1,
+    eRasterizerBlended  = 1u << 2,
+};
+
+constexpr u32 RASTERIZER_VARIANT_COUNT = 8;
+
+// Dispatches recorded since the last barrier that EncodeRasterizerLists checks a new one against, a barrier once full.
+constexpr usize RASTERIZER_MAX_UNORDERED_DISPATCHES = 64;
+
+// Data for rasterizer.comp specialization constants; ids 3 and 4 are the workgroup shape.
+struct RasterizerSpecialization {
+    vk::Bool32  textured;
+    vk::Bool32  clipped;
+    vk::Bool32  blended;
+    u32         workgroup_size_x;
+    u32         workgroup_size_y;
+};
+
+// What EncodeRasterizerLists needs besides the lists, gathered once on the recording thread so tasks never touch ImGui.
+struct RasterizerEncodeInfo {
+    ImDrawData*             draw_data       = {};
+    vk::Extent2D            extent          = {};   // pixels drawn to, at most the target's size
+    vk::DescriptorSet       bind_group      = {};
+    ImVec2                  viewport_scale  = {};
+    ImVec2                  clip_scale      = {};
+    ImVec2                  white_pixel     = {};
+    const OcclusionCuller*  culler          = {};   // null when occlusion culling is off
+};
+
+// Counted per task by EncodeRasterizerLists and summed into RenderStats afterwards.
+struct RasterizerCounters {
+    std::array<u32, RASTERIZER_VARIANT_COUNT>   variant_dispatches  = {};
+    u32                                         pipeline_binds      = 0;
+    u32                                         barriers            = 0;
+    u32                                         occluded_dispatches = 0;
+    u32                                         trimmed_dispatches  = 0;
+};
+
+// Workgroup shapes the tuner measures, only these are accepted from a saved tuning.
+constexpr auto RASTERIZER_WORKGROUP_CANDIDATES = std::array{ vk::Extent2D(8, 8), vk::Extent2D(16, 8), vk::Extent2D(16, 16), vk::Extent2D(32, 8) };
+
+// Color target written by the rasterizer with async compute; with two of them the compute queue rasterizes frame N+1 while
+// graphics samples frame N. Otherwise the target is a frame graph transient.
+struct RasterizerTarget {
+    GpuTexture  texture;
+    u64         sampled_frame_value = 0; // frame whose graphics submit last sampled the texture
+};
+
+constexpr usize RASTERIZER_TARGET_COUNT = 2;
+
+// Rasterizer targets grow in steps of this many pixels, must be a power of two.
+constexpr u32 RASTERIZER_TARGET_GRANULARITY = 256;
+
+// Time kept in reserve when sleeping for just-in-time input sampling, covers scheduler and timing jitter.
+constexpr f64 JUST_IN_TIME_MARGIN_MS = 1.0;
+// ImGui's text cursor blinks in 0.4 s steps, redrawing twice per step keeps it close enough when rendering on demand
+constexpr f64 TEXT_CURSOR_REDRAW_MS = 200.0;
+
+using Clock = std::chrono::steady_clock;
+using Milliseconds = std::chrono::duration<f64, std::milli>;
+
+// Where one thread spent a frame: working, waiting for the other thread, or blocked on the GPU and presentation.
+struct ThreadTimings {
+    f64 busy_ms = 0.0;
+    f64 idle_ms = 0.0;
+    f64 wait_ms = 0.0;
+
+    // exponential moving averages, smoothed like the latency stats
+    void Accumulate(Milliseconds busy, Milliseconds idle, Milliseconds wait) {
+        constexpr f64 smoothing = 0.1;
+
+        busy_ms += (busy.count() - busy_ms) * smoothing;
+        idle_ms += (idle.count() - idle_ms) * smoothing;
+        wait_ms += (wait.count() - wait_ms) * smoothing;
+    }
+};
+
+// Settings changed from the UI and applied by the render half of a frame, handed over with every frame.
+struct FrameSettings {
+    vk::PresentModeKHR  present_mode            = vk::PresentModeKHR::eFifo;
+    i32                 max_frames_in_flight    = 2;
+    bool                use_memcpy              = false;
+    bool                use_async_compute       = false;
+    bool                use_submission_thread   = false;
+    bool                use_graphics_path       = false;
+    bool                use_indirect_draws      = false;
+    bool                use_draw_batching       = false;
+    bool                use_parallel_encoding   = false;
+    bool                use_occlusion_culling   = false;
+    i32                 partial_submit_lists    = 0;    // draw lists per early graphics submit, 0 submits the frame at once
+    bool                use_dynamic_resolution  = false;
+    f32                 rasterizer_budget_ms    = 4.0F; // GPU time dynamic resolution keeps the rasterizer under
+    bool                screenshot_requested    = false;
+    ImVec2              white_pixel             = {};   // of the font atlas, the render thread must not read ImGui's IO
+};
+
+// Results of the render half shown in the UI, copied back so the UI never reads state the render thread is writing.
+struct RenderStats {
+    f64                                         cpu_latency_ms                  = 0.0;
+    f64                                         frame_interval_ms               = 0.0;
+    std::array<u32, RASTERIZER_VARIANT_COUNT>   rasterizer_variant_dispatches   = {};
+    bool                                        screenshot_pending              = false;
+    u32                                         graphics_draw_calls             = 0;
+    u32                                         draw_commands_in                = 0;    // before batching, same as out without it
+    u32                                         draw_commands_out               = 0;
+    u32                                         rasterizer_pipeline_binds       = 0;
+    u32                                         rasterizer_barriers             = 0;    // between overlapping dispatches
+    u32                                         rasterizer_encode_tasks         = 0;    // secondary command buffers, 0 when serial
+    f64                                         rasterizer_encode_ms            = 0.0;  // exponential moving average
+    u32                                         graphics_submits                = 0;    // of the last frame
+    u32                                         occluders                       = 0;
+    u32                                         occluded_dispatches             = 0;
+    u32                                         trimmed_dispatches              = 0;
+    f64                                         rasterizer_gpu_ms               = 0.0;  // exponential moving average
+    f32                                         resolution_scale                = 1.0F;
+    u32                                         full_resolution_lists           = 0;    // kept out of the scaling
+    usize                                       cached_bind_groups              = 0;
+    u32                                         bindless_textures               = 0;
+    usize                                       graphics_pipeline_states        = 0;
+    usize                                       compute_pipeline_states         = 0;
+    u64                                         bind_group_cache_misses         = 0;
+    FrameGraphStats                             frame_graph                     = {};
+    FrameGraphStats                             compute_frame_graph             = {};   // async compute only
+    ThreadTimings                               render_thread                   = {};
+};
+
+// One frame handed from the UI thread to the render thread, the render thread writes its stats back into it when done.
+struct FramePacket {
+    DrawDataSnapshot    snapshot    = {};
+    FrameSettings       settings    = {};
+    Clock::time_point   input_time  = {};
+    RenderStats         stats       = {};
+};
+
+// The render thread encodes and presents frame N while the UI thread builds frame N+1.
+constexpr usize FRAME_PACKET_COUNT = 2;
+
 struct float2 {
     float x, y;
 };
@@ -34,17 +191,67 @@ struct App {
     WindowPlatform*             platform;
     VulkanRenderer*             vulkan;
     ImGuiRenderer*              imgui;
-
-    vk::DescriptorSetLayout     compute_bind_group_layout;
-    GpuComputePipelineState     compute_pipeline_state;
-    vk::DescriptorSetLayout     graphics_bind_group_layout;
-    GpuGraphicsPipelineState    graphics_pipeline_state;
-
-    GpuTexture                  color_texture;
-
-    bool use_memcpy = false;
-
-    App() {
+    ReadbackService*            readbacks;
+    FrameGraphTransientPool*    transients;
+    ParallelEncoder*            encoder;
+
+    std::array<GpuComputePipelineState, RASTERIZER_VARIANT_COUNT>  rasterizer_pipeline_states;
+    GpuGraphicsPipelineState                                        graphics_pipeline_state;
+    GpuComputePipelineState                                         upscale_pipeline_state;
+
+    std::array<RasterizerTarget, RASTERIZER_TARGET_COUNT>   rasterizer_targets;
+    usize                                                   rasterizer_target_index = 0;
+    vk::Sampler                                             rasterizer_sampler;
+    vk::Sampler                                             rasterizer_upscale_sampler;
+
+    // two timestamps per frame slot around the rasterizer passes, read once the slot comes back
+    vk::QueryPool                           rasterizer_query_pool;
+    std::array<bool, MAX_FRAMES_IN_FLIGHT>  rasterizer_queries_written = {};
+    f64                                     timestamp_period_ms = 0.0;
+    u64                                     timestamp_mask = 0;
+
+    vk::Extent2D                rasterizer_workgroup_size = { 16, 16 };
+    bool                        rasterizer_use_subgroups = false;
+
+    // owned by the UI thread
+    FrameSettings       frame_settings          = {};
+    RenderStats         displayed_stats         = {};
+    ThreadTimings       main_thread_timings     = {};
+    bool                use_just_in_time        = false;
+    bool                use_render_thread       = false;
+    bool                use_sharp_stats_window  = true;
+    f64                 just_in_time_sleep_ms   = 0.0;
+
+    // on-demand rendering, see WaitForRedraw
+    bool                use_on_demand_rendering = false;
+    i32                 trailing_frames         = 3;
+    f32                 idle_refresh_seconds    = 1.0F;
+    i32                 frames_until_idle       = 0;
+    u64                 seen_event_count        = 0;
+    Clock::time_point   redraw_deadline         = Clock::time_point::max();
+    Clock::time_point   last_frame_time         = {};
+    f64                 on_demand_sleep_ms      = 0.0;
+    std::atomic<bool>   redraw_requested        = false;   // set from any thread by Invalidate
+
+    // owned by whichever thread renders, see RenderFrame
+    FrameSettings       render_settings         = {};
+    RenderStats         render_stats            = {};
+    Clock::time_point   last_present_time       = {};
+    DrawBatcher         draw_batcher            = {};
+    OcclusionCuller     occlusion_culler        = {};
+    DynamicResolution   dynamic_resolution      = {};
+    f64                 rasterizer_encode_frame_ms = 0.0;
+
+    std::thread                                     render_thread;
+    std::exception_ptr                              render_thread_error;
+    SpscQueue<FramePacket, FRAME_PACKET_COUNT>      frame_packets;
+
+    // screenshots are requested at the end of a frame and written once the GPU has finished it
+    bool                                screenshot_requested    = false;
+    std::optional<ReadbackTicket>       screenshot_ticket       = {};
+    u32                                 screenshot_count        = 0;
+
+    explicit App(bool tune_rasterizer) {
 //        glfwInitVulkanLoader(vulkan->loader.getProcAddress<PFN_vkGetInstanceProcAddr>("vkGetInstanceProcAddr"));
         platform = new WindowPlatform("Vulkan window", 800, 600);
         vulkan = new VulkanRenderer(platform);
@@ -53,38 +260,489 @@ struct App {
         ImGui_ImplGlfw_InitForVulkan(static_cast<GLFWwindow*>(platform->GetNativeWindow()), true);
 
         imgui = new ImGuiRenderer(vulkan);
+        readbacks = new ReadbackService(vulkan);
+        transients = new FrameGraphTransientPool(vulkan);
+        encoder = new ParallelEncoder(vulkan);
+
+        auto& subgroup_properties = vulkan->context.subgroup_properties;
+        rasterizer_use_subgroups = (subgroup_properties.supportedStages & vk::ShaderStageFlagBits::eCompute)
+            && (subgroup_properties.supportedOperations & vk::SubgroupFeatureFlagBits::eBasic)
+            && (subgroup_properties.supportedOperations & vk::SubgroupFeatureFlagBits::eBallot)
+            && (subgroup_properties.supportedOperations & vk::SubgroupFeatureFlagBits::eVote);
+
+        frame_settings.present_mode = vulkan->configuration.present_mode;
+        frame_settings.max_frames_in_flight = vulkan->max_frames_in_flight;
+        frame_settings.use_async_compute = vulkan->async_compute_supported;
+        render_settings = frame_settings;
 
         CreateRenderTargets();
+        CreateRasterizerQueries();
+        ConfigureRasterizerWorkgroupSize(tune_rasterizer);
         CreateComputePipelineState();
         CreateGraphicsPipelineState();
+        CreateUpscalePipelineState();
     }
 
     ~App() {
-        vulkan->CleanupTexture(&color_texture);
+        for (auto& target : rasterizer_targets) {
+            vulkan->CleanupTexture(&target.texture);
+        }
+        vulkan->context.logical_device.destroySampler(rasterizer_sampler);
+        vulkan->context.logical_device.destroySampler(rasterizer_upscale_sampler);
+        if (rasterizer_query_pool) {
+            vulkan->context.logical_device.destroyQueryPool(rasterizer_query_pool);
+        }
 
-        gpu_destroy_compute_pipeline_state(&vulkan->context, &compute_pipeline_state);
+        for (auto& state : rasterizer_pipeline_states) {
+            gpu_destroy_compute_pipeline_state(&vulkan->context, &state);
+        }
         gpu_destroy_graphics_pipeline_state(&vulkan->context, &graphics_pipeline_state);
-        vulkan->context.logical_device.destroyDescriptorSetLayout(compute_bind_group_layout);
-        vulkan->context.logical_device.destroyDescriptorSetLayout(graphics_bind_group_layout);
+        gpu_destroy_compute_pipeline_state(&vulkan->context, &upscale_pipeline_state);
 
+        encoder->release();
+        transients->release();
+        readbacks->release();
         imgui->release();
         vulkan->release();
         platform->release();
     }
 
     void Start() {
-        while (PumpEvents()) {
-            Update();
+        while (true) {
+            if (use_render_thread != render_thread.joinable()) {
+                if (use_render_thread) {
+                    StartRenderThread();
+                } else {
+                    StopRenderThread();
+                }
+            }
+
+            auto running = render_thread.joinable() ? RunPipelinedFrame() : RunSerialFrame();
+            if (!running) {
+                break;
+            }
+        }
+
+        StopRenderThread();
+        vulkan->WaitIdle();
+    }
+
+    // Asks for a frame from any thread, for changes the UI does not see as input, like new data to show.
+    void Invalidate() {
+        redraw_requested.store(true, std::memory_order_release);
+        platform->PostEmptyEvent();
+    }
+
+    // Asks for a frame after delay at the latest, from the UI thread. Animations call it with no delay every frame.
+    void RequestRedraw(Clock::duration delay = {}) {
+        redraw_deadline = std::min(redraw_deadline, Clock::now() + delay);
+    }
+
+    // Input, UI and rendering of one frame back to back on the main thread.
+    auto RunSerialFrame() -> bool {
+        auto frame_start = Clock::now();
+        auto idle = WaitForRedraw();
+
+        // wait for a free frame before sampling input, not after
+        auto wait_start = Clock::now();
+        vulkan->WaitForFrameSlot();
+        auto wait = Milliseconds(Clock::now() - wait_start);
+
+        if (use_just_in_time) {
+            auto sleep_start = Clock::now();
+            WaitJustInTime();
+            idle += Clock::now() - sleep_start;
+        }
+
+        auto input_time = Clock::now();
+        if (!PumpEvents()) {
+            return false;
+        }
+        Update();
+
+        wait += RenderFrame(ImGui::GetDrawData(), frame_settings, input_time);
+        frame_settings.screenshot_requested = false;
+        displayed_stats = render_stats;
+        EndFrameOnDemand();
+
+        idle += WaitWhileMinimized();
+        main_thread_timings.Accumulate(Milliseconds(Clock::now() - frame_start) - idle - wait, idle, wait);
+        return true;
+    }
+
+    // UI half of a frame on the main thread, the render thread picks the snapshot up from frame_packets.
+    auto RunPipelinedFrame() -> bool {
+        auto frame_start = Clock::now();
+        auto idle = WaitForRedraw();
+
+        auto write_start = Clock::now();
+        auto packet = frame_packets.BeginWrite();
+        idle += Clock::now() - write_start;
+        if (packet == nullptr) {
+            // closed from the render thread, StopRenderThread rethrows what stopped it
+            StopRenderThread();
+            return true;
+        }
+        displayed_stats = packet->stats;
+
+        packet->input_time = Clock::now();
+        if (!PumpEvents()) {
+            return false;
+        }
+        Update();
+
+        packet->snapshot.Capture(ImGui::GetDrawData());
+        packet->settings = frame_settings;
+        frame_settings.screenshot_requested = false;
+        frame_packets.EndWrite();
+        EndFrameOnDemand();
+
+        idle += WaitWhileMinimized();
+        main_thread_timings.Accumulate(Milliseconds(Clock::now() - frame_start) - idle, idle, Milliseconds(0.0));
+        return true;
+    }
+
+    void StartRenderThread() {
+        frame_packets.Reopen();
+        render_thread = std::thread([this] {
+            try {
+                RenderThreadMain();
+            } catch (...) {
+                render_thread_error = std::current_exception();
+                frame_packets.Close();
+            }
+        });
+    }
+
+    void StopRenderThread() {
+        if (render_thread.joinable()) {
+            frame_packets.Close();
+            render_thread.join();
+        }
+        use_render_thread = false;
+
+        if (render_thread_error) {
+            std::rethrow_exception(std::exchange(render_thread_error, nullptr));
+        }
+    }
+
+    void RenderThreadMain() {
+        while (true) {
+            auto idle_start = Clock::now();
+            auto packet = frame_packets.BeginRead();
+            if (packet == nullptr) {
+                break;
+            }
+
+            auto frame_start = Clock::now();
+            auto wait = RenderFrame(packet->snapshot.GetDrawData(), packet->settings, packet->input_time);
+            auto frame_end = Clock::now();
+
+            render_stats.render_thread.Accumulate(Milliseconds(frame_end - frame_start) - wait, frame_start - idle_start, wait);
+            packet->stats = render_stats;
+            frame_packets.EndRead();
+        }
+    }
+
+    // Render half of a frame, returns the time spent blocked on the GPU and presentation.
+    auto RenderFrame(ImDrawData* draw_data, const FrameSettings& settings, Clock::time_point input_time) -> Milliseconds {
+        ApplyFrameSettings(settings);
+
+        auto wait_start = Clock::now();
+        vulkan->WaitForFrameSlot();
+        auto wait = Milliseconds(Clock::now() - wait_start);
+
+        if (!vulkan->WaitAndBeginNewFrame()) {
+            return wait;
+        }
+
+        UpdateDynamicResolution();
+        BatchDrawData(&draw_data);
+
+        auto graph = FrameGraph(vulkan, transients, vulkan->context.graphics_queue_family_index);
+        auto composite = !render_settings.use_graphics_path;
+
+        FrameGraphImage target;
+        render_stats.compute_frame_graph = {};
+        if (composite && render_settings.use_async_compute) {
+            target = EncodeAsyncRasterizer(&graph, draw_data);
+        } else {
+            // on the graphics path nothing reads the target, so the graph culls the rasterizer passes
+            target = graph.CreateImage(GetRasterizerTargetDesc(vulkan->configuration.extent));
+            AddRasterizerPasses(&graph, target, draw_data);
+        }
+        AddSwapchainPass(&graph, draw_data, composite ? std::optional(target) : std::nullopt);
+        if (composite) {
+            AddScreenshotPass(&graph, target);
+        }
+        graph.Execute(vulkan->current_command_buffer);
+        render_stats.frame_graph = graph.GetStats();
+        render_stats.graphics_submits = vulkan->partial_submit_count + 1;
+
+        wait_start = Clock::now();
+        vulkan->SubmitFrameAndPresent();
+        wait += Clock::now() - wait_start;
+
+        UpdateLatencyStats(input_time, Clock::now());
+        PollScreenshot();
+        render_stats.screenshot_pending = screenshot_requested || screenshot_ticket.has_value();
+        render_stats.cached_bind_groups = vulkan->bind_groups->GetSize();
+        render_stats.bind_group_cache_misses = vulkan->bind_groups->miss_count;
+        render_stats.bindless_textures = vulkan->textures->GetRegisteredCount();
+        render_stats.graphics_pipeline_states = vulkan->context.graphics_pipeline_cache.size();
+        render_stats.compute_pipeline_states = vulkan->context.compute_pipeline_cache.size();
+        return wait;
+    }
+
+    // Replaces draw_data with the batched copy when batching is enabled, both encoders then see the merged commands.
+    void BatchDrawData(ImDrawData** draw_data) {
+        if (render_settings.use_draw_batching) {
+            *draw_data = draw_batcher.Build(*draw_data);
+            render_stats.draw_commands_in = draw_batcher.GetInputCommandCount();
+            render_stats.draw_commands_out = draw_batcher.GetOutputCommandCount();
+            return;
+        }
+
+        u32 command_count = 0;
+        for (auto cmd_list : std::span((*draw_data)->CmdLists, (*draw_data)->CmdListsCount)) {
+            for (auto& draw_cmd : std::span(cmd_list->CmdBuffer.Data, cmd_list->CmdBuffer.Size)) {
+                command_count += draw_cmd.UserCallback == nullptr ? 1 : 0;
+            }
+        }
+        render_stats.draw_commands_in = command_count;
+        render_stats.draw_commands_out = command_count;
+    }
+
+    // Swapchain changes happen here, between frames on the rendering thread, instead of from inside the UI code.
+    void ApplyFrameSettings(const FrameSettings& settings) {
+        if (settings.present_mode != vulkan->configuration.present_mode) {
+            vulkan->SetPresentMode(settings.present_mode);
+        }
+        if (settings.max_frames_in_flight != vulkan->max_frames_in_flight) {
+            vulkan->SetMaxFramesInFlight(settings.max_frames_in_flight);
+        }
+        if (settings.use_submission_thread != vulkan->submissions->IsRunning()) {
+            vulkan->SetSubmissionThreadEnabled(settings.use_submission_thread);
+        }
+        if (settings.screenshot_requested) {
+            screenshot_requested = true;
+        }
+        render_settings = settings;
+    }
+
+    // Nothing is presented while minimized, sleeps until the window changes and returns the time slept.
+    auto WaitWhileMinimized() -> Milliseconds {
+        auto framebuffer_size = platform->GetFramebufferSize();
+        if (framebuffer_size.width != 0 && framebuffer_size.height != 0) {
+            return Milliseconds(0.0);
+        }
+
+        auto sleep_start = Clock::now();
+        platform->WaitEvents();
+        return Clock::now() - sleep_start;
+    }
+
+    // With on-demand rendering, sleeps in the event loop once the trailing frames after the last reason to draw have run
+    // out, until the next one: input or window events, Invalidate, a due RequestRedraw or the idle refresh interval. Events
+    // handled while waiting are already queued for ImGui. Returns the time slept.
+    auto WaitForRedraw() -> Milliseconds {
+        on_demand_sleep_ms = 0.0;
+        if (!use_on_demand_rendering || frames_until_idle > 0) {
+            return Milliseconds(0.0);
+        }
+
+        auto sleep_start = Clock::now();
+        while (!ConsumeRedrawReasons()) {
+            auto refresh = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<f64>(idle_refresh_seconds));
+            auto deadline = std::min(redraw_deadline, last_frame_time + refresh);
+            auto timeout = std::chrono::duration<f64>(deadline - Clock::now()).count();
+            if (timeout > 0.0) {
+                platform->WaitEventsTimeout(timeout);
+            }
+        }
+        auto slept = Milliseconds(Clock::now() - sleep_start);
+        on_demand_sleep_ms = slept.count();
+        return slept;
+    }
+
+    // Events and invalidations restart the trailing frames, which let ImGui settle what it animates on its own, like hover
+    // and active highlights, scrolling and window sizes. A due RequestRedraw or the idle refresh only draws one frame, an
+    // animation asks again while it runs.
+    auto ConsumeRedrawReasons() -> bool {
+        auto now = Clock::now();
+        auto event_count = platform->GetEventCount();
+        auto has_events = event_count != seen_event_count;
+        auto invalidated = redraw_requested.exchange(false, std::memory_order_acquire);
+        seen_event_count = event_count;
+
+        if (has_events || invalidated) {
+            frames_until_idle = trailing_frames + 1;
+            return true;
+        }
+        auto refresh = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<f64>(idle_refresh_seconds));
+        if (now >= redraw_deadline || now >= last_frame_time + refresh) {
+            frames_until_idle = std::max(frames_until_idle, 1);
+            redraw_deadline = Clock::time_point::max();
+            return true;
+        }
+        return false;
+    }
+
+    // Counts the frame against the trailing frames, events it handled and requests made while building it start them over.
+    void EndFrameOnDemand() {
+        last_frame_time = Clock::now();
+        frames_until_idle = std::max(frames_until_idle - 1, 0);
+        ConsumeRedrawReasons();
+    }
 
-            vulkan->WaitAndBeginNewFrame();
+    // Sleeps until just before the next frame is due, so input is sampled as late as the deadline allows.
+    void WaitJustInTime() {
+        just_in_time_sleep_ms = 0.0;
 
-            EncodeRasterizer(vulkan->current_command_buffer);
-            EncodeSwapchain(vulkan->current_command_buffer);
+        // only predictable once the GPU has drained, otherwise the previous frame sets the pace anyway
+        vulkan->WaitForFrameValue(vulkan->current_frame_value - 1);
 
-            vulkan->SubmitFrameAndPresent();
+        auto budget = Milliseconds(render_stats.frame_interval_ms - render_stats.cpu_latency_ms - JUST_IN_TIME_MARGIN_MS);
+        auto deadline = last_present_time + std::chrono::duration_cast<Clock::duration>(budget);
+        auto now = Clock::now();
+        if (deadline > now) {
+            just_in_time_sleep_ms = Milliseconds(deadline - now).count();
+            std::this_thread::sleep_until(deadline);
         }
+    }
 
-        vulkan->context.logical_device.waitIdle();
+    // Reads the rasterizer target back once the frame has finished, when a screenshot is waiting for a free readback slot.
+    void AddScreenshotPass(FrameGraph* graph, FrameGraphImage target) {
+        if (!screenshot_requested || screenshot_ticket) {
+            return;
+        }
+
+        auto pass = graph->AddPass("Screenshot", [this, graph, target](GpuCommandBuffer* command_buffer) {
+            RequestScreenshot(command_buffer, graph->GetTexture(target));
+        }, true);
+        graph->Read(pass, target, FrameGraphUsage::eComputeStorage);
+    }
+
+    void RequestScreenshot(GpuCommandBuffer* command_buffer, GpuTexture* target) {
+        auto rect = vk::Rect2D(
+            vk::Offset2D(0, 0),
+            vk::Extent2D(
+                std::min(vulkan->configuration.extent.width, target->extent.width),
+                std::min(vulkan->configuration.extent.height, target->extent.height)));
+
+        // retried next frame when every readback slot is still busy
+        screenshot_ticket = readbacks->RequestConvertedReadback(
+            command_buffer,
+            target,
+            vk::ImageLayout::eGeneral,
+            vk::PipelineStageFlagBits2::eComputeShader,
+            rect);
+        if (screenshot_ticket) {
+            screenshot_requested = false;
+        }
+    }
+
+    void PollScreenshot() {
+        if (!screenshot_ticket) {
+            return;
+        }
+
+        auto result = readbacks->GetResult(*screenshot_ticket);
+        if (!result) {
+            return;
+        }
+
+        auto filename = "screenshot_" + std::to_string(screenshot_count++) + ".ppm";
+        auto file = std::ofstream(filename, std::ios::binary);
+        file << "P6\n" << result->extent.width << " " << result->extent.height << "\n255\n";
+        for (usize i = 0, count = static_cast<usize>(result->extent.width) * result->extent.height; i < count; ++i) {
+            file.write(reinterpret_cast<const char*>(result->pixels + i * result->texel_size), 3);
+        }
+
+        readbacks->Release(*screenshot_ticket);
+        screenshot_ticket.reset();
+    }
+
+    void UpdateLatencyStats(Clock::time_point input_time, Clock::time_point present_time) {
+        constexpr f64 smoothing = 0.1;
+
+        auto latency = Milliseconds(present_time - input_time).count();
+        render_stats.cpu_latency_ms += (latency - render_stats.cpu_latency_ms) * smoothing;
+
+        if (last_present_time != Clock::time_point{}) {
+            auto interval = Milliseconds(present_time - last_present_time).count();
+            render_stats.frame_interval_ms += (interval - render_stats.frame_interval_ms) * smoothing;
+        }
+        last_present_time = present_time;
+    }
+
+    void UpdatePresentationSettings() {
+        auto present_modes = std::array{
+            vk::PresentModeKHR::eFifo,
+            vk::PresentModeKHR::eFifoRelaxed,
+            vk::PresentModeKHR::eMailbox,
+            vk::PresentModeKHR::eImmediate,
+        };
+
+        // applied by ApplyFrameSettings on the rendering thread
+        if (ImGui::BeginCombo("Present mode", vk::to_string(frame_settings.present_mode).c_str())) {
+            for (auto present_mode : present_modes) {
+                if (!vulkan->IsPresentModeSupported(present_mode)) {
+                    continue;
+                }
+                if (ImGui::Selectable(vk::to_string(present_mode).c_str(), present_mode == frame_settings.present_mode)) {
+                    frame_settings.present_mode = present_mode;
+                }
+            }
+            ImGui::EndCombo();
+        }
+
+        ImGui::SliderInt("Frames in flight", &frame_settings.max_frames_in_flight, 1, MAX_FRAMES_IN_FLIGHT);
+
+        ImGui::Checkbox("On-demand rendering", &use_on_demand_rendering);
+        if (use_on_demand_rendering) {
+            ImGui::SliderInt("Trailing frames", &trailing_frames, 0, 30);
+            ImGui::SliderFloat("Idle refresh (s)", &idle_refresh_seconds, 0.1F, 10.0F);
+            ImGui::Text("On-demand sleep %.3f ms before this frame", on_demand_sleep_ms);
+        }
+
+        ImGui::Checkbox("Render thread", &use_render_thread);
+        ImGui::Checkbox("Submission thread", &frame_settings.use_submission_thread);
+        if (use_render_thread) {
+            ImGui::Text("Just-in-time input: serial mode only");
+        } else {
+            ImGui::Checkbox("Just-in-time input", &use_just_in_time);
+        }
+        ImGui::Text("CPU latency %.3f ms (input to present), frame interval %.3f ms", displayed_stats.cpu_latency_ms, displayed_stats.frame_interval_ms);
+        if (use_just_in_time && !use_render_thread) {
+            ImGui::Text("Just-in-time sleep %.3f ms", just_in_time_sleep_ms);
+        }
+
+        // idle is time spent waiting for the other thread, wait is time blocked on the GPU or presentation
+        ImGui::Text("Main thread: busy %.3f ms, idle %.3f ms, wait %.3f ms", main_thread_timings.busy_ms, main_thread_timings.idle_ms, main_thread_timings.wait_ms);
+        if (use_render_thread) {
+            auto& timings = displayed_stats.render_thread;
+            ImGui::Text("Render thread: busy %.3f ms, idle %.3f ms, wait %.3f ms", timings.busy_ms, timings.idle_ms, timings.wait_ms);
+        }
+
+        auto submissions = vulkan->submissions;
+        ImGui::Text("Submit %.3f ms, present %.3f ms", submissions->submit_time_ms.load(), submissions->present_time_ms.load());
+        if (frame_settings.use_submission_thread) {
+            ImGui::Text("Submission queue depth %zu (max %zu), %llu submits, %llu presents",
+                submissions->GetQueueDepth(),
+                submissions->max_queue_depth.load(),
+                static_cast<unsigned long long>(submissions->submitted_count.load()),
+                static_cast<unsigned long long>(submissions->presented_count.load()));
+        }
+    }
+
+    void UpdateFrameGraphStats(const char* label, const FrameGraphStats& stats) {
+        ImGui::Text("%s: %u passes (%u culled), %u barriers in %u batches", label, stats.pass_count, stats.culled_pass_count, stats.barrier_count, stats.barrier_batch_count);
+        if (stats.transient_image_count != 0) {
+            ImGui::Text("%s: %u transients in %.1f MiB, %.1f MiB aliased", label, stats.transient_image_count,
+                static_cast<f64>(stats.transient_memory_size) / (1024.0 * 1024.0),
+                static_cast<f64>(stats.aliased_memory_size) / (1024.0 * 1024.0));
+        }
     }
 
     void Update() {
@@ -94,10 +752,101 @@ struct App {
         ImGui::NewFrame();
 
         ImGui::Begin("Stats");
+        if (use_sharp_stats_window) {
+            // text is what blurs first when upscaled
+            ImGui::GetWindowDrawList()->AddCallback(ImDrawCallback_FullResolution, nullptr);
+        }
         ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
-        ImGui::Checkbox("Use memcpy", &use_memcpy);
+        ImGui::Checkbox("Use memcpy", &frame_settings.use_memcpy);
+        ImGui::Checkbox("Graphics pipeline", &frame_settings.use_graphics_path);
+        ImGui::Checkbox("Draw batching", &frame_settings.use_draw_batching);
+        ImGui::Text("Draw commands %u -> %u", displayed_stats.draw_commands_in, displayed_stats.draw_commands_out);
+        if (frame_settings.use_graphics_path) {
+            if (imgui->IsIndirectSupported()) {
+                ImGui::Checkbox("Indirect draws", &frame_settings.use_indirect_draws);
+            } else {
+                ImGui::Text("Indirect draws: no multi-draw indirect support");
+            }
+            ImGui::Text("Graphics draw calls %u", displayed_stats.graphics_draw_calls);
+        }
+        ImGui::Text("Bindless textures %u/%u", displayed_stats.bindless_textures, GPU_BINDLESS_DESCRIPTOR_COUNT);
+        ImGui::Text("Cached bind groups %zu, %llu misses", displayed_stats.cached_bind_groups, static_cast<unsigned long long>(displayed_stats.bind_group_cache_misses));
+        UpdateFrameGraphStats("Frame graph", displayed_stats.frame_graph);
+        if (displayed_stats.compute_frame_graph.pass_count != 0) {
+            UpdateFrameGraphStats("Compute frame graph", displayed_stats.compute_frame_graph);
+        }
+        if (ImGui::Button("Screenshot")) {
+            frame_settings.screenshot_requested = true;
+        }
+        if (frame_settings.screenshot_requested || displayed_stats.screenshot_pending) {
+            ImGui::SameLine();
+            ImGui::Text("pending");
+        }
+        UpdatePresentationSettings();
+        if (vulkan->async_compute_supported) {
+            ImGui::Checkbox("Async compute", &frame_settings.use_async_compute);
+        } else {
+            ImGui::Text("Async compute: no dedicated compute queue");
+        }
+        ImGui::Text("Rasterizer workgroup %ux%u", rasterizer_workgroup_size.width, rasterizer_workgroup_size.height);
+        if (rasterizer_use_subgroups) {
+            ImGui::Text("Rasterizer kernel: subgroup (size %u)", vulkan->context.subgroup_properties.subgroupSize);
+        } else {
+            ImGui::Text("Rasterizer kernel: scalar");
+        }
+        ImGui::Text("Pipeline cache: %zu graphics, %zu compute", displayed_stats.graphics_pipeline_states, displayed_stats.compute_pipeline_states);
+        if (!frame_settings.use_graphics_path) {
+            u32 dispatch_count = 0;
+            for (auto count : displayed_stats.rasterizer_variant_dispatches) {
+                dispatch_count += count;
+            }
+            ImGui::Text("Rasterizer dispatches %u, pipeline binds %u, barriers %u", dispatch_count, displayed_stats.rasterizer_pipeline_binds, displayed_stats.rasterizer_barriers);
+            ImGui::Checkbox("Parallel encoding", &frame_settings.use_parallel_encoding);
+            ImGui::SameLine();
+            ImGui::Text("(%u threads)", encoder->GetThreadCount());
+            ImGui::Text("Rasterizer encoding %.3f ms, %u secondary command buffers", displayed_stats.rasterizer_encode_ms, displayed_stats.rasterizer_encode_tasks);
+            ImGui::Checkbox("Occlusion culling", &frame_settings.use_occlusion_culling);
+            if (frame_settings.use_occlusion_culling) {
+                ImGui::Text("%u occluders, %u dispatches culled, %u trimmed", displayed_stats.occluders, displayed_stats.occluded_dispatches, displayed_stats.trimmed_dispatches);
+            }
+            if (rasterizer_query_pool) {
+                ImGui::Checkbox("Dynamic resolution", &frame_settings.use_dynamic_resolution);
+                ImGui::SliderFloat("Rasterizer budget (ms)", &frame_settings.rasterizer_budget_ms, 0.5F, 16.0F);
+                ImGui::Checkbox("Keep this window at full resolution", &use_sharp_stats_window);
+                ImGui::Text("Rasterizer GPU %.3f ms at %.1f%% scale, %u lists at full resolution", displayed_stats.rasterizer_gpu_ms, displayed_stats.resolution_scale * 100.0F, displayed_stats.full_resolution_lists);
+            } else {
+                ImGui::Text("Dynamic resolution: no timestamp queries");
+            }
+            if (frame_settings.use_async_compute) {
+                ImGui::Text("Partial submits: graphics queue only");
+            } else {
+                ImGui::SliderInt("Submit every N draw lists", &frame_settings.partial_submit_lists, 0, 32);
+                ImGui::Text("%u graphics submits per frame", displayed_stats.graphics_submits);
+            }
+        }
+        if (ImGui::TreeNode("Rasterizer variants")) {
+            for (u32 variant = 0; variant < RASTERIZER_VARIANT_COUNT; ++variant) {
+                ImGui::Text("%s %s %s: %u dispatches",
+                    variant & eRasterizerTextured ? "textured" : "solid   ",
+                    variant & eRasterizerClipped ? "clipped  " : "unclipped",
+                    variant & eRasterizerBlended ? "blended" : "opaque ",
+                    displayed_stats.rasterizer_variant_dispatches[variant]);
+            }
+            ImGui::TreePop();
+        }
         ImGui::End();
         ImGui::ShowDemoWindow(nullptr);
+
+        auto& io = ImGui::GetIO();
+        frame_settings.white_pixel = io.Fonts->TexUvWhitePixel;
+
+        // what changes on screen without input, for on-demand rendering
+        if (io.WantTextInput && io.ConfigInputTextCursorBlink) {
+            RequestRedraw(std::chrono::duration_cast<Clock::duration>(Milliseconds(TEXT_CURSOR_REDRAW_MS)));
+        }
+        if (frame_settings.screenshot_requested || displayed_stats.screenshot_pending) {
+            RequestRedraw();
+        }
         ImGui::Render();
     }
 
@@ -119,76 +868,343 @@ struct App {
 //        return true;
     }
 
-    void EncodeRasterizer(GpuCommandBuffer* command_buffer) {
-        auto draw_data = ImGui::GetDrawData();
-
-        // change image layout to General
-        {
-            auto barriers = std::array{
-                vk::ImageMemoryBarrier2()
-                    .setSrcStageMask(vk::PipelineStageFlagBits2::eTopOfPipe)
-                    .setDstStageMask(vk::PipelineStageFlagBits2::eComputeShader)
-                    .setSrcAccessMask(vk::AccessFlagBits2{})
-                    .setDstAccessMask(vk::AccessFlagBits2::eShaderWrite)
-                    .setOldLayout(vk::ImageLayout::eUndefined)
-                    .setNewLayout(vk::ImageLayout::eGeneral)
-                    .setImage(color_texture.image)
-                    .setSubresourceRange(vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1)),
-            };
+    // Rasterizes draw_data into target, on the queue the graph records for.
+    //
+    // Below full scale with dynamic resolution, the lists before the first one marked with ImDrawCallback_FullResolution go
+    // into a smaller transient image, which a filtered compute pass then stretches over target. The marked list and the
+    // ones after it are drawn on top at full resolution, which keeps the draw order.
+    void AddRasterizerPasses(FrameGraph* graph, FrameGraphImage target, ImDrawData* draw_data) {
+        auto cmd_lists = std::span(draw_data->CmdLists, static_cast<usize>(draw_data->CmdListsCount));
+        auto scale = render_settings.use_dynamic_resolution ? dynamic_resolution.GetScale() : 1.0F;
+        auto scaled_list_count = scale < 1.0F ? FindFullResolutionList(cmd_lists) : 0;
+        render_stats.full_resolution_lists = scale < 1.0F ? static_cast<u32>(cmd_lists.size() - scaled_list_count) : 0;
+
+        if (scaled_list_count == 0) {
+            AddRasterizerClearPass(graph, target);
+
+            // blending reads what earlier triangles wrote
+            auto rasterizer_pass = graph->AddPass("Rasterizer", [this, graph, target, draw_data, cmd_lists](GpuCommandBuffer* command_buffer) {
+                EncodeRasterizer(command_buffer, draw_data, cmd_lists, graph->GetTexture(target), ImVec2(1.0F, 1.0F));
+                EndRasterizerFrame(command_buffer);
+            });
+            graph->Read(rasterizer_pass, target, FrameGraphUsage::eComputeStorage);
+            graph->Write(rasterizer_pass, target, FrameGraphUsage::eComputeStorage);
+            return;
+        }
 
-            command_buffer->cmd_buffer.pipelineBarrier2(vk::DependencyInfo({}, {}, {}, barriers));
+        auto extent = vk::Extent2D(std::max(vulkan->configuration.extent.width, 1u), std::max(vulkan->configuration.extent.height, 1u));
+        auto scaled_extent = vk::Extent2D(
+            std::max(static_cast<u32>(std::lround(static_cast<f32>(extent.width) * scale)), 1u),
+            std::max(static_cast<u32>(std::lround(static_cast<f32>(extent.height) * scale)), 1u)
+        );
+
+        // what the upscale stretches by, rounding the extent moves it slightly off scale
+        auto render_scale = ImVec2(
+            static_cast<f32>(scaled_extent.width) / static_cast<f32>(extent.width),
+            static_cast<f32>(scaled_extent.height) / static_cast<f32>(extent.height)
+        );
+
+        auto scaled_target = graph->CreateImage(GetRasterizerTargetDesc(scaled_extent));
+        AddRasterizerClearPass(graph, scaled_target);
+
+        auto scaled_lists = cmd_lists.first(scaled_list_count);
+        auto scaled_pass = graph->AddPass("Rasterizer (scaled)", [this, graph, scaled_target, draw_data, scaled_lists, render_scale](GpuCommandBuffer* command_buffer) {
+            EncodeRasterizer(command_buffer, draw_data, scaled_lists, graph->GetTexture(scaled_target), render_scale);
+        });
+        graph->Read(scaled_pass, scaled_target, FrameGraphUsage::eComputeStorage);
+        graph->Write(scaled_pass, scaled_target, FrameGraphUsage::eComputeStorage);
+
+        // covers the whole visible part of target, so target needs no clear
+        auto full_lists = cmd_lists.subspan(scaled_list_count);
+        auto upscale_pass = graph->AddPass("Upscale rasterizer target", [this, graph, scaled_target, target, scaled_extent, extent, last = full_lists.empty()](GpuCommandBuffer* command_buffer) {
+            EncodeUpscale(command_buffer, graph->GetTexture(scaled_target), scaled_extent, graph->GetTexture(target), extent);
+            if (last) {
+                EndRasterizerFrame(command_buffer);
+            }
+        });
+        graph->Read(upscale_pass, scaled_target, FrameGraphUsage::eComputeSampled);
+        graph->Write(upscale_pass, target, FrameGraphUsage::eComputeStorage);
+        if (full_lists.empty()) {
+            return;
         }
 
-        // clear image
-        {
+        auto full_pass = graph->AddPass("Rasterizer (full resolution)", [this, graph, target, draw_data, full_lists](GpuCommandBuffer* command_buffer) {
+            EncodeRasterizer(command_buffer, draw_data, full_lists, graph->GetTexture(target), ImVec2(1.0F, 1.0F));
+            EndRasterizerFrame(command_buffer);
+        });
+        graph->Read(full_pass, target, FrameGraphUsage::eComputeStorage);
+        graph->Write(full_pass, target, FrameGraphUsage::eComputeStorage);
+    }
+
+    // Stretches the top-left scaled_extent of scaled over the top-left extent of target.
+    void EncodeUpscale(GpuCommandBuffer* command_buffer, GpuTexture* scaled, vk::Extent2D scaled_extent, GpuTexture* target, vk::Extent2D extent) {
+        auto target_info = vk::DescriptorImageInfo()
+            .setImageView(target->view)
+            .setImageLayout(vk::ImageLayout::eGeneral);
+
+        auto scaled_info = vk::DescriptorImageInfo()
+            .setSampler(rasterizer_upscale_sampler)
+            .setImageView(scaled->view)
+            .setImageLayout(vk::ImageLayout::eShaderReadOnlyOptimal);
+
+        auto writes = std::array{
+            vk::WriteDescriptorSet()
+                .setDstBinding(0)
+                .setDstArrayElement(0)
+                .setDescriptorType(vk::DescriptorType::eStorageImage)
+                .setDescriptorCount(1)
+                .setPImageInfo(&target_info),
+            vk::WriteDescriptorSet()
+                .setDstBinding(1)
+                .setDstArrayElement(0)
+                .setDescriptorType(vk::DescriptorType::eCombinedImageSampler)
+                .setDescriptorCount(1)
+                .setPImageInfo(&scaled_info),
+        };
+
+        auto scaled_size = ImVec2(static_cast<f32>(scaled->extent.width), static_cast<f32>(scaled->extent.height));
+        auto push_constants = RasterizerUpscalePushConstants{
+            .uv_scale = ImVec2(
+                static_cast<f32>(scaled_extent.width) / static_cast<f32>(extent.width) / scaled_size.x,
+                static_cast<f32>(scaled_extent.height) / static_cast<f32>(extent.height) / scaled_size.y),
+            .uv_max = ImVec2(
+                (static_cast<f32>(scaled_extent.width) - 0.5F) / scaled_size.x,
+                (static_cast<f32>(scaled_extent.height) - 0.5F) / scaled_size.y),
+            .width = extent.width,
+            .height = extent.height,
+        };
+
+        command_buffer->cmd_buffer.bindPipeline(vk::PipelineBindPoint::eCompute, upscale_pipeline_state.pipeline);
+        gpu_command_buffer_push_bind_group(command_buffer, vk::PipelineBindPoint::eCompute, upscale_pipeline_state.pipeline_layout, 0, writes);
+        command_buffer->cmd_buffer.pushConstants(upscale_pipeline_state.pipeline_layout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(push_constants), &push_constants);
+        gpu_dispatch_threads(command_buffer->cmd_buffer, &upscale_pipeline_state, extent.width, extent.height, 1);
+    }
+
+    // The first pass of the rasterizer in a frame, so it also starts the frame's rasterizer stats.
+    void AddRasterizerClearPass(FrameGraph* graph, FrameGraphImage target) {
+        auto clear_pass = graph->AddPass("Clear rasterizer target", [this, graph, target](GpuCommandBuffer* command_buffer) {
+            BeginRasterizerFrame(command_buffer);
+
             auto clear_value = vk::ClearColorValue(std::array{ 0.0f, 0.0f, 0.0f, 1.0f });
             auto subresource = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1);
 
-            command_buffer->cmd_buffer.clearColorImage(color_texture.image, vk::ImageLayout::eGeneral, clear_value, subresource);
+            command_buffer->cmd_buffer.clearColorImage(graph->GetTexture(target)->image, vk::ImageLayout::eTransferDstOptimal, clear_value, subresource);
+        });
+        graph->Write(clear_pass, target, FrameGraphUsage::eTransfer);
+    }
+
+    // Index of the first list marked with ImDrawCallback_FullResolution, or the list count.
+    static auto FindFullResolutionList(std::span<ImDrawList*> cmd_lists) -> usize {
+        for (usize i = 0; i < cmd_lists.size(); ++i) {
+            for (auto& draw_cmd : std::span(cmd_lists[i]->CmdBuffer.Data, cmd_lists[i]->CmdBuffer.Size)) {
+                if (draw_cmd.UserCallback == ImDrawCallback_FullResolution) {
+                    return i;
+                }
+            }
         }
+        return cmd_lists.size();
+    }
 
-        auto bind_group = gpu_command_buffer_allocate_bind_group(&vulkan->context, command_buffer, compute_bind_group_layout);
-        {
-            auto color_image_info = vk::DescriptorImageInfo()
-                .setImageView(color_texture.view)
-                .setImageLayout(vk::ImageLayout::eGeneral);
+    // The passes of a frame add their counts to the rasterizer stats in between, see EncodeRasterizer.
+    void BeginRasterizerFrame(GpuCommandBuffer* command_buffer) {
+        render_stats.rasterizer_variant_dispatches.fill(0);
+        render_stats.rasterizer_pipeline_binds = 0;
+        render_stats.rasterizer_barriers = 0;
+        render_stats.rasterizer_encode_tasks = 0;
+        render_stats.occluders = 0;
+        render_stats.occluded_dispatches = 0;
+        render_stats.trimmed_dispatches = 0;
+        rasterizer_encode_frame_ms = 0.0;
+
+        if (rasterizer_query_pool) {
+            auto first_query = vulkan->current_frame_index * 2;
+            command_buffer->cmd_buffer.resetQueryPool(rasterizer_query_pool, first_query, 2);
+            command_buffer->cmd_buffer.writeTimestamp2(vk::PipelineStageFlagBits2::eAllCommands, rasterizer_query_pool, first_query);
+            rasterizer_queries_written[vulkan->current_frame_index] = true;
+        }
+    }
 
-            auto texture_image_info = vk::DescriptorImageInfo()
-                .setSampler(imgui->texture.sampler)
-                .setImageView(imgui->texture.view)
-                .setImageLayout(vk::ImageLayout::eShaderReadOnlyOptimal);
+    void EndRasterizerFrame(GpuCommandBuffer* command_buffer) {
+        constexpr f64 smoothing = 0.1;
+        render_stats.rasterizer_encode_ms += (rasterizer_encode_frame_ms - render_stats.rasterizer_encode_ms) * smoothing;
 
-            auto writes = std::array{
-                vk::WriteDescriptorSet()
-                    .setDstSet(bind_group)
-                    .setDstBinding(0)
-                    .setDstArrayElement(0)
-                    .setDescriptorType(vk::DescriptorType::eStorageImage)
-                    .setDescriptorCount(1)
-                    .setPImageInfo(&color_image_info),
-                vk::WriteDescriptorSet()
-                    .setDstSet(bind_group)
-                    .setDstBinding(1)
-                    .setDstArrayElement(0)
-                    .setDescriptorType(vk::DescriptorType::eCombinedImageSampler)
-                    .setDescriptorCount(1)
-                    .setPImageInfo(&texture_image_info)
-            };
+        if (rasterizer_query_pool) {
+            command_buffer->cmd_buffer.writeTimestamp2(vk::PipelineStageFlagBits2::eAllCommands, rasterizer_query_pool, vulkan->current_frame_index * 2 + 1);
+        }
+    }
 
-            vulkan->context.logical_device.updateDescriptorSets(writes, nullptr);
+    // The frame slot's previous frame has finished, so its rasterizer timestamps are read without waiting.
+    void UpdateDynamicResolution() {
+        constexpr f64 smoothing = 0.1;
+
+        auto slot = vulkan->current_frame_index;
+        if (rasterizer_queries_written[slot]) {
+            rasterizer_queries_written[slot] = false;
+
+            std::array<u64, 2> timestamps = {};
+            auto result = vulkan->context.logical_device.getQueryPoolResults(rasterizer_query_pool, slot * 2, 2, sizeof(timestamps), timestamps.data(), sizeof(u64), vk::QueryResultFlagBits::e64);
+            if (result == vk::Result::eSuccess) {
+                auto gpu_ms = static_cast<f64>((timestamps[1] - timestamps[0]) & timestamp_mask) * timestamp_period_ms;
+                render_stats.rasterizer_gpu_ms += (gpu_ms - render_stats.rasterizer_gpu_ms) * smoothing;
+                if (render_settings.use_dynamic_resolution) {
+                    dynamic_resolution.Update(gpu_ms, render_settings.rasterizer_budget_ms);
+                }
+            }
         }
 
-        command_buffer->cmd_buffer.bindPipeline(vk::PipelineBindPoint::eCompute, compute_pipeline_state.pipeline);
-        command_buffer->cmd_buffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, compute_pipeline_state.pipeline_layout, 0, 1, &bind_group, 0, nullptr);
+        if (!render_settings.use_dynamic_resolution) {
+            dynamic_resolution.Reset();
+        }
+        render_stats.resolution_scale = dynamic_resolution.GetScale();
+    }
 
-        if (draw_data->TotalVtxCount > 0) {
-            auto fb_width = static_cast<i32>(draw_data->DisplaySize.x * draw_data->FramebufferScale.x);
-            auto fb_height = static_cast<i32>(draw_data->DisplaySize.y * draw_data->FramebufferScale.y);
+    // Rasterizes into the next persistent target on the compute queue and imports it into graph, whose first use of it
+    // acquires it from the compute family.
+    auto EncodeAsyncRasterizer(FrameGraph* graph, ImDrawData* draw_data) -> FrameGraphImage {
+        auto& target = rasterizer_targets[rasterizer_target_index];
+        rasterizer_target_index = (rasterizer_target_index + 1) % RASTERIZER_TARGET_COUNT;
+        EnsureRasterizerTargetSize(&target);
+
+        // the wait for the previous reader comes from the submit, the contents are discarded
+        auto compute_graph = FrameGraph(vulkan, transients, vulkan->context.compute_queue_family_index);
+        auto compute_target = compute_graph.ImportImage(target.texture, FrameGraphImageState{});
+        AddRasterizerPasses(&compute_graph, compute_target, draw_data);
+        compute_graph.SetOutput(compute_target, FrameGraphImageState{
+            .layout = vk::ImageLayout::eShaderReadOnlyOptimal,
+            .queue_family_index = vulkan->context.graphics_queue_family_index,
+        });
+        compute_graph.Execute(vulkan->BeginComputeCommands());
+        render_stats.compute_frame_graph = compute_graph.GetStats();
+
+        // the texture is written again only after the graphics submit that sampled it has finished
+        vulkan->SubmitComputeCommands(target.sampled_frame_value);
+        target.sampled_frame_value = vulkan->current_frame_value;
+
+        // the layout it was released from, the composite then acquires it into eShaderReadOnlyOptimal like the release
+        return graph->ImportImage(target.texture, FrameGraphImageState{
+            .layout = vk::ImageLayout::eGeneral,
+            .queue_family_index = vulkan->context.compute_queue_family_index,
+        });
+    }
 
+    // Barriers come from the frame graph, see AddRasterizerPasses. With parallel encoding the draw lists are split into
+    // contiguous runs of about the same number of indices, each recorded into a secondary command buffer of its own.
+    //
+    // With partial submits on the graphics queue, what is recorded so far goes to the GPU after every partial_submit_lists
+    // draw lists when encoding serially, and after the rasterizer either way, so the composite is a submit of its own.
+    //
+    // cmd_lists is a part of draw_data's lists, drawn with positions and clip rects multiplied by render_scale.
+    void EncodeRasterizer(GpuCommandBuffer* command_buffer, ImDrawData* draw_data, std::span<ImDrawList*> cmd_lists, GpuTexture* target, ImVec2 render_scale) {
+        auto encode_start = Clock::now();
+
+        auto clip_scale = draw_data->FramebufferScale * render_scale;
+        auto info = RasterizerEncodeInfo{
+            .draw_data = draw_data,
+            .extent = vk::Extent2D(
+                std::min(static_cast<u32>(std::lround(draw_data->DisplaySize.x * clip_scale.x)), target->extent.width),
+                std::min(static_cast<u32>(std::lround(draw_data->DisplaySize.y * clip_scale.y)), target->extent.height)),
+            .bind_group = GetRasterizerBindGroup(command_buffer, rasterizer_pipeline_states[0].bind_group_layouts[0], target, false),
+            .viewport_scale = draw_data->FramebufferScale * render_scale,
+            .clip_scale = clip_scale,
+            .white_pixel = render_settings.white_pixel,
+        };
+
+        // built up front, the tasks of parallel encoding only read it. Filtered upscaling blends a texel into the pixels
+        // around it, so below full scale occluders keep a texel away from their edges.
+        if (render_settings.use_occlusion_culling) {
+            auto bounds = ImRect(0, 0, static_cast<f32>(info.extent.width), static_cast<f32>(info.extent.height));
+            auto margin = render_scale.x < 1.0F || render_scale.y < 1.0F ? 1.0F : 0.0F;
+
+            occlusion_culler.Build(draw_data, info.viewport_scale, info.clip_scale, &imgui->texture, info.white_pixel, bounds, margin);
+            info.culler = &occlusion_culler;
+            // the scaled and the full resolution pass both build it from the whole frame, count the frame's occluders once
+            render_stats.occluders = occlusion_culler.GetOccluderCount();
+        }
+
+        auto task_count = render_settings.use_parallel_encoding ? std::min(encoder->GetThreadCount(), static_cast<u32>(cmd_lists.size())) : 0u;
+        auto submit_every = command_buffer == vulkan->current_command_buffer ? static_cast<usize>(std::max(render_settings.partial_submit_lists, 0)) : 0;
+
+        std::array<RasterizerCounters, ParallelEncoder::MAX_TASK_COUNT> task_counters = {};
+        if (task_count < 2 && submit_every != 0) {
+            // a new command buffer starts without bindings, EncodeRasterizerLists binds them again for every chunk
+            task_count = 0;
+            for (usize begin = 0; begin < cmd_lists.size(); begin += submit_every) {
+                auto chunk = cmd_lists.subspan(begin, std::min(submit_every, cmd_lists.size() - begin));
+                EncodeRasterizerLists(command_buffer, info, chunk, &task_counters[0]);
+                vulkan->SubmitPartial();
+            }
+        } else if (task_count < 2) {
+            task_count = 0;
+            EncodeRasterizerLists(command_buffer, info, cmd_lists, &task_counters[0]);
+        } else {
+            u64 total_index_count = 0;
+            for (auto cmd_list : cmd_lists) {
+                total_index_count += static_cast<u64>(cmd_list->IdxBuffer.Size);
+            }
+
+            std::array<usize, ParallelEncoder::MAX_TASK_COUNT + 1> task_begin = {};
+            std::array<vk::DeviceSize, ParallelEncoder::MAX_TASK_COUNT> arena_sizes = {};
+            usize list = 0;
+            u64 index_count = 0;
+            for (u32 task = 0; task < task_count; ++task) {
+                task_begin[task] = list;
+                auto task_end = total_index_count * (task + 1) / task_count;
+                while (list < cmd_lists.size() && (index_count < task_end || task + 1 == task_count)) {
+                    auto cmd_list = cmd_lists[list++];
+                    index_count += static_cast<u64>(cmd_list->IdxBuffer.Size);
+
+                    // the buffers EncodeRasterizerLists allocates for the list, with room for their alignment
+                    arena_sizes[task] += cmd_list->VtxBuffer.Size * sizeof(ImDrawVert) + alignof(ImDrawVert);
+                    arena_sizes[task] += cmd_list->IdxBuffer.Size * sizeof(ImDrawIdx) + alignof(ImDrawIdx);
+                }
+            }
+            task_begin[task_count] = list;
+
+            encoder->Encode(command_buffer, Slice<vk::DeviceSize>(task_count, arena_sizes.data()), [&](u32 task, GpuCommandBuffer* task_command_buffer) {
+                auto task_lists = cmd_lists.subspan(task_begin[task], task_begin[task + 1] - task_begin[task]);
+                EncodeRasterizerLists(task_command_buffer, info, task_lists, &task_counters[task]);
+            });
+            if (submit_every != 0) {
+                vulkan->SubmitPartial();
+            }
+        }
+
+        for (auto& counters : task_counters) {
+            for (u32 variant = 0; variant < RASTERIZER_VARIANT_COUNT; ++variant) {
+                render_stats.rasterizer_variant_dispatches[variant] += counters.variant_dispatches[variant];
+            }
+            render_stats.rasterizer_pipeline_binds += counters.pipeline_binds;
+            render_stats.rasterizer_barriers += counters.barriers;
+            render_stats.occluded_dispatches += counters.occluded_dispatches;
+            render_stats.trimmed_dispatches += counters.trimmed_dispatches;
+        }
+        render_stats.rasterizer_encode_tasks += task_count;
+        rasterizer_encode_frame_ms += Milliseconds(Clock::now() - encode_start).count();
+    }
+
+    // Records the dispatches of cmd_lists, safe to run on several threads at once with different command buffers.
+    //
+    // Dispatches run unordered unless a barrier separates them, and blending reads what earlier triangles wrote, so a
+    // dispatch overlapping one recorded since the last barrier waits for it. What was recorded before this call is unknown,
+    // a task's secondary may execute next to another one, so the first dispatch always waits.
+    void EncodeRasterizerLists(GpuCommandBuffer* command_buffer, const RasterizerEncodeInfo& info, std::span<ImDrawList*> cmd_lists, RasterizerCounters* counters) {
+        auto draw_data = info.draw_data;
+
+        std::array<ImRect, RASTERIZER_MAX_UNORDERED_DISPATCHES> unordered_rects;
+        usize unordered_count = RASTERIZER_MAX_UNORDERED_DISPATCHES;
+
+        // all variants share the same layout, so the bind groups survive pipeline switches
+        command_buffer->cmd_buffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, rasterizer_pipeline_states[0].pipeline_layout, 0, 1, &info.bind_group, 0, nullptr);
+        command_buffer->cmd_buffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, rasterizer_pipeline_states[0].pipeline_layout, BindlessTextureTable::BIND_GROUP_INDEX, 1, &vulkan->textures->bind_group, 0, nullptr);
+
+        auto bound_variant = std::numeric_limits<u32>::max();
+        if (draw_data->TotalVtxCount > 0) {
             auto clip_off = draw_data->DisplayPos;
-            auto clip_scale = draw_data->FramebufferScale;
+            auto clip_scale = info.clip_scale;
 
-            for (auto cmd_list : std::span(draw_data->CmdLists, draw_data->CmdListsCount)) {
+            for (auto& cmd_list : cmd_lists) {
+                // cmd_lists is a part of draw_data's lists, the culler knows them by their index there
+                auto list_index = static_cast<usize>(&cmd_list - draw_data->CmdLists);
                 auto vtx_buffer_size = cmd_list->VtxBuffer.Size * sizeof(ImDrawVert);
                 auto idx_buffer_size = cmd_list->IdxBuffer.Size * sizeof(ImDrawIdx);
 
@@ -204,7 +1220,7 @@ struct App {
                     continue;
                 }
 
-                if (use_memcpy) {
+                if (render_settings.use_memcpy) {
                     std::memcpy(gpu_buffer_contents(&vtx_buffer_info), cmd_list->VtxBuffer.Data, vtx_buffer_size);
                     std::memcpy(gpu_buffer_contents(&idx_buffer_info), cmd_list->IdxBuffer.Data, idx_buffer_size);
                 } else {
@@ -212,61 +1228,183 @@ struct App {
                     gpu_update_buffer(command_buffer->cmd_buffer, &idx_buffer_info, cmd_list->IdxBuffer.Data, idx_buffer_size);
                 }
 
-                auto viewport_scale = ImGui::GetIO().DisplayFramebufferScale;
+                auto viewport_scale = info.viewport_scale;
 
                 for (auto& draw_cmd : std::span(cmd_list->CmdBuffer.Data, cmd_list->CmdBuffer.Size)) {
                     auto clip_rect = ImRect(
                         (ImVec2(draw_cmd.ClipRect.x, draw_cmd.ClipRect.y) - clip_off) * clip_scale,
                         (ImVec2(draw_cmd.ClipRect.z, draw_cmd.ClipRect.w) - clip_off) * clip_scale
                     );
-                    clip_rect.ClipWith(ImRect(0, 0, static_cast<f32>(fb_width), static_cast<f32>(fb_height)));
+                    clip_rect.ClipWith(ImRect(0, 0, static_cast<f32>(info.extent.width), static_cast<f32>(info.extent.height)));
 
                     if (clip_rect.Min.x >= clip_rect.Max.x || clip_rect.Min.y >= clip_rect.Max.y) {
                         continue;
                     }
                     assert(draw_cmd.VtxOffset == 0);
 
-                    i32 group_count_x = static_cast<i32>(clip_rect.GetWidth() + 7) / 8;
-                    i32 group_count_y = static_cast<i32>(clip_rect.GetHeight() + 7) / 8;
+                    // integer pixel range covered by the clip rect, max is exclusive
+                    auto clip_pixels = ImRect(ImFloor(clip_rect.Min), ImVec2(std::ceil(clip_rect.Max.x), std::ceil(clip_rect.Max.y)));
+
                     for (u32 i = 0; i < draw_cmd.ElemCount; i += 3) {
+                        auto& v0 = cmd_list->VtxBuffer[static_cast<i32>(cmd_list->IdxBuffer[static_cast<i32>(draw_cmd.IdxOffset + i + 0)])];
+                        auto& v1 = cmd_list->VtxBuffer[static_cast<i32>(cmd_list->IdxBuffer[static_cast<i32>(draw_cmd.IdxOffset + i + 1)])];
+                        auto& v2 = cmd_list->VtxBuffer[static_cast<i32>(cmd_list->IdxBuffer[static_cast<i32>(draw_cmd.IdxOffset + i + 2)])];
+
+                        auto p0 = v0.pos * viewport_scale;
+                        auto p1 = v1.pos * viewport_scale;
+                        auto p2 = v2.pos * viewport_scale;
+
+                        auto triangle_pixels = ImRect(
+                            ImFloor(ImMin(ImMin(p0, p1), p2)),
+                            ImFloor(ImMax(ImMax(p0, p1), p2)) + ImVec2(1.0F, 1.0F)
+                        );
+
+                        auto variant = ClassifyTriangle(draw_cmd, v0, v1, v2, triangle_pixels, clip_pixels, info.white_pixel);
+
+                        // dispatch only over the part of the clip rect the triangle can touch
+                        auto dispatch_rect = triangle_pixels;
+                        dispatch_rect.ClipWithFull(clip_pixels);
+                        if (dispatch_rect.Min.x >= dispatch_rect.Max.x || dispatch_rect.Min.y >= dispatch_rect.Max.y) {
+                            continue;
+                        }
+
+                        if (info.culler != nullptr) {
+                            auto occlusion = info.culler->Cull(list_index, &dispatch_rect);
+                            if (occlusion == OcclusionResult::eOccluded) {
+                                counters->occluded_dispatches += 1;
+                                continue;
+                            }
+                            if (occlusion == OcclusionResult::eTrimmed) {
+                                // the triangle reaches past the trimmed rect now, see OcclusionCuller
+                                variant |= eRasterizerClipped;
+                                counters->trimmed_dispatches += 1;
+                            }
+                        }
+
+                        auto overlaps = unordered_count == unordered_rects.size();
+                        for (usize r = 0; r < unordered_count && !overlaps; ++r) {
+                            overlaps = unordered_rects[r].Overlaps(dispatch_rect);
+                        }
+                        if (overlaps) {
+                            auto barrier = vk::MemoryBarrier2()
+                                .setSrcStageMask(vk::PipelineStageFlagBits2::eComputeShader)
+                                .setSrcAccessMask(vk::AccessFlagBits2::eShaderStorageWrite)
+                                .setDstStageMask(vk::PipelineStageFlagBits2::eComputeShader)
+                                .setDstAccessMask(vk::AccessFlagBits2::eShaderStorageRead | vk::AccessFlagBits2::eShaderStorageWrite);
+                            command_buffer->cmd_buffer.pipelineBarrier2(vk::DependencyInfo({}, barrier, {}, {}));
+                            unordered_count = 0;
+                            counters->barriers += 1;
+                        }
+                        unordered_rects[unordered_count++] = dispatch_rect;
+
+                        auto& pipeline_state = rasterizer_pipeline_states[variant];
+                        if (variant != bound_variant) {
+                            command_buffer->cmd_buffer.bindPipeline(vk::PipelineBindPoint::eCompute, pipeline_state.pipeline);
+                            bound_variant = variant;
+                            counters->pipeline_binds += 1;
+                        }
+
                         auto push_constants = RasterizerPushConstants{
                             .index_buffer_reference = gpu_buffer_device_address(&idx_buffer_info),
                             .vertex_buffer_reference = gpu_buffer_device_address(&vtx_buffer_info),
                             .viewport_scale = viewport_scale,
                             .index_offset = draw_cmd.IdxOffset + i,
-                            .clip_rect_min_x = clip_rect.Min.x,
-                            .clip_rect_min_y = clip_rect.Min.y,
-                            .clip_rect_max_x = clip_rect.Max.x,
-                            .clip_rect_max_y = clip_rect.Max.y,
+                            .clip_rect_min_x = dispatch_rect.Min.x,
+                            .clip_rect_min_y = dispatch_rect.Min.y,
+                            .clip_rect_max_x = dispatch_rect.Max.x,
+                            .clip_rect_max_y = dispatch_rect.Max.y,
+                            .texture_index = BindlessTextureTable::GetIndex(static_cast<GpuTexture*>(draw_cmd.TextureId), &imgui->texture),
                         };
 
-                        command_buffer->cmd_buffer.pushConstants(compute_pipeline_state.pipeline_layout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(push_constants), &push_constants);
+                        command_buffer->cmd_buffer.pushConstants(pipeline_state.pipeline_layout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(push_constants), &push_constants);
+
+                        auto thread_count_x = static_cast<u32>(dispatch_rect.GetWidth());
+                        auto thread_count_y = static_cast<u32>(dispatch_rect.GetHeight());
+                        gpu_dispatch_threads(command_buffer->cmd_buffer, &pipeline_state, thread_count_x, thread_count_y, 1);
 
-                        command_buffer->cmd_buffer.dispatch(group_count_x, group_count_y, 1);
+                        counters->variant_dispatches[variant] += 1;
                     }
                 }
             }
         }
+    }
 
-        // change image layout ShaderReadOnlyOptimal
-        {
-            auto barriers = std::array{
-                vk::ImageMemoryBarrier2()
-                    .setSrcStageMask(vk::PipelineStageFlagBits2::eComputeShader)
-                    .setDstStageMask(vk::PipelineStageFlagBits2::eFragmentShader)
-                    .setSrcAccessMask(vk::AccessFlagBits2::eShaderWrite)
-                    .setDstAccessMask(vk::AccessFlagBits2::eShaderRead)
-                    .setOldLayout(vk::ImageLayout::eGeneral)
-                    .setNewLayout(vk::ImageLayout::eShaderReadOnlyOptimal)
-                    .setImage(color_texture.image)
-                    .setSubresourceRange(vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1)),
-            };
+    // Set 0 of the rasterizer, the color target. Comes from the bind group cache unless transient is set.
+    auto GetRasterizerBindGroup(GpuCommandBuffer* command_buffer, vk::DescriptorSetLayout bind_group_layout, GpuTexture* target, bool transient) -> vk::DescriptorSet {
+        auto color_image_info = vk::DescriptorImageInfo()
+            .setImageView(target->view)
+            .setImageLayout(vk::ImageLayout::eGeneral);
+
+        auto writes = std::array{
+            vk::WriteDescriptorSet()
+                .setDstBinding(0)
+                .setDstArrayElement(0)
+                .setDescriptorType(vk::DescriptorType::eStorageImage)
+                .setDescriptorCount(1)
+                .setPImageInfo(&color_image_info),
+        };
+
+        if (!transient) {
+            return vulkan->bind_groups->GetBindGroup(bind_group_layout, writes);
+        }
+
+        auto bind_group = gpu_command_buffer_allocate_bind_group(&vulkan->context, command_buffer, bind_group_layout);
+        writes[0].setDstSet(bind_group);
+        vulkan->context.logical_device.updateDescriptorSets(writes, nullptr);
+        return bind_group;
+    }
+
+    // Picks the cheapest rasterizer variant that still produces the same pixels for this triangle.
+    auto ClassifyTriangle(const ImDrawCmd& draw_cmd, const ImDrawVert& v0, const ImDrawVert& v1, const ImDrawVert& v2, const ImRect& triangle_pixels, const ImRect& clip_pixels, ImVec2 white_pixel) -> u32 {
+        u32 variant = 0;
+
+        auto is_white_pixel = [&](const ImDrawVert& v) {
+            return v.uv.x == white_pixel.x && v.uv.y == white_pixel.y;
+        };
+
+        auto solid = draw_cmd.TextureId == &imgui->texture && is_white_pixel(v0) && is_white_pixel(v1) && is_white_pixel(v2);
+        if (!solid) {
+            variant |= eRasterizerTextured;
+        }
+
+        if (!clip_pixels.Contains(triangle_pixels)) {
+            variant |= eRasterizerClipped;
+        }
+
+        auto alpha_mask = static_cast<ImU32>(IM_COL32_A_MASK);
+        auto opaque = solid && (v0.col & alpha_mask) == alpha_mask && (v1.col & alpha_mask) == alpha_mask && (v2.col & alpha_mask) == alpha_mask;
+        if (!opaque) {
+            variant |= eRasterizerBlended;
+        }
+
+        return variant;
+    }
 
-            command_buffer->cmd_buffer.pipelineBarrier2(vk::DependencyInfo({}, {}, {}, barriers));
+    // Draws into the swapchain image, which the graph then leaves ready to present.
+    void AddSwapchainPass(FrameGraph* graph, ImDrawData* draw_data, std::optional<FrameGraphImage> target) {
+        auto swapchain_texture = GpuTexture{
+            .image = vulkan->swapchain_images[vulkan->current_image_index],
+            .view = vulkan->swapchain_views[vulkan->current_image_index],
+            .extent = vulkan->configuration.extent,
+        };
+
+        // the frame's submit waits for the image to be acquired at color attachment output
+        auto swapchain = graph->ImportImage(swapchain_texture, FrameGraphImageState{
+            .stages = vk::PipelineStageFlagBits2::eColorAttachmentOutput,
+        });
+        graph->SetOutput(swapchain, FrameGraphImageState{ .layout = vk::ImageLayout::ePresentSrcKHR });
+
+        auto pass = graph->AddPass("Swapchain", [this, graph, draw_data, target](GpuCommandBuffer* command_buffer) {
+            EncodeSwapchain(command_buffer, draw_data, target ? graph->GetTexture(*target) : nullptr);
+        });
+        graph->Write(pass, swapchain, FrameGraphUsage::eColorAttachment);
+        if (target) {
+            graph->Read(pass, *target, FrameGraphUsage::eFragmentSampled);
         }
     }
 
-    void EncodeSwapchain(GpuCommandBuffer* command_buffer) {
+    // Composites the rasterizer target onto the swapchain image, or draws the UI with the graphics pipeline when target is null.
+    void EncodeSwapchain(GpuCommandBuffer* command_buffer, ImDrawData* draw_data, GpuTexture* target) {
         auto render_area = vk::Rect2D(vk::Offset2D(0, 0), vulkan->configuration.extent);
         auto render_viewport = vk::Viewport()
             .setX(0)
@@ -276,18 +1414,6 @@ struct App {
             .setMinDepth(0)
             .setMaxDepth(1);
 
-        vk::ImageMemoryBarrier2 barriers_1[1] = {};
-        barriers_1[0].setSrcStageMask(vk::PipelineStageFlagBits2::eTopOfPipe);
-        barriers_1[0].setDstStageMask(vk::PipelineStageFlagBits2::eColorAttachmentOutput);
-        barriers_1[0].setSrcAccessMask(vk::AccessFlagBits2::eNone);
-        barriers_1[0].setDstAccessMask(vk::AccessFlagBits2::eColorAttachmentRead | vk::AccessFlagBits2::eColorAttachmentWrite);
-        barriers_1[0].setOldLayout(vk::ImageLayout::eUndefined);
-        barriers_1[0].setNewLayout(vk::ImageLayout::eColorAttachmentOptimal);
-        barriers_1[0].setImage(vulkan->swapchain_images[vulkan->current_image_index]);
-        barriers_1[0].setSubresourceRange(vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1));
-
-        command_buffer->cmd_buffer.pipelineBarrier2(vk::DependencyInfo({}, {}, {}, barriers_1));
-
         vk::RenderingAttachmentInfo color_attachment_info = {};
         color_attachment_info.setImageView(vulkan->swapchain_views[vulkan->current_image_index]);
         color_attachment_info.setImageLayout(vk::ImageLayout::eColorAttachmentOptimal);
@@ -305,16 +1431,14 @@ struct App {
         command_buffer->cmd_buffer.setViewport(0, render_viewport);
         command_buffer->cmd_buffer.setScissor(0, render_area);
 
-        auto bind_group = gpu_command_buffer_allocate_bind_group(&vulkan->context, command_buffer, graphics_bind_group_layout);
-        {
+        if (target != nullptr) {
             auto image_info = vk::DescriptorImageInfo()
-                .setSampler(color_texture.sampler)
-                .setImageView(color_texture.view)
+                .setSampler(rasterizer_sampler)
+                .setImageView(target->view)
                 .setImageLayout(vk::ImageLayout::eShaderReadOnlyOptimal);
 
             auto writes = std::array{
                 vk::WriteDescriptorSet()
-                    .setDstSet(bind_group)
                     .setDstBinding(0)
                     .setDstArrayElement(0)
                     .setDescriptorType(vk::DescriptorType::eCombinedImageSampler)
@@ -322,53 +1446,33 @@ struct App {
                     .setPImageInfo(&image_info)
             };
 
-            vulkan->context.logical_device.updateDescriptorSets(writes, nullptr);
+            // one set per rasterizer target, written the first time the target is composited
+            auto bind_group = vulkan->bind_groups->GetBindGroup(graphics_pipeline_state.bind_group_layouts[0], writes);
+            command_buffer->cmd_buffer.bindPipeline(vk::PipelineBindPoint::eGraphics, graphics_pipeline_state.pipeline);
+            command_buffer->cmd_buffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, graphics_pipeline_state.pipeline_layout, 0, 1, &bind_group, 0, nullptr);
+
+            // the target can be larger than the swapchain, only its top-left part holds this frame
+            auto uv_scale = ImVec2(
+                static_cast<f32>(vulkan->configuration.extent.width) / static_cast<f32>(target->extent.width),
+                static_cast<f32>(vulkan->configuration.extent.height) / static_cast<f32>(target->extent.height)
+            );
+            command_buffer->cmd_buffer.pushConstants(graphics_pipeline_state.pipeline_layout, vk::ShaderStageFlagBits::eVertex, 0, sizeof(uv_scale), &uv_scale);
+            command_buffer->cmd_buffer.draw(6, 1, 0, 0);
+        } else if (render_settings.use_indirect_draws && imgui->IsIndirectSupported()) {
+            render_stats.graphics_draw_calls = imgui->RecordCommandBufferIndirect(command_buffer, draw_data);
+        } else {
+            render_stats.graphics_draw_calls = imgui->RecordCommandBuffer(command_buffer, draw_data);
         }
-        command_buffer->cmd_buffer.bindPipeline(vk::PipelineBindPoint::eGraphics, graphics_pipeline_state.pipeline);
-        command_buffer->cmd_buffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, graphics_pipeline_state.pipeline_layout, 0, 1, &bind_group, 0, nullptr);
-        command_buffer->cmd_buffer.draw(6, 1, 0, 0);
-
-//        imgui->RecordCommandBuffer(command_buffer, ImGui::GetDrawData());
         command_buffer->cmd_buffer.endRendering();
-
-        vk::ImageMemoryBarrier2 barriers_2[1] = {};
-        barriers_2[0].setSrcStageMask(vk::PipelineStageFlagBits2::eColorAttachmentOutput);
-        barriers_2[0].setDstStageMask(vk::PipelineStageFlagBits2::eBottomOfPipe);
-        barriers_2[0].setSrcAccessMask(vk::AccessFlagBits2::eColorAttachmentRead | vk::AccessFlagBits2::eColorAttachmentWrite);
-        barriers_2[0].setDstAccessMask(vk::AccessFlagBits2::eMemoryRead);
-        barriers_2[0].setOldLayout(vk::ImageLayout::eColorAttachmentOptimal);
-        barriers_2[0].setNewLayout(vk::ImageLayout::ePresentSrcKHR);
-        barriers_2[0].setImage(vulkan->swapchain_images[vulkan->current_image_index]);
-        barriers_2[0].setSubresourceRange(vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1));
-
-        command_buffer->cmd_buffer.pipelineBarrier2(vk::DependencyInfo({}, {}, {}, barriers_2));
     }
 
     void CreateRenderTargets() {
-        auto color_image_info = vk::ImageCreateInfo()
-            .setImageType(vk::ImageType::e2D)
-            .setFormat(vk::Format::eR32G32B32A32Sfloat)
-            .setExtent(vk::Extent3D(vulkan->configuration.extent.width, vulkan->configuration.extent.height, 1))
-            .setMipLevels(1)
-            .setArrayLayers(1)
-            .setSamples(vk::SampleCountFlagBits::e1)
-            .setTiling(vk::ImageTiling::eOptimal)
-            .setUsage(vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eStorage | vk::ImageUsageFlagBits::eTransferDst)
-            .setSharingMode(vk::SharingMode::eExclusive)
-            .setQueueFamilyIndices({})
-            .setInitialLayout(vk::ImageLayout::eUndefined);
-
-        vk::resultCheck(vulkan->context.logical_device.createImage(&color_image_info, nullptr, &color_texture.image), "Failed to create image");
-        gpu_texture_storage(&vulkan->context, &color_texture.allocation, color_texture.image, GpuStorageMode::ePrivate, {});
-
-        auto color_view_info = vk::ImageViewCreateInfo()
-            .setImage(color_texture.image)
-            .setViewType(vk::ImageViewType::e2D)
-            .setFormat(vk::Format::eR32G32B32A32Sfloat)
-            .setSubresourceRange(vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1));
+        auto extent = vk::Extent2D(std::max(vulkan->configuration.extent.width, 1u), std::max(vulkan->configuration.extent.height, 1u));
+        for (auto& target : rasterizer_targets) {
+            CreateRasterizerTexture(&target.texture, extent);
+        }
 
-        vk::resultCheck(vulkan->context.logical_device.createImageView(&color_view_info, nullptr, &color_texture.view), "Failed to create image view");
-        
+        // shared by every rasterizer target, including the transient ones
         auto color_sampler_info = vk::SamplerCreateInfo()
             .setMagFilter(vk::Filter::eNearest)
             .setMinFilter(vk::Filter::eNearest)
@@ -385,26 +1489,98 @@ struct App {
             .setMipLodBias(0.0f)
             .setMinLod(0.0f)
             .setMaxLod(0.0f);
-        
-        vk::resultCheck(vulkan->context.logical_device.createSampler(&color_sampler_info, nullptr, &color_texture.sampler), "Failed to create sampler");
+
+        vk::resultCheck(vulkan->context.logical_device.createSampler(&color_sampler_info, nullptr, &rasterizer_sampler), "Failed to create sampler");
+
+        // linear filtering of 32-bit float formats is optional, dynamic resolution then upscales with nearest
+        auto format_properties = vulkan->context.physical_device.getFormatProperties(vk::Format::eR32G32B32A32Sfloat);
+        auto upscale_filter = format_properties.optimalTilingFeatures & vk::FormatFeatureFlagBits::eSampledImageFilterLinear
+            ? vk::Filter::eLinear
+            : vk::Filter::eNearest;
+
+        auto upscale_sampler_info = color_sampler_info;
+        upscale_sampler_info.setMagFilter(upscale_filter).setMinFilter(upscale_filter);
+
+        vk::resultCheck(vulkan->context.logical_device.createSampler(&upscale_sampler_info, nullptr, &rasterizer_upscale_sampler), "Failed to create sampler");
     }
 
-    void CreateComputePipelineState() {
-        auto entries = std::array{
-            vk::DescriptorSetLayoutBinding(0, vk::DescriptorType::eStorageImage, 1, vk::ShaderStageFlagBits::eCompute),
-            vk::DescriptorSetLayoutBinding(1, vk::DescriptorType::eCombinedImageSampler, 1, vk::ShaderStageFlagBits::eCompute),
-        };
-        compute_bind_group_layout = vulkan->context.logical_device.createDescriptorSetLayout(vk::DescriptorSetLayoutCreateInfo({}, entries));
+    // Dynamic resolution goes by these timestamps, without them on both queues the rasterizer can run on it stays off.
+    void CreateRasterizerQueries() {
+        auto& context = vulkan->context;
+
+        auto properties = context.physical_device.getProperties();
+        auto queue_families = context.physical_device.getQueueFamilyProperties();
+        auto timestamp_valid_bits = std::min(
+            queue_families[context.graphics_queue_family_index].timestampValidBits,
+            queue_families[context.compute_queue_family_index].timestampValidBits);
+        if (!properties.limits.timestampComputeAndGraphics || timestamp_valid_bits == 0) {
+            fprintf(stderr, "Timestamp queries are not supported, dynamic resolution is unavailable\n");
+            return;
+        }
 
-        auto bind_group_layouts = std::array{
-            compute_bind_group_layout
-        };
+        auto query_count = static_cast<u32>(rasterizer_queries_written.size() * 2);
+        rasterizer_query_pool = context.logical_device.createQueryPool(vk::QueryPoolCreateInfo({}, vk::QueryType::eTimestamp, query_count));
+        timestamp_period_ms = static_cast<f64>(properties.limits.timestampPeriod) * 1e-6;
+        timestamp_mask = timestamp_valid_bits >= 64 ? ~0ull : (1ull << timestamp_valid_bits) - 1ull;
+    }
 
-        auto push_constant_ranges = std::array{
-            vk::PushConstantRange(vk::ShaderStageFlagBits::eCompute, 0, sizeof(RasterizerPushConstants))
+    // Transient rasterizer target, rounded up like EnsureRasterizerTargetSize so drag-resizing keeps reusing the same images.
+    auto GetRasterizerTargetDesc(vk::Extent2D extent) -> FrameGraphImageDesc {
+        return FrameGraphImageDesc{
+            .extent = vk::Extent2D(
+                static_cast<u32>(gpu_calculate_alignment(std::max(extent.width, 1u), RASTERIZER_TARGET_GRANULARITY)),
+                static_cast<u32>(gpu_calculate_alignment(std::max(extent.height, 1u), RASTERIZER_TARGET_GRANULARITY))),
+            .format = vk::Format::eR32G32B32A32Sfloat,
+            .usage = vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eStorage | vk::ImageUsageFlagBits::eTransferDst,
         };
+    }
+
+    // Grow-only: the texture is reallocated when the swapchain outgrows it, otherwise only its top-left part is used.
+    void EnsureRasterizerTargetSize(RasterizerTarget* target) {
+        auto extent = vulkan->configuration.extent;
+        if (extent.width <= target->texture.extent.width && extent.height <= target->texture.extent.height) {
+            return;
+        }
+
+        // round up, so drag-resizing reallocates every few hundred pixels instead of every frame
+        auto grown_extent = vk::Extent2D(
+            std::max(static_cast<u32>(gpu_calculate_alignment(extent.width, RASTERIZER_TARGET_GRANULARITY)), target->texture.extent.width),
+            std::max(static_cast<u32>(gpu_calculate_alignment(extent.height, RASTERIZER_TARGET_GRANULARITY)), target->texture.extent.height)
+        );
+
+        vulkan->DestroyDeferred(target->texture);
+        CreateRasterizerTexture(&target->texture, grown_extent);
+    }
+
+    void CreateRasterizerTexture(GpuTexture* texture, vk::Extent2D extent) {
+        auto color_image_info = vk::ImageCreateInfo()
+            .setImageType(vk::ImageType::e2D)
+            .setFormat(vk::Format::eR32G32B32A32Sfloat)
+            .setExtent(vk::Extent3D(extent.width, extent.height, 1))
+            .setMipLevels(1)
+            .setArrayLayers(1)
+            .setSamples(vk::SampleCountFlagBits::e1)
+            .setTiling(vk::ImageTiling::eOptimal)
+            .setUsage(vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eStorage | vk::ImageUsageFlagBits::eTransferDst)
+            .setSharingMode(vk::SharingMode::eExclusive)
+            .setQueueFamilyIndices({})
+            .setInitialLayout(vk::ImageLayout::eUndefined);
+
+        vk::resultCheck(vulkan->context.logical_device.createImage(&color_image_info, nullptr, &texture->image), "Failed to create image");
+        texture->extent = extent;
+        gpu_texture_storage(&vulkan->context, &texture->allocation, texture->image, GpuStorageMode::ePrivate, {});
+
+        auto color_view_info = vk::ImageViewCreateInfo()
+            .setImage(texture->image)
+            .setViewType(vk::ImageViewType::e2D)
+            .setFormat(vk::Format::eR32G32B32A32Sfloat)
+            .setSubresourceRange(vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1));
 
-        auto comp_bytes = vulkan->ReadBytes("shaders/rasterizer.comp.spv").value();
+        vk::resultCheck(vulkan->context.logical_device.createImageView(&color_view_info, nullptr, &texture->view), "Failed to create image view");
+    }
+
+    void LoadRasterizerShaderObject(GpuShaderObject* shader_object) {
+        auto comp_bytes = vulkan->ReadBytes(rasterizer_use_subgroups ? "shaders/rasterizer_subgroup.comp.spv" : "shaders/rasterizer.comp.spv").value();
 
         GpuShaderObjectCreateInfo shader_object_infos[1] = {};
         shader_object_infos[0].stage = vk::ShaderStageFlagBits::eCompute;
@@ -412,27 +1588,367 @@ struct App {
         shader_object_infos[0].pCode = comp_bytes.data();
         shader_object_infos[0].pName = "main";
 
-        GpuShaderObject compute_shader_object;
-        gpu_create_shader_object(&vulkan->context, &compute_shader_object, &shader_object_infos[0]);
+        gpu_create_shader_object(&vulkan->context, shader_object, &shader_object_infos[0]);
+    }
+
+    void CreateRasterizerPipelineState(GpuShaderObject* shader_object, u32 variant, vk::Extent2D workgroup_size, GpuComputePipelineState* state) {
+        auto specialization = RasterizerSpecialization{
+            .textured = (variant & eRasterizerTextured) ? VK_TRUE : VK_FALSE,
+            .clipped = (variant & eRasterizerClipped) ? VK_TRUE : VK_FALSE,
+            .blended = (variant & eRasterizerBlended) ? VK_TRUE : VK_FALSE,
+            .workgroup_size_x = workgroup_size.width,
+            .workgroup_size_y = workgroup_size.height,
+        };
+
+        auto specialization_map_entries = std::array{
+            vk::SpecializationMapEntry(0, offsetof(RasterizerSpecialization, textured), sizeof(vk::Bool32)),
+            vk::SpecializationMapEntry(1, offsetof(RasterizerSpecialization, clipped), sizeof(vk::Bool32)),
+            vk::SpecializationMapEntry(2, offsetof(RasterizerSpecialization, blended), sizeof(vk::Bool32)),
+            vk::SpecializationMapEntry(3, offsetof(RasterizerSpecialization, workgroup_size_x), sizeof(u32)),
+            vk::SpecializationMapEntry(4, offsetof(RasterizerSpecialization, workgroup_size_y), sizeof(u32)),
+        };
+
+        auto specialization_info = vk::SpecializationInfo()
+            .setMapEntries(specialization_map_entries)
+            .setDataSize(sizeof(specialization))
+            .setPData(&specialization);
 
         auto state_create_info = GpuComputePipelineStateCreateInfo{
-            .shader_object = &compute_shader_object,
-            .bind_group_layouts = bind_group_layouts,
-            .push_constant_ranges = push_constant_ranges
+            .shader_object = shader_object,
+            .specialization_info = &specialization_info,
         };
 
-        gpu_create_compute_pipeline_state(&vulkan->context, &state_create_info, &compute_pipeline_state);
+        gpu_create_compute_pipeline_state(&vulkan->context, &state_create_info, state);
+    }
+
+    void CreateComputePipelineState() {
+        GpuShaderObject compute_shader_object;
+        LoadRasterizerShaderObject(&compute_shader_object);
+
+        for (u32 variant = 0; variant < RASTERIZER_VARIANT_COUNT; ++variant) {
+            CreateRasterizerPipelineState(&compute_shader_object, variant, rasterizer_workgroup_size, &rasterizer_pipeline_states[variant]);
+        }
 
         gpu_destroy_shader_object(&vulkan->context, &compute_shader_object);
     }
 
-    void CreateGraphicsPipelineState() {
-        auto entries = std::array{
-            vk::DescriptorSetLayoutBinding(0, vk::DescriptorType::eCombinedImageSampler, 1, vk::ShaderStageFlagBits::eFragment)
+    void CreateUpscalePipelineState() {
+        auto comp_bytes = vulkan->ReadBytes("shaders/rasterizer_upscale.comp.spv").value();
+
+        GpuShaderObjectCreateInfo shader_object_info = {};
+        shader_object_info.stage = vk::ShaderStageFlagBits::eCompute;
+        shader_object_info.codeSize = comp_bytes.size();
+        shader_object_info.pCode = comp_bytes.data();
+        shader_object_info.pName = "main";
+
+        GpuShaderObject shader_object;
+        gpu_create_shader_object(&vulkan->context, &shader_object, &shader_object_info);
+
+        // the transient images change from frame to frame, so the bindings are pushed
+        auto state_create_info = GpuComputePipelineStateCreateInfo{
+            .shader_object = &shader_object,
+            .push_bind_group_mask = 1u << 0,
+        };
+        gpu_create_compute_pipeline_state(&vulkan->context, &state_create_info, &upscale_pipeline_state);
+
+        gpu_destroy_shader_object(&vulkan->context, &shader_object);
+    }
+
+    auto GetDeviceUUID() -> std::string {
+        auto properties = vulkan->context.physical_device.getProperties2<vk::PhysicalDeviceProperties2, vk::PhysicalDeviceIDProperties>();
+
+        std::string uuid;
+        for (auto byte : properties.get<vk::PhysicalDeviceIDProperties>().deviceUUID) {
+            char digits[3];
+            snprintf(digits, sizeof(digits), "%02x", byte);
+            uuid += digits;
+        }
+        return uuid;
+    }
+
+    // The candidate workgroup shapes within the device's compute limits.
+    auto GetRasterizerWorkgroupCandidates() -> std::vector<vk::Extent2D> {
+        auto limits = vulkan->context.physical_device.getProperties().limits;
+
+        std::vector<vk::Extent2D> candidates;
+        for (auto candidate : RASTERIZER_WORKGROUP_CANDIDATES) {
+            if (candidate.width * candidate.height > limits.maxComputeWorkGroupInvocations) {
+                continue;
+            }
+            if (candidate.width > limits.maxComputeWorkGroupSize[0] || candidate.height > limits.maxComputeWorkGroupSize[1]) {
+                continue;
+            }
+            candidates.emplace_back(candidate);
+        }
+        return candidates;
+    }
+
+    // Tunings live in the user's cache directory, or in the working directory when there is none.
+    auto GetRasterizerTuningPath() -> std::filesystem::path {
+        std::filesystem::path directory;
+#if _WIN32
+        if (auto local_app_data = std::getenv("LOCALAPPDATA")) {
+            directory = local_app_data;
+        }
+#elif __APPLE__
+        if (auto home = std::getenv("HOME")) {
+            directory = std::filesystem::path(home) / "Library" / "Caches";
+        }
+#else
+        if (auto cache_home = std::getenv("XDG_CACHE_HOME"); cache_home != nullptr && *cache_home != '\0') {
+            directory = cache_home;
+        } else if (auto home = std::getenv("HOME")) {
+            directory = std::filesystem::path(home) / ".cache";
+        }
+#endif
+        if (!directory.empty()) {
+            directory /= "game";
+        }
+
+        // the shape is only good for the kernel and device it was measured with
+        auto kernel = rasterizer_use_subgroups ? "subgroup" : "scalar";
+        return directory / ("rasterizer_tuning_" + std::string(kernel) + "_" + GetDeviceUUID() + ".txt");
+    }
+
+    // Uses the workgroup shape saved for this device and kernel, running the tuner when there is none, when it is not one of
+    // the candidates the device can run, or when forced.
+    void ConfigureRasterizerWorkgroupSize(bool force_tuning) {
+        auto path = GetRasterizerTuningPath();
+
+        if (!force_tuning) {
+            std::ifstream file(path);
+
+            vk::Extent2D workgroup_size;
+            if (file >> workgroup_size.width >> workgroup_size.height) {
+                auto candidates = GetRasterizerWorkgroupCandidates();
+                if (std::find(candidates.begin(), candidates.end(), workgroup_size) != candidates.end()) {
+                    rasterizer_workgroup_size = workgroup_size;
+                    return;
+                }
+                fprintf(stderr, "Ignoring rasterizer tuning %ux%u from %s\n", workgroup_size.width, workgroup_size.height, path.string().c_str());
+            }
+        }
+
+        auto tuned = TuneRasterizerWorkgroupSize();
+        if (!tuned.has_value()) {
+            return;
+        }
+        rasterizer_workgroup_size = *tuned;
+
+        std::error_code error;
+        if (path.has_parent_path()) {
+            std::filesystem::create_directories(path.parent_path(), error);
+        }
+        std::ofstream file(path, std::ios::trunc);
+        if (error || !(file << tuned->width << " " << tuned->height << "\n")) {
+            fprintf(stderr, "Failed to save rasterizer tuning to %s\n", path.string().c_str());
+        }
+    }
+
+    // A deterministic frame that looks like a typical UI: a few large panels, rows of buttons and many glyph-sized quads.
+    void BuildRasterizerReferenceFrame(ImVec2 size, std::vector<ImDrawVert>* vertices, std::vector<ImDrawIdx>* indices) {
+        auto add_rect = [&](ImVec2 min, ImVec2 max, ImVec2 uv_min, ImVec2 uv_max, ImU32 col) {
+            auto base = static_cast<ImDrawIdx>(vertices->size());
+            vertices->push_back(ImDrawVert{ .pos = min, .uv = uv_min, .col = col });
+            vertices->push_back(ImDrawVert{ .pos = ImVec2(max.x, min.y), .uv = ImVec2(uv_max.x, uv_min.y), .col = col });
+            vertices->push_back(ImDrawVert{ .pos = max, .uv = uv_max, .col = col });
+            vertices->push_back(ImDrawVert{ .pos = ImVec2(min.x, max.y), .uv = ImVec2(uv_min.x, uv_max.y), .col = col });
+            for (auto index : { 0, 1, 2, 0, 2, 3 }) {
+                indices->push_back(base + static_cast<ImDrawIdx>(index));
+            }
+        };
+
+        auto white_pixel = ImGui::GetIO().Fonts->TexUvWhitePixel;
+        auto panel_size = size * 0.5F;
+
+        for (i32 y = 0; y < 2; ++y) {
+            for (i32 x = 0; x < 2; ++x) {
+                auto panel_min = ImVec2(static_cast<f32>(x), static_cast<f32>(y)) * panel_size;
+                add_rect(panel_min, panel_min + panel_size, white_pixel, white_pixel, IM_COL32(40, 40, 40, 240));
+
+                for (i32 row = 0; row < 8; ++row) {
+                    auto button_min = panel_min + ImVec2(8.0F, 8.0F + 24.0F * static_cast<f32>(row));
+                    add_rect(button_min, button_min + ImVec2(panel_size.x * 0.5F, 20.0F), white_pixel, white_pixel, IM_COL32(66, 150, 250, 102));
+
+                    for (i32 glyph = 0; glyph < 32; ++glyph) {
+                        auto glyph_min = button_min + ImVec2(4.0F + 7.0F * static_cast<f32>(glyph), 4.0F);
+                        add_rect(glyph_min, glyph_min + ImVec2(7.0F, 13.0F), ImVec2(0.0F, 0.0F), ImVec2(0.05F, 0.1F), IM_COL32_WHITE);
+                    }
+                }
+            }
+        }
+    }
+
+    // Times the general rasterizer variant with each candidate workgroup shape and returns the fastest one.
+    auto TuneRasterizerWorkgroupSize() -> std::optional<vk::Extent2D> {
+        auto& context = vulkan->context;
+
+        auto properties = context.physical_device.getProperties();
+        auto queue_families = context.physical_device.getQueueFamilyProperties();
+        auto timestamp_valid_bits = queue_families[context.graphics_queue_family_index].timestampValidBits;
+        if (!properties.limits.timestampComputeAndGraphics || timestamp_valid_bits == 0) {
+            fprintf(stderr, "Timestamp queries are not supported, keeping the default rasterizer workgroup size\n");
+            return std::nullopt;
+        }
+
+        auto candidates = GetRasterizerWorkgroupCandidates();
+        if (candidates.empty()) {
+            fprintf(stderr, "No rasterizer workgroup size fits the device limits, keeping the default\n");
+            return std::nullopt;
+        }
+
+        auto target_size = ImVec2(static_cast<f32>(vulkan->configuration.extent.width), static_cast<f32>(vulkan->configuration.extent.height));
+
+        std::vector<ImDrawVert> vertices;
+        std::vector<ImDrawIdx> indices;
+        BuildRasterizerReferenceFrame(target_size, &vertices, &indices);
+
+        GpuCommandBuffer command_buffer;
+        gpu_create_command_buffer(&context, &command_buffer, context.graphics_queue_family_index);
+
+        GpuBufferInfo vtx_buffer_info;
+        GpuBufferInfo idx_buffer_info;
+        if (!gpu_command_buffer_allocate(&context, &command_buffer, &vtx_buffer_info, vertices.size() * sizeof(ImDrawVert), alignof(ImDrawVert))) {
+            fprintf(stderr, "Failed to allocate vertex buffer for rasterizer tuning\n");
+            gpu_destroy_command_buffer(&context, &command_buffer);
+            return std::nullopt;
+        }
+        if (!gpu_command_buffer_allocate(&context, &command_buffer, &idx_buffer_info, indices.size() * sizeof(ImDrawIdx), alignof(ImDrawIdx))) {
+            fprintf(stderr, "Failed to allocate index buffer for rasterizer tuning\n");
+            gpu_destroy_command_buffer(&context, &command_buffer);
+            return std::nullopt;
+        }
+        std::memcpy(gpu_buffer_contents(&vtx_buffer_info), vertices.data(), vertices.size() * sizeof(ImDrawVert));
+        std::memcpy(gpu_buffer_contents(&idx_buffer_info), indices.data(), indices.size() * sizeof(ImDrawIdx));
+
+        GpuShaderObject shader_object;
+        LoadRasterizerShaderObject(&shader_object);
+
+        std::vector<GpuComputePipelineState> states(candidates.size());
+        for (usize i = 0; i < candidates.size(); ++i) {
+            CreateRasterizerPipelineState(&shader_object, eRasterizerTextured | eRasterizerClipped | eRasterizerBlended, candidates[i], &states[i]);
+        }
+        gpu_destroy_shader_object(&context, &shader_object);
+
+        constexpr u32 repetitions = 5;
+        auto query_count = static_cast<u32>(candidates.size()) * repetitions * 2;
+        auto query_pool = context.logical_device.createQueryPool(vk::QueryPoolCreateInfo({}, vk::QueryType::eTimestamp, query_count));
+
+        command_buffer.cmd_buffer.begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+        command_buffer.cmd_buffer.resetQueryPool(query_pool, 0, query_count);
+
+        // runs before the first frame, the font atlas may still be on the upload queue
+        auto upload_wait_value = vulkan->uploads->RecordAcquires(command_buffer.cmd_buffer);
+        {
+            auto barriers = std::array{
+                vk::ImageMemoryBarrier2()
+                    .setSrcStageMask(vk::PipelineStageFlagBits2::eTopOfPipe)
+                    .setDstStageMask(vk::PipelineStageFlagBits2::eComputeShader)
+                    .setSrcAccessMask(vk::AccessFlagBits2{})
+                    .setDstAccessMask(vk::AccessFlagBits2::eShaderRead | vk::AccessFlagBits2::eShaderWrite)
+                    .setOldLayout(vk::ImageLayout::eUndefined)
+                    .setNewLayout(vk::ImageLayout::eGeneral)
+                    .setImage(rasterizer_targets[0].texture.image)
+                    .setSubresourceRange(vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1)),
+            };
+
+            command_buffer.cmd_buffer.pipelineBarrier2(vk::DependencyInfo({}, {}, {}, barriers));
+        }
+
+        // the candidate layouts are destroyed after tuning, so they must not end up in the bind group cache
+        auto bind_group = GetRasterizerBindGroup(&command_buffer, states[0].bind_group_layouts[0], &rasterizer_targets[0].texture, true);
+        command_buffer.cmd_buffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, states[0].pipeline_layout, 0, 1, &bind_group, 0, nullptr);
+        command_buffer.cmd_buffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, states[0].pipeline_layout, BindlessTextureTable::BIND_GROUP_INDEX, 1, &vulkan->textures->bind_group, 0, nullptr);
+
+        u32 query = 0;
+        for (u32 repetition = 0; repetition < repetitions; ++repetition) {
+            for (auto& state : states) {
+                // keep runs from overlapping so each one is timed on its own
+                auto memory_barriers = std::array{
+                    vk::MemoryBarrier2()
+                        .setSrcStageMask(vk::PipelineStageFlagBits2::eComputeShader)
+                        .setDstStageMask(vk::PipelineStageFlagBits2::eComputeShader)
+                        .setSrcAccessMask(vk::AccessFlagBits2::eShaderWrite)
+                        .setDstAccessMask(vk::AccessFlagBits2::eShaderRead | vk::AccessFlagBits2::eShaderWrite)
+                };
+                command_buffer.cmd_buffer.pipelineBarrier2(vk::DependencyInfo({}, memory_barriers, {}, {}));
+
+                command_buffer.cmd_buffer.writeTimestamp2(vk::PipelineStageFlagBits2::eComputeShader, query_pool, query++);
+                command_buffer.cmd_buffer.bindPipeline(vk::PipelineBindPoint::eCompute, state.pipeline);
+
+                for (u32 i = 0; i < indices.size(); i += 3) {
+                    auto& v0 = vertices[indices[i + 0]];
+                    auto& v1 = vertices[indices[i + 1]];
+                    auto& v2 = vertices[indices[i + 2]];
+
+                    auto triangle_pixels = ImRect(ImFloor(ImMin(ImMin(v0.pos, v1.pos), v2.pos)), ImFloor(ImMax(ImMax(v0.pos, v1.pos), v2.pos)) + ImVec2(1.0F, 1.0F));
+                    triangle_pixels.ClipWithFull(ImRect(ImVec2(0.0F, 0.0F), target_size));
+
+                    auto push_constants = RasterizerPushConstants{
+                        .index_buffer_reference = gpu_buffer_device_address(&idx_buffer_info),
+                        .vertex_buffer_reference = gpu_buffer_device_address(&vtx_buffer_info),
+                        .viewport_scale = ImVec2(1.0F, 1.0F),
+                        .index_offset = i,
+                        .clip_rect_min_x = triangle_pixels.Min.x,
+                        .clip_rect_min_y = triangle_pixels.Min.y,
+                        .clip_rect_max_x = triangle_pixels.Max.x,
+                        .clip_rect_max_y = triangle_pixels.Max.y,
+                        .texture_index = imgui->texture.bindless_index,
+                    };
+
+                    command_buffer.cmd_buffer.pushConstants(state.pipeline_layout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(push_constants), &push_constants);
+                    gpu_dispatch_threads(command_buffer.cmd_buffer, &state, static_cast<u32>(triangle_pixels.GetWidth()), static_cast<u32>(triangle_pixels.GetHeight()), 1);
+                }
+
+                command_buffer.cmd_buffer.writeTimestamp2(vk::PipelineStageFlagBits2::eComputeShader, query_pool, query++);
+            }
+        }
+        command_buffer.cmd_buffer.end();
+
+        auto fence = context.logical_device.createFence(vk::FenceCreateInfo());
+
+        std::vector<vk::SemaphoreSubmitInfo> wait_infos;
+        if (upload_wait_value != 0) {
+            wait_infos.emplace_back(vulkan->uploads->timeline_semaphore, upload_wait_value, vk::PipelineStageFlagBits2::eComputeShader);
+        }
+        auto command_buffer_infos = std::array{
+            vk::CommandBufferSubmitInfo(command_buffer.cmd_buffer)
         };
 
-        graphics_bind_group_layout = vulkan->context.logical_device.createDescriptorSetLayout(vk::DescriptorSetLayoutCreateInfo({}, entries));
+        vulkan->submissions->Submit(context.graphics_queue, vk::SubmitInfo2({}, wait_infos, command_buffer_infos, {}), fence);
+        vk::resultCheck(context.logical_device.waitForFences(1, &fence, VK_TRUE, UINT64_MAX), "Failed to wait for fence");
+        context.logical_device.destroyFence(fence);
+
+        std::vector<u64> timestamps(query_count);
+        vk::resultCheck(context.logical_device.getQueryPoolResults(query_pool, 0, query_count, timestamps.size() * sizeof(u64), timestamps.data(), sizeof(u64), vk::QueryResultFlagBits::e64 | vk::QueryResultFlagBits::eWait), "Failed to read timestamps");
 
+        context.logical_device.destroyQueryPool(query_pool);
+        gpu_destroy_command_buffer(&context, &command_buffer);
+        for (auto& state : states) {
+            gpu_destroy_compute_pipeline_state(&context, &state);
+        }
+
+        auto timestamp_mask = timestamp_valid_bits >= 64 ? ~0ull : (1ull << timestamp_valid_bits) - 1ull;
+
+        std::vector<f64> best_times(candidates.size(), std::numeric_limits<f64>::max());
+        for (u32 repetition = 0; repetition < repetitions; ++repetition) {
+            for (usize i = 0; i < candidates.size(); ++i) {
+                auto base = (repetition * candidates.size() + i) * 2;
+                auto ticks = (timestamps[base + 1] - timestamps[base + 0]) & timestamp_mask;
+                best_times[i] = std::min(best_times[i], static_cast<f64>(ticks) * properties.limits.timestampPeriod * 1e-6);
+            }
+        }
+
+        usize best = 0;
+        for (usize i = 0; i < candidates.size(); ++i) {
+            if (best_times[i] < best_times[best]) {
+                best = i;
+            }
+        }
+        return candidates[best];
+    }
+
+    void CreateGraphicsPipelineState() {
         auto attachments = std::array {
             vk::PipelineColorBlendAttachmentState{}
                 .setBlendEnable(false)
@@ -459,10 +1975,6 @@ struct App {
         gpu_create_shader_object(&vulkan->context, &vert_shader_object, &shader_object_infos[0]);
         gpu_create_shader_object(&vulkan->context, &frag_shader_object, &shader_object_infos[1]);
 
-        auto bind_group_layouts = std::array{
-            graphics_bind_group_layout
-        };
-
         auto shader_objects = std::array{
             &vert_shader_object,
             &frag_shader_object
@@ -479,8 +1991,6 @@ struct App {
             .color_blend_state      = {
                 .attachments = attachments
             },
-            .bind_group_layouts     = bind_group_layouts,
-            .push_constant_ranges   = {}
         };
 
         vk::PipelineRenderingCreateInfo rendering_create_info = {};
@@ -493,11 +2003,16 @@ struct App {
     }
 };
 
-auto main() -> i32 {
+auto main(i32 argc, char** argv) -> i32 {
     // setenv("MVK_DEBUG", "1", 1);
 
+    auto args = std::span(argv, static_cast<usize>(argc));
+    auto tune_rasterizer = std::any_of(args.begin(), args.end(), [](const char* arg) {
+        return std::string_view(arg) == "--tune-rasterizer";
+    });
+
     try {
-        auto app = App();
+        auto app = App(tune_rasterizer);
         app.Start();
         return 0;
     } catch(const std::exception& e) {